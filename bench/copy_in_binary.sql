@@ -0,0 +1,4 @@
+-- COPY one week of data in binary format (RRTimeslice_recv, CData_recv).
+BEGIN;
+COPY bench_copy FROM ':datadir/copy.bin' (FORMAT binary);
+ROLLBACK;
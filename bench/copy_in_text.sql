@@ -0,0 +1,4 @@
+-- COPY one week of data in text format (RRTimeslice_in, CData_in).
+BEGIN;
+COPY bench_copy FROM ':datadir/copy.txt';
+ROLLBACK;
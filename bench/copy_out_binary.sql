@@ -0,0 +1,2 @@
+-- COPY one week of data in binary format (RRTimeslice_send, CData_send).
+COPY bench_fetch TO '/dev/null' (FORMAT binary);
@@ -0,0 +1,2 @@
+-- COPY one week of data in text format (RRTimeslice_out, CData_out).
+COPY bench_fetch TO '/dev/null';
@@ -0,0 +1,5 @@
+-- PostRR_fetch() of a random one day window of the bench_fetch archive.
+\set off random(0, 6 * 86400)
+SELECT count(*) FROM PostRR_fetch('bench_fetch', 'ts', 'value',
+	to_timestamp(1325376000 + :off), to_timestamp(1325462400 + :off),
+	'none');
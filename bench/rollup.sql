@@ -0,0 +1,4 @@
+-- Roll up the full week of the bench_fetch archive into hourly slices.
+SELECT count(*) FROM (
+	SELECT ts::rrtimeslice(3600, 168), Consolidate(value)
+		FROM bench_fetch GROUP BY 1) AS r;
@@ -0,0 +1,51 @@
+-- PostRR benchmark setup
+--
+-- Creates the archives used by the pgbench scripts in this directory and
+-- fills them with reproducible data (all data is generated from a fixed
+-- random seed, starting at 2012-01-01 00:00:00 UTC, i.e. epoch 1325376000).
+--
+-- Expects the psql variable 'datadir' to point to a directory writable by
+-- the server, which is used to store the data files for the COPY benchmarks.
+--
+-- Archive sizes:
+--  - bench_single:  1 archive, 10 second slices, 1 day (8640 slices)
+--  - bench_fanout:  4 archives, 10s/1d, 1m/1d, 5m/1w, 1h/30d
+--  - bench_multi:   1 multi-series archive, 1 minute slices, 1 day,
+--                   up to 1000 series
+--  - bench_wrap:    1 archive, 10 second slices, 100 slices
+--  - bench_fetch:   1 archive, 1 minute slices, 1 week (10080 slices),
+--                   fully populated
+
+SET client_min_messages = warning;
+
+CREATE EXTENSION IF NOT EXISTS postrr;
+
+SELECT setseed(0.42);
+
+SELECT PostRR_create_archive('bench_single', 'bench_single', 10, 8640);
+
+SELECT PostRR_create_archive('bench_fanout', 'bench_fanout_10s', 10, 8640);
+SELECT PostRR_create_archive('bench_fanout', 'bench_fanout_1m', 60, 1440);
+SELECT PostRR_create_archive('bench_fanout', 'bench_fanout_5m', 300, 2016);
+SELECT PostRR_create_archive('bench_fanout', 'bench_fanout_1h', 3600, 720);
+
+SELECT PostRR_create_archive('bench_multi', 'bench_multi', 60, 1440, true);
+
+SELECT PostRR_create_archive('bench_wrap', 'bench_wrap', 10, 100);
+CREATE SEQUENCE bench_wrap_seq;
+
+SELECT PostRR_create_archive('bench_fetch', 'bench_fetch', 60, 10080);
+INSERT INTO bench_fetch (ts, value)
+	SELECT to_timestamp(1325376000 + 60 * i),
+			(100 * random())::numeric::cdata
+		FROM generate_series(1, 10080) AS i;
+
+-- target of the COPY FROM benchmarks (rolled back after each transaction)
+CREATE TABLE bench_copy (ts rrtimeslice(60, 10080), value cdata);
+
+\set copy_text :datadir '/copy.txt'
+\set copy_binary :datadir '/copy.bin'
+COPY (SELECT ts::timestamptz, value FROM bench_fetch) TO :'copy_text';
+COPY bench_fetch TO :'copy_binary' (FORMAT binary);
+
+ANALYZE;
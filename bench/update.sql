@@ -0,0 +1,8 @@
+-- PostRR_update() of the rraname given by -D rraname=<name> at a random
+-- point in time of the first day. All timestamps fall into the same ring
+-- period, so updates never get rejected as being too old.
+--
+-- Concurrent inserts of the same slice are not handled by PostRR_update(),
+-- so this script is meant to be run by a single client only.
+\set off random(1, 86400)
+SELECT PostRR_update(':rraname', to_timestamp(1325376000 + :off), random());
@@ -0,0 +1,7 @@
+-- Multi-writer PostRR_update() of the bench_multi archive. Each client
+-- writes to its own set of series (series id modulo the number of clients,
+-- given by -D clients=<n>) to avoid concurrent inserts of the same slice.
+\set off random(1, 86400)
+\set id random(0, 999 / :clients) * :clients + :client_id
+SELECT PostRR_update('bench_multi', :id, to_timestamp(1325376000 + :off),
+	random());
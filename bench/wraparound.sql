@@ -0,0 +1,5 @@
+-- PostRR_update() of strictly increasing timestamps in the small
+-- bench_wrap ring, replacing the oldest slice once the ring is full.
+-- Meant to be run by a single client only.
+SELECT PostRR_update('bench_wrap',
+	to_timestamp(1325376000 + 10 * nextval('bench_wrap_seq')), random());
@@ -104,8 +104,92 @@ case "$1" in
 		shift
 		$BIN_DIR/pg_restore -h $TARGET/var/run/postgresql/ -p 2345 "$@"
 		;;
+	check)
+		if test $# -ne 1; then
+			echo "Too many arguments!" >&2
+			echo "Usage: $0 check" >&2
+			exit 1
+		fi
+		if ! test -e version; then
+			./version-gen.sh > /dev/null
+		fi
+		. ./version
+		# the latest value cache requires PostRR to be preloaded
+		$0 start -B -o "-c shared_preload_libraries=postrr-$VERSION_MAJOR.$VERSION_MINOR"
+		rc=0
+		PGHOST=$TARGET/var/run/postgresql PGPORT=2345 \
+			make -C src -f Makefile.pgxs installcheck || rc=$?
+		$0 stop
+		exit $rc
+		;;
+	bench)
+		shift
+		clients=4
+		duration=30
+		while getopts "c:T:" opt; do
+			case "$opt" in
+				c)
+					clients=$OPTARG
+					;;
+				T)
+					duration=$OPTARG
+					;;
+				*)
+					echo "Usage: $0 bench [-c <clients>] [-T <seconds>]" >&2
+					exit 1
+					;;
+			esac
+		done
+
+		BENCH_DIR=$PWD/bench
+		RESULT_DIR=$TARGET/bench/`date +%Y%m%d-%H%M%S`
+		PG_ARGS="-h $TARGET/var/run/postgresql/ -p 2345"
+		mkdir -p $RESULT_DIR
+
+		$BIN_DIR/dropdb $PG_ARGS --if-exists postrr_bench
+		$BIN_DIR/createdb $PG_ARGS postrr_bench
+		$BIN_DIR/psql $PG_ARGS -X -q -v ON_ERROR_STOP=1 \
+			-v datadir=$RESULT_DIR -f $BENCH_DIR/setup.sql postrr_bench \
+			> $RESULT_DIR/setup.log
+
+		# name, number of clients, script, pgbench args
+		run_bench() {
+			name=$1
+			c=$2
+			script=$3
+			shift 3
+			echo "Running $name ($c clients, ${duration}s) ..." >&2
+			$BIN_DIR/pgbench $PG_ARGS -n -c $c -j $c -T $duration \
+				--random-seed=42 -D datadir=$RESULT_DIR -D clients=$c \
+				-f $BENCH_DIR/$script "$@" postrr_bench \
+				> $RESULT_DIR/$name.log 2>&1
+			tps=$( sed -n -r -e 's/^tps = ([0-9.]+) .*/\1/p' \
+				$RESULT_DIR/$name.log | tail -n1 )
+			lat=$( sed -n -r -e 's/^latency average = ([0-9.]+) ms/\1/p' \
+				$RESULT_DIR/$name.log )
+			printf "%-20s %8s %12s %12s\n" $name $c $tps $lat \
+				>> $RESULT_DIR/summary.txt
+		}
+
+		printf "%-20s %8s %12s %12s\n" benchmark clients tps "latency/ms" \
+			> $RESULT_DIR/summary.txt
+		run_bench update_single 1 update.sql -D rraname=bench_single
+		run_bench update_fanout 1 update.sql -D rraname=bench_fanout
+		run_bench update_series 1 update_series.sql
+		run_bench update_multi $clients update_series.sql
+		run_bench wraparound 1 wraparound.sql
+		run_bench fetch $clients fetch.sql
+		run_bench rollup 1 rollup.sql
+		run_bench copy_in_text 1 copy_in_text.sql
+		run_bench copy_in_binary 1 copy_in_binary.sql
+		run_bench copy_out_text 1 copy_out_text.sql
+		run_bench copy_out_binary 1 copy_out_binary.sql
+
+		echo "Results stored in $RESULT_DIR" >&2
+		cat $RESULT_DIR/summary.txt
+		;;
 	*)
-		echo "Usage: $0 setup|client|stop|start" >&2
+		echo "Usage: $0 setup|client|stop|start|check|bench" >&2
 		echo ""
 		echo "  - setup"
 		echo "    Set up a new PostgreSQL server listening on port 2345."
@@ -118,6 +202,16 @@ case "$1" in
 		echo "    Stop the PostgreSQL server."
 		echo "  - restart"
 		echo "    Restart a background PostgreSQL server process."
+		echo "  - check"
+		echo "    Start the PostgreSQL server with PostRR preloaded, run the"
+		echo "    regression tests against it (PostRR has to be installed)"
+		echo "    and stop the server again."
+		echo "  - bench [-c <clients>] [-T <seconds>]"
+		echo "    Run the pgbench based benchmarks in bench/ against the"
+		echo "    (running) PostgreSQL server and print a summary of the"
+		echo "    results. The multi-writer and fetch benchmarks use"
+		echo "    <clients> concurrent clients (default: 4); each benchmark"
+		echo "    runs for <seconds> seconds (default: 30)."
 		echo ""
 		echo "Environment variables:"
 		echo "  - TARGET"
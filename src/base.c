@@ -42,6 +42,21 @@
 PG_MODULE_MAGIC;
 #endif
 
+void
+_PG_init(void);
+
+/*
+ * module initialization
+ */
+
+void
+_PG_init(void)
+{
+	rrcascade_init();
+	rrcache_init();
+	rrstat_init();
+} /* _PG_init */
+
 /*
  * prototypes for PostgreSQL functions
  */
@@ -30,8 +30,11 @@
  */
 
 #include "postrr.h"
+#include "probes.h"
+#include "rrcore.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 
@@ -40,12 +43,17 @@
 
 /* Postgres utilities */
 #include <catalog/pg_type.h>
+#include <libpq/pqformat.h>
 #include <utils/array.h>
 
+#if PG_VERSION_NUM >= 120000
+#	include <common/shortest_dec.h>
+#endif
+
 enum {
-	CF_AVG = 0,
-	CF_MIN = 1,
-	CF_MAX = 2
+	CF_AVG = RRCORE_CF_AVG,
+	CF_MIN = RRCORE_CF_MIN,
+	CF_MAX = RRCORE_CF_MAX
 };
 
 #define CF_TO_STR(cf) \
@@ -75,6 +83,8 @@ PG_FUNCTION_INFO_V1(cdata_validate);
 
 PG_FUNCTION_INFO_V1(cdata_in);
 PG_FUNCTION_INFO_V1(cdata_out);
+PG_FUNCTION_INFO_V1(cdata_recv);
+PG_FUNCTION_INFO_V1(cdata_send);
 PG_FUNCTION_INFO_V1(cdata_typmodin);
 PG_FUNCTION_INFO_V1(cdata_typmodout);
 
@@ -125,6 +135,7 @@ cdata_in(PG_FUNCTION_ARGS)
 {
 	cdata_t *data;
 	int32 typmod;
+	int32 cf = -1;
 
 	char *val_str, *orig;
 	char *endptr = NULL;
@@ -167,6 +178,41 @@ cdata_in(PG_FUNCTION_ARGS)
 	while ((*endptr != '\0') && isspace((int)*endptr))
 		++endptr;
 
+	/* accept the output format as well: "<value> (<CF> U:<undef>/<num>)" */
+	if (*endptr == '(') {
+		char cf_str[4];
+		int  consumed = 0;
+
+		if ((sscanf(endptr, "(%3s U:%d/%d)%n", cf_str, &data->undef_num,
+						&data->val_num, &consumed) != 3) || (! consumed)
+				|| (data->val_num < 1) || (data->undef_num < 0)
+				|| (data->undef_num > data->val_num))
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("invalid input syntax for cdata: \"%s\"",
+							orig)
+					));
+
+		if (! strcasecmp(cf_str, "AVG"))
+			cf = CF_AVG;
+		else if (! strcasecmp(cf_str, "MIN"))
+			cf = CF_MIN;
+		else if (! strcasecmp(cf_str, "MAX"))
+			cf = CF_MAX;
+		else
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("invalid input syntax for cdata: \"%s\"",
+							orig),
+						errdetail("unknown consolidation function: %s",
+							cf_str)
+					));
+
+		endptr += consumed;
+		while ((*endptr != '\0') && isspace((int)*endptr))
+			++endptr;
+	}
+
 	if (*endptr != '\0')
 		ereport(ERROR, (
 					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
@@ -174,8 +220,18 @@ cdata_in(PG_FUNCTION_ARGS)
 					errdetail("garbage found after number: \"%s\"", endptr)
 				));
 
+	if ((typmod > 0) && (cf >= 0) && (cf != typmod) && (data->val_num > 1))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid input value for cdata('%s'): "
+						"consolidation function %s does not match",
+						CF_TO_STR(typmod), CF_TO_STR(cf))
+				));
+
 	if (typmod > 0)
 		data->cf = typmod;
+	else if (cf >= 0)
+		data->cf = cf;
 	else
 		data->cf = 0;
 
@@ -187,6 +243,7 @@ cdata_out(PG_FUNCTION_ARGS)
 {
 	cdata_t *data;
 
+	char  val_str[32];
 	char  cd_str[1024];
 	char *result;
 
@@ -198,14 +255,87 @@ cdata_out(PG_FUNCTION_ARGS)
 
 	data = PG_GETARG_CDATA_P(0);
 
-	snprintf(cd_str, sizeof(cd_str), "%g (%s U:%i/%i)",
-			data->value, CF_TO_STR(data->cf),
-			data->undef_num, data->val_num);
+	/* use a representation which reads back exactly (the shortest one, if
+	 * available, like float8out) to allow for lossless input */
+#if PG_VERSION_NUM >= 120000
+	double_to_shortest_decimal_buf(data->value, val_str);
+#else
+	snprintf(val_str, sizeof(val_str), "%.17g", data->value);
+#endif
+
+	snprintf(cd_str, sizeof(cd_str), "%s (%s U:%i/%i)",
+			val_str, CF_TO_STR(data->cf), data->undef_num, data->val_num);
 
 	result = pstrdup(cd_str);
 	PG_RETURN_CSTRING(result);
 } /* cdata_out */
 
+Datum
+cdata_recv(PG_FUNCTION_ARGS)
+{
+	cdata_t *data;
+	StringInfo buf;
+	int32 typmod;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("cdata_recv() expects three arguments"),
+					errhint("Usage: cdata_recv(internal, oid, typmod)")
+				));
+
+	buf    = (StringInfo)PG_GETARG_POINTER(0);
+	typmod = PG_GETARG_INT32(2);
+
+	data = (cdata_t *)palloc0(sizeof(*data));
+	data->value     = pq_getmsgfloat8(buf);
+	data->undef_num = (int32)pq_getmsgint(buf, sizeof(int32));
+	data->val_num   = (int32)pq_getmsgint(buf, sizeof(int32));
+	data->cf        = (int32)pq_getmsgint(buf, sizeof(int32));
+
+	if ((data->val_num < 0) || (data->undef_num < 0)
+			|| (data->undef_num > data->val_num)
+			|| (data->cf < CF_AVG) || (data->cf > CF_MAX))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					errmsg("invalid external cdata value")
+				));
+
+	if ((typmod > 0) && (data->cf != typmod) && (data->val_num > 1))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid input value for cdata('%s'): "
+						"consolidation function %s does not match",
+						CF_TO_STR(typmod), CF_TO_STR(data->cf))
+				));
+
+	if (typmod > 0)
+		data->cf = typmod;
+
+	PG_RETURN_CDATA_P(data);
+} /* cdata_recv */
+
+Datum
+cdata_send(PG_FUNCTION_ARGS)
+{
+	cdata_t *data;
+	StringInfoData buf;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("cdata_send() expects one argument"),
+					errhint("Usage: cdata_send(cdata)")
+				));
+
+	data = PG_GETARG_CDATA_P(0);
+
+	pq_begintypsend(&buf);
+	pq_sendfloat8(&buf, data->value);
+	pq_sendint(&buf, data->undef_num, sizeof(int32));
+	pq_sendint(&buf, data->val_num, sizeof(int32));
+	pq_sendint(&buf, data->cf, sizeof(int32));
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+} /* cdata_send */
+
 Datum
 cdata_typmodin(PG_FUNCTION_ARGS)
 {
@@ -363,9 +493,6 @@ cdata_update(PG_FUNCTION_ARGS)
 	cdata_t *data;
 	cdata_t *update;
 
-	float8 value;
-	float8 u_value;
-
 	int32 val_num;
 	int32 u_val_num;
 
@@ -384,6 +511,18 @@ cdata_update(PG_FUNCTION_ARGS)
 	if (! update)
 		PG_RETURN_CDATA_P(data);
 
+	TRACE_POSTRR_CDATA_UPDATE_START(data, update);
+
+	/* the first argument may point into a shared buffer (e.g., when used in
+	 * an UPDATE statement); modify it in place only if it's an aggregate's
+	 * transition value */
+	if (! AggCheckCallContext(fcinfo, NULL)) {
+		cdata_t *copy = (cdata_t *)palloc(sizeof(*copy));
+
+		memcpy(copy, data, sizeof(*copy));
+		data = copy;
+	}
+
 	if ((data->cf != update->cf) && (update->val_num > 1))
 		ereport(ERROR, (
 					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
@@ -391,41 +530,76 @@ cdata_update(PG_FUNCTION_ARGS)
 						"consolidation function")
 				));
 
-	value     = data->value;
-	u_value   = update->value;
-
 	val_num   = data->val_num - data->undef_num;
 	u_val_num = update->val_num - update->undef_num;
 
+	data->value = cdata_consolidate(data->cf, data->value, val_num,
+			update->value, u_val_num);
+
 	data->undef_num += update->undef_num;
 	data->val_num   += update->val_num;
 
-	if (isnan(value) || isnan(u_value)) {
-		data->value = isnan(value) ? u_value : value;
-		PG_RETURN_CDATA_P(data);
-	}
-
-	switch (data->cf) {
-		case CF_AVG:
-			data->value = ((value * val_num) + (u_value * u_val_num))
-				/ (val_num + u_val_num);
-			break;
-		case CF_MIN:
-			data->value = (value < u_value) ? value : u_value;
-			break;
-		case CF_MAX:
-			data->value = (value >= u_value) ? value : u_value;
-			break;
-		default:
-			ereport(ERROR, (
-						errcode(ERRCODE_DATA_CORRUPTED),
-						errmsg("unknown consolidation function %d",
-							data->cf)
-					));
-			break;
-	}
+	TRACE_POSTRR_CDATA_UPDATE_DONE(data);
 	PG_RETURN_CDATA_P(data);
 } /* cdata_update */
 
+float8
+cdata_consolidate(int32 cf, float8 value, int32 val_num,
+		float8 u_value, int32 u_val_num)
+{
+	double result = NAN;
+
+	if (rrcore_consolidate(cf, value, val_num, u_value, u_val_num, &result))
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("unknown consolidation function %d", cf)
+				));
+	return result;
+} /* cdata_consolidate */
+
+cdata_t *
+cdata_create(float8 value, int32 undef_num, int32 val_num, int32 cf)
+{
+	cdata_t *data;
+
+	data = (cdata_t *)palloc0(sizeof(*data));
+
+	data->value     = value;
+	data->undef_num = undef_num;
+	data->val_num   = val_num;
+	data->cf        = cf;
+	return data;
+} /* cdata_create */
+
+const char *
+cdata_cf_to_str(int32 cf)
+{
+	return CF_TO_STR(cf);
+} /* cdata_cf_to_str */
+
+float8
+cdata_get_value(cdata_t *data)
+{
+	return data->value;
+} /* cdata_get_value */
+
+int32
+cdata_get_cf(cdata_t *data)
+{
+	return data->cf;
+} /* cdata_get_cf */
+
+int32
+cdata_get_undef_num(cdata_t *data)
+{
+	return data->undef_num;
+} /* cdata_get_undef_num */
+
+int32
+cdata_get_val_num(cdata_t *data)
+{
+	return data->val_num;
+} /* cdata_get_val_num */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
@@ -0,0 +1,445 @@
+/*
+ * PostRR - src/cvector.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A PostgreSQL data-type providing a vector of consolidated data points,
+ * e.g. for a group of related data sources which are updated together. The
+ * values are stored in a struct-of-arrays layout.
+ */
+
+#include "postrr.h"
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* Postgres utilities */
+#include <catalog/pg_type.h>
+#include <lib/stringinfo.h>
+#include <utils/array.h>
+
+#if PG_VERSION_NUM >= 120000
+#	include <common/shortest_dec.h>
+#endif
+
+/*
+ * data type
+ */
+
+struct cvector {
+	char  vl_len_[4];
+	int32 cf;
+	int32 num;
+	int32 padding;
+
+	/* float8 values[num]; int32 undef_num[num]; int32 val_num[num]; */
+	float8 values[1];
+};
+
+#define CVECTOR_SIZE(num) \
+	(offsetof(cvector_t, values) \
+		+ (num) * (sizeof(float8) + 2 * sizeof(int32)))
+
+#define CVECTOR_UNDEF_NUM(v) ((int32 *)((v)->values + (v)->num))
+#define CVECTOR_VAL_NUM(v) (CVECTOR_UNDEF_NUM(v) + (v)->num)
+
+/* number of elements is limited to keep a vector on a single page */
+#define CVECTOR_MAX_NUM 256
+
+/*
+ * internal helper functions
+ */
+
+static cvector_t *
+cvector_create(int32 num, int32 cf)
+{
+	cvector_t *vec;
+
+	if ((num <= 0) || (num > CVECTOR_MAX_NUM))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid number of cvector elements: %d", num),
+					errhint("A cvector must have 1 to %d elements",
+						CVECTOR_MAX_NUM)
+				));
+
+	vec = (cvector_t *)palloc0(CVECTOR_SIZE(num));
+	SET_VARSIZE(vec, CVECTOR_SIZE(num));
+
+	vec->cf  = cf;
+	vec->num = num;
+	return vec;
+} /* cvector_create */
+
+static cvector_t *
+cvector_copy(cvector_t *vec)
+{
+	cvector_t *copy;
+
+	copy = (cvector_t *)palloc(VARSIZE(vec));
+	memcpy(copy, vec, VARSIZE(vec));
+	return copy;
+} /* cvector_copy */
+
+static void
+cvector_set(cvector_t *vec, int32 i, float8 value)
+{
+	vec->values[i] = value;
+	CVECTOR_VAL_NUM(vec)[i] = 1;
+	CVECTOR_UNDEF_NUM(vec)[i] = isnan(value) ? 1 : 0;
+} /* cvector_set */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(cvector_in);
+PG_FUNCTION_INFO_V1(cvector_out);
+
+PG_FUNCTION_INFO_V1(cvector_to_cvector);
+PG_FUNCTION_INFO_V1(float8array_to_cvector);
+PG_FUNCTION_INFO_V1(cvector_to_float8array);
+
+PG_FUNCTION_INFO_V1(cvector_update);
+PG_FUNCTION_INFO_V1(cvector_get);
+
+/*
+ * public API
+ */
+
+Datum
+cvector_in(PG_FUNCTION_ARGS)
+{
+	cvector_t *vec;
+	int32 typmod;
+
+	float8 values[CVECTOR_MAX_NUM];
+	int32  num = 0;
+	int32  i;
+
+	char *val_str, *orig;
+	char *endptr = NULL;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("cvector_in() expects three arguments"),
+					errhint("Usage: cvector_in(col_name, oid, typmod)")
+				));
+
+	val_str = PG_GETARG_CSTRING(0);
+	typmod  = PG_GETARG_INT32(2);
+
+	orig = val_str;
+	while ((*val_str != '\0') && isspace((int)*val_str))
+		++val_str;
+
+	if (*val_str != '{')
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid input syntax for cvector: \"%s\"", orig),
+					errdetail("cvector value must start with \"{\"")
+				));
+	++val_str;
+
+	while (42) {
+		if (num >= CVECTOR_MAX_NUM)
+			ereport(ERROR, (
+						errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						errmsg("too many cvector elements"),
+						errhint("A cvector must have 1 to %d elements",
+							CVECTOR_MAX_NUM)
+					));
+
+		errno = 0;
+		values[num] = strtod(val_str, &endptr);
+
+		if ((endptr == val_str) || errno)
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("invalid input syntax for cvector: \"%s\"",
+							orig)
+					));
+		++num;
+
+		val_str = endptr;
+		while ((*val_str != '\0') && isspace((int)*val_str))
+			++val_str;
+
+		if (*val_str == ',') {
+			++val_str;
+			continue;
+		}
+		else if (*val_str == '}') {
+			++val_str;
+			break;
+		}
+
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid input syntax for cvector: \"%s\"", orig),
+					errdetail("expected \",\" or \"}\" but found \"%s\"",
+						val_str)
+				));
+	}
+
+	while ((*val_str != '\0') && isspace((int)*val_str))
+		++val_str;
+
+	if (*val_str != '\0')
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid input syntax for cvector: \"%s\"", orig),
+					errdetail("garbage found after vector: \"%s\"", val_str)
+				));
+
+	vec = cvector_create(num, (typmod > 0) ? typmod : 0);
+	for (i = 0; i < num; ++i)
+		cvector_set(vec, i, values[i]);
+
+	PG_RETURN_CVECTOR_P(vec);
+} /* cvector_in */
+
+Datum
+cvector_out(PG_FUNCTION_ARGS)
+{
+	cvector_t *vec;
+
+	StringInfoData buf;
+	char  val_str[32];
+	int32 i;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("cvector_out() expects one argument"),
+					errhint("Usage: cvector_out(cvector)")
+				));
+
+	vec = PG_GETARG_CVECTOR_P(0);
+
+	initStringInfo(&buf);
+	appendStringInfoChar(&buf, '{');
+	for (i = 0; i < vec->num; ++i) {
+		/* as for cdata, use a representation which reads back exactly */
+#if PG_VERSION_NUM >= 120000
+		double_to_shortest_decimal_buf(vec->values[i], val_str);
+#else
+		snprintf(val_str, sizeof(val_str), "%.17g", vec->values[i]);
+#endif
+		appendStringInfo(&buf, "%s%s", i ? ", " : "", val_str);
+	}
+	appendStringInfo(&buf, "} (%s U:", cdata_cf_to_str(vec->cf));
+	for (i = 0; i < vec->num; ++i)
+		appendStringInfo(&buf, "%s%i/%i", i ? ", " : "",
+				CVECTOR_UNDEF_NUM(vec)[i], CVECTOR_VAL_NUM(vec)[i]);
+	appendStringInfoChar(&buf, ')');
+
+	PG_RETURN_CSTRING(buf.data);
+} /* cvector_out */
+
+Datum
+cvector_to_cvector(PG_FUNCTION_ARGS)
+{
+	cvector_t *vec;
+	int32 typmod;
+	int32 i;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("cvector_to_cvector() "
+						"expects three arguments"),
+					errhint("Usage: cvector_to_cvector"
+						"(cvector, typmod, is_explicit)")
+				));
+
+	vec    = PG_GETARG_CVECTOR_P(0);
+	typmod = PG_GETARG_INT32(1);
+
+	if ((typmod < 0) || (vec->cf == typmod))
+		PG_RETURN_CVECTOR_P(vec);
+
+	for (i = 0; i < vec->num; ++i)
+		if (CVECTOR_VAL_NUM(vec)[i] > 1)
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid cast: cannot cast cvector "
+							"with different typmod (yet)")
+					));
+
+	vec = cvector_copy(vec);
+	vec->cf = typmod;
+	PG_RETURN_CVECTOR_P(vec);
+} /* cvector_to_cvector */
+
+Datum
+float8array_to_cvector(PG_FUNCTION_ARGS)
+{
+	ArrayType *array;
+	cvector_t *vec;
+	int32 typmod;
+
+	Datum *elems;
+	bool  *nulls;
+	int    n;
+	int32  i;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("float8array_to_cvector() "
+						"expects three arguments"),
+					errhint("Usage: float8array_to_cvector"
+						"(double precision[], typmod, is_explicit)")
+				));
+
+	array  = PG_GETARG_ARRAYTYPE_P(0);
+	typmod = PG_GETARG_INT32(1);
+
+	if (ARR_NDIM(array) > 1)
+		ereport(ERROR, (
+					errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+					errmsg("array must be one-dimensional")
+				));
+
+	deconstruct_array(array, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL,
+			/* elmalign = */ 'd', &elems, &nulls, &n);
+
+	vec = cvector_create(n, (typmod >= 0) ? typmod : 0);
+	for (i = 0; i < n; ++i)
+		cvector_set(vec, i, nulls[i] ? NAN : DatumGetFloat8(elems[i]));
+
+	PG_RETURN_CVECTOR_P(vec);
+} /* float8array_to_cvector */
+
+Datum
+cvector_to_float8array(PG_FUNCTION_ARGS)
+{
+	cvector_t *vec;
+	Datum     *elems;
+	int32      i;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("cvector_to_float8array() expects one argument"),
+					errhint("Usage: cvector_to_float8array(cvector)")
+				));
+
+	vec = PG_GETARG_CVECTOR_P(0);
+
+	elems = (Datum *)palloc(vec->num * sizeof(*elems));
+	for (i = 0; i < vec->num; ++i)
+		elems[i] = Float8GetDatum(vec->values[i]);
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(elems, vec->num, FLOAT8OID,
+				sizeof(float8), FLOAT8PASSBYVAL, /* elmalign = */ 'd'));
+} /* cvector_to_float8array */
+
+Datum
+cvector_update(PG_FUNCTION_ARGS)
+{
+	cvector_t *vec;
+	cvector_t *update;
+	int32 i;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("cvector_update() expects two arguments"),
+					errhint("Usage: cvector_update(cvector, cvector)")
+				));
+
+	if (PG_ARGISNULL(0) && PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+	else if (PG_ARGISNULL(0))
+		PG_RETURN_DATUM(PG_GETARG_DATUM(1));
+	else if (PG_ARGISNULL(1))
+		PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+
+	update = PG_GETARG_CVECTOR_P(1);
+
+	/* modify the first argument in place only if it's an aggregate's
+	 * transition value (and has been detoasted already) */
+	if (AggCheckCallContext(fcinfo, NULL))
+		vec = PG_GETARG_CVECTOR_P(0);
+	else
+		vec = PG_GETARG_CVECTOR_P_COPY(0);
+
+	if (vec->num != update->num)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid update value: number of elements "
+						"does not match (%d != %d)", update->num, vec->num)
+				));
+
+	for (i = 0; i < vec->num; ++i) {
+		int32 val_num   = CVECTOR_VAL_NUM(vec)[i] - CVECTOR_UNDEF_NUM(vec)[i];
+		int32 u_val_num = CVECTOR_VAL_NUM(update)[i]
+			- CVECTOR_UNDEF_NUM(update)[i];
+
+		if ((vec->cf != update->cf) && (CVECTOR_VAL_NUM(update)[i] > 1))
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid update value: incompatible "
+							"consolidation function")
+					));
+
+		vec->values[i] = cdata_consolidate(vec->cf, vec->values[i], val_num,
+				update->values[i], u_val_num);
+
+		CVECTOR_UNDEF_NUM(vec)[i] += CVECTOR_UNDEF_NUM(update)[i];
+		CVECTOR_VAL_NUM(vec)[i]   += CVECTOR_VAL_NUM(update)[i];
+	}
+
+	PG_RETURN_CVECTOR_P(vec);
+} /* cvector_update */
+
+Datum
+cvector_get(PG_FUNCTION_ARGS)
+{
+	cvector_t *vec;
+	int32 i;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("cvector_get() expects two arguments"),
+					errhint("Usage: cvector_get(cvector, index)")
+				));
+
+	vec = PG_GETARG_CVECTOR_P(0);
+	i   = PG_GETARG_INT32(1);
+
+	/* indexes start at 1 (as for arrays) */
+	if ((i < 1) || (i > vec->num))
+		PG_RETURN_NULL();
+	--i;
+
+	PG_RETURN_CDATA_P(cdata_create(vec->values[i],
+				CVECTOR_UNDEF_NUM(vec)[i], CVECTOR_VAL_NUM(vec)[i], vec->cf));
+} /* cvector_get */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -31,5 +31,9 @@ COMMENT ON TYPE RRTimeslice IS 'postrr type: A timeslice implementing round-robi
 
 COMMENT ON TYPE CData IS 'cdata type: A floating point data type (double precision) implementing consolidation functions.';
 
+COMMENT ON TYPE CVector IS 'cvector type: A vector of consolidated data points (see cdata), e.g. for a group of related data sources updated together.';
+
+COMMENT ON TYPE QData IS 'qdata type: A consolidated data point collecting a histogram of the values in order to answer quantile queries.';
+
 -- vim: set tw=78 sw=4 ts=4 noexpandtab :
 
@@ -0,0 +1,103 @@
+/*
+ * PostRR - src/probes.h
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Static tracepoints (USDT probes) of the PostRR hot paths.
+ *
+ * The probes are available as provider "postrr" if PostRR has been
+ * configured using --enable-dtrace (requires sys/sdt.h, as provided by
+ * SystemTap or DTrace). Otherwise, all probes expand to nothing.
+ */
+
+#ifndef POSTRR_PROBES_H
+#define POSTRR_PROBES_H 1
+
+#ifdef POSTRR_ENABLE_DTRACE
+#	include <sys/sdt.h>
+
+#	define POSTRR_PROBE1(name, a1) \
+		DTRACE_PROBE1(postrr, name, a1)
+#	define POSTRR_PROBE2(name, a1, a2) \
+		DTRACE_PROBE2(postrr, name, a1, a2)
+#	define POSTRR_PROBE4(name, a1, a2, a3, a4) \
+		DTRACE_PROBE4(postrr, name, a1, a2, a3, a4)
+#else /* ! POSTRR_ENABLE_DTRACE */
+#	define POSTRR_PROBE1(name, a1) do { } while (0)
+#	define POSTRR_PROBE2(name, a1, a2) do { } while (0)
+#	define POSTRR_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#endif /* POSTRR_ENABLE_DTRACE */
+
+/*
+ * cdata__update__start(cdata_t *data, cdata_t *update),
+ * cdata__update__done(cdata_t *data):
+ * consolidation of a CData value
+ */
+#define TRACE_POSTRR_CDATA_UPDATE_START(data, update) \
+	POSTRR_PROBE2(cdata__update__start, (data), (update))
+#define TRACE_POSTRR_CDATA_UPDATE_DONE(data) \
+	POSTRR_PROBE1(cdata__update__done, (data))
+
+/*
+ * spec__lookup__hit(int32 typmod), spec__lookup__miss(int32 typmod):
+ * lookup of an RRTimeslice spec in the backend-local cache
+ */
+#define TRACE_POSTRR_SPEC_LOOKUP_HIT(typmod) \
+	POSTRR_PROBE1(spec__lookup__hit, (typmod))
+#define TRACE_POSTRR_SPEC_LOOKUP_MISS(typmod) \
+	POSTRR_PROBE1(spec__lookup__miss, (typmod))
+
+/*
+ * update__done(Oid relid, int32 retries, bool rejected, int64 usecs):
+ * a sample has been written to (or rejected from) an archive by
+ * PostRR_update(), taking 'usecs' microseconds
+ *
+ * update__retry(Oid relid, int32 retries):
+ * the update loop had to be retried due to concurrent updates
+ *
+ * update__commit(int num):
+ * a transaction updating 'num' slices (samples which have not been rejected
+ * by PostRR_update()) has been committed
+ */
+#define TRACE_POSTRR_UPDATE_DONE(relid, retries, rejected, usecs) \
+	POSTRR_PROBE4(update__done, (relid), (retries), (rejected), (usecs))
+#define TRACE_POSTRR_UPDATE_RETRY(relid, retries) \
+	POSTRR_PROBE2(update__retry, (relid), (retries))
+#define TRACE_POSTRR_UPDATE_COMMIT(num) \
+	POSTRR_PROBE1(update__commit, (num))
+
+/*
+ * slice__rollover(Oid relid, bool overwritten):
+ * a new slice has been created, replacing an old slice of the ring if
+ * 'overwritten' is true
+ */
+#define TRACE_POSTRR_SLICE_ROLLOVER(relid, overwritten) \
+	POSTRR_PROBE2(slice__rollover, (relid), (overwritten))
+
+#endif /* ! POSTRR_PROBES_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
+
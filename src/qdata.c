@@ -0,0 +1,600 @@
+/*
+ * PostRR - src/qdata.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A PostgreSQL data-type providing consolidated data points which are able
+ * to answer quantile (percentile) queries. Values are collected in a
+ * logarithmic histogram of fixed size (similar to DDSketch) which may be
+ * merged cheaply.
+ */
+
+#include "postrr.h"
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* Postgres utilities */
+#include <utils/array.h>
+
+#if PG_VERSION_NUM >= 120000
+#	include <common/shortest_dec.h>
+#endif
+
+/* number of histogram bins; if values span more than that, the lowest bins
+ * get collapsed, sacrificing accuracy of low quantiles */
+#define QDATA_BINS 256
+
+/* relative accuracy of quantile estimates */
+#define QDATA_ALPHA 0.01
+#define QDATA_GAMMA ((1.0 + QDATA_ALPHA) / (1.0 - QDATA_ALPHA))
+
+/* values with an absolute value less than or equal to this are collected in
+ * a single bin (counted as zero) */
+#define QDATA_MIN_VALUE 1e-9
+
+/* quantile (in percent) used when casting to a scalar value */
+#define QDATA_DEFAULT_QUANTILE 50
+
+/*
+ * data type
+ */
+
+/* logarithmic histogram of the absolute values of one sign */
+typedef struct {
+	/* number of values collected in the bins */
+	int32  bins_num;
+
+	/* key of the first bin */
+	int32  key_offset;
+	uint32 bins[QDATA_BINS];
+} qdata_store_t;
+
+struct qdata {
+	float8 min;
+	float8 max;
+	float8 sum;
+	int32  undef_num;
+	int32  val_num;
+	int32  quantile;
+
+	/* number of values in [-QDATA_MIN_VALUE, QDATA_MIN_VALUE] */
+	int32  zero_num;
+
+	qdata_store_t pos;
+	qdata_store_t neg;
+};
+
+/*
+ * internal helper functions
+ */
+
+static int32
+qdata_key(float8 value)
+{
+	return (int32)ceil(log(value) / log(QDATA_GAMMA));
+} /* qdata_key */
+
+static float8
+qdata_key_value(int32 key)
+{
+	/* the center of the bin, relative to its boundaries */
+	return 2.0 * pow(QDATA_GAMMA, key) / (QDATA_GAMMA + 1.0);
+} /* qdata_key_value */
+
+static void
+qdata_bins_add(qdata_store_t *store, int32 key, uint32 count)
+{
+	int32 i;
+
+	if (store->bins_num <= 0) {
+		memset(store->bins, 0, sizeof(store->bins));
+		store->key_offset = key;
+	}
+	else if (key < store->key_offset) {
+		int32 highest = QDATA_BINS - 1;
+		int32 shift;
+
+		while ((highest > 0) && (! store->bins[highest]))
+			--highest;
+
+		/* shift bins up as far as possible; collapse the rest */
+		shift = Min(store->key_offset - key, QDATA_BINS - 1 - highest);
+		if (shift > 0) {
+			memmove(store->bins + shift, store->bins,
+					(QDATA_BINS - shift) * sizeof(*store->bins));
+			memset(store->bins, 0, shift * sizeof(*store->bins));
+			store->key_offset -= shift;
+		}
+		key = Max(key, store->key_offset);
+	}
+	else if (key >= store->key_offset + QDATA_BINS) {
+		int32  shift = key - (store->key_offset + QDATA_BINS - 1);
+		uint32 lowest = 0;
+
+		/* collapse the lowest bins into the new first bin */
+		for (i = 0; (i <= shift) && (i < QDATA_BINS); ++i)
+			lowest += store->bins[i];
+
+		if (shift < QDATA_BINS) {
+			memmove(store->bins + 1, store->bins + shift + 1,
+					(QDATA_BINS - shift - 1) * sizeof(*store->bins));
+			memset(store->bins + QDATA_BINS - shift, 0,
+					shift * sizeof(*store->bins));
+		}
+		else
+			memset(store->bins, 0, sizeof(store->bins));
+
+		store->bins[0] = lowest;
+		store->key_offset += shift;
+	}
+
+	store->bins[key - store->key_offset] += count;
+	store->bins_num += (int32)count;
+} /* qdata_bins_add */
+
+static float8
+qdata_clamp(qdata_t *data, float8 value)
+{
+	if (value < data->min)
+		value = data->min;
+	if (value > data->max)
+		value = data->max;
+	return value;
+} /* qdata_clamp */
+
+static void
+qdata_add_value(qdata_t *data, float8 value)
+{
+	++data->val_num;
+
+	if (isnan(value)) {
+		++data->undef_num;
+		return;
+	}
+
+	if ((data->val_num - data->undef_num == 1) || (value < data->min))
+		data->min = value;
+	if ((data->val_num - data->undef_num == 1) || (value > data->max))
+		data->max = value;
+	data->sum += value;
+
+	if (value > QDATA_MIN_VALUE)
+		qdata_bins_add(&data->pos, qdata_key(value), 1);
+	else if (value < -QDATA_MIN_VALUE)
+		qdata_bins_add(&data->neg, qdata_key(-value), 1);
+	else
+		++data->zero_num;
+} /* qdata_add_value */
+
+static void
+qdata_store_merge(qdata_store_t *data, qdata_store_t *update)
+{
+	int32 i;
+
+	if (update->bins_num <= 0)
+		return;
+
+	for (i = 0; i < QDATA_BINS; ++i)
+		if (update->bins[i])
+			qdata_bins_add(data, update->key_offset + i, update->bins[i]);
+} /* qdata_store_merge */
+
+static void
+qdata_merge(qdata_t *data, qdata_t *update)
+{
+	int32 def_num   = data->val_num - data->undef_num;
+	int32 u_def_num = update->val_num - update->undef_num;
+
+	if (u_def_num > 0) {
+		if ((def_num <= 0) || (update->min < data->min))
+			data->min = update->min;
+		if ((def_num <= 0) || (update->max > data->max))
+			data->max = update->max;
+		data->sum += update->sum;
+	}
+
+	qdata_store_merge(&data->pos, &update->pos);
+	qdata_store_merge(&data->neg, &update->neg);
+
+	data->val_num   += update->val_num;
+	data->undef_num += update->undef_num;
+	data->zero_num  += update->zero_num;
+} /* qdata_merge */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(qdata_validate);
+
+PG_FUNCTION_INFO_V1(qdata_in);
+PG_FUNCTION_INFO_V1(qdata_out);
+PG_FUNCTION_INFO_V1(qdata_typmodin);
+PG_FUNCTION_INFO_V1(qdata_typmodout);
+
+PG_FUNCTION_INFO_V1(qdata_to_qdata);
+PG_FUNCTION_INFO_V1(qdata_to_float8);
+PG_FUNCTION_INFO_V1(qdata_to_cdata);
+
+PG_FUNCTION_INFO_V1(qdata_update);
+PG_FUNCTION_INFO_V1(qdata_quantile);
+
+/*
+ * public API
+ */
+
+Datum
+qdata_validate(PG_FUNCTION_ARGS)
+{
+	char   type_info[1024];
+	char  *result;
+	size_t req_len;
+	size_t len;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("qdata_validate() expect one argument"),
+					errhint("Usage qdata_validate(expected_size)")
+				));
+
+	req_len = (size_t)PG_GETARG_UINT32(0);
+	len = sizeof(qdata_t);
+
+	if (req_len != len)
+		ereport(ERROR, (
+					errmsg("length of the qdata type "
+						"does not match the expected length"),
+					errhint("Please report a bug against PostRR")
+				));
+
+	snprintf(type_info, sizeof(type_info),
+			"qdata validated successfully; type length = %zu", len);
+	type_info[sizeof(type_info) - 1] = '\0';
+
+	result = pstrdup(type_info);
+	PG_RETURN_CSTRING(result);
+} /* qdata_validate */
+
+Datum
+qdata_in(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+	int32 typmod;
+	float8 value;
+
+	char *val_str, *orig;
+	char *endptr = NULL;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("qdata_in() expects three arguments"),
+					errhint("Usage: qdata_in(col_name, oid, typmod)")
+				));
+
+	data = (qdata_t *)palloc0(sizeof(*data));
+
+	val_str = PG_GETARG_CSTRING(0);
+	typmod  = PG_GETARG_INT32(2);
+
+	orig = val_str;
+	while ((*val_str != '\0') && isspace((int)*val_str))
+		++val_str;
+
+	if (*val_str == '\0')
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid input syntax for qdata: \"%s\"", orig)
+				));
+
+	errno = 0;
+	value = strtod(val_str, &endptr);
+
+	if ((endptr == val_str) || errno)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid input syntax for qdata: \"%s\"", orig)
+				));
+
+	while ((*endptr != '\0') && isspace((int)*endptr))
+		++endptr;
+
+	if (*endptr != '\0')
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid input syntax for qdata: \"%s\"", orig),
+					errdetail("garbage found after number: \"%s\"", endptr)
+				));
+
+	qdata_add_value(data, value);
+
+	if (typmod >= 0)
+		data->quantile = typmod;
+	else
+		data->quantile = QDATA_DEFAULT_QUANTILE;
+
+	PG_RETURN_QDATA_P(data);
+} /* qdata_in */
+
+Datum
+qdata_out(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+	float8   value;
+
+	char  val_str[32];
+	char  qd_str[1024];
+	char *result;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("qdata_out() expects one argument"),
+					errhint("Usage: qdata_out(qdata)")
+				));
+
+	data = PG_GETARG_QDATA_P(0);
+
+	value = qdata_quantile_internal(data, (float8)data->quantile / 100.0);
+
+	/* as for cdata, use a representation which reads back exactly */
+#if PG_VERSION_NUM >= 120000
+	double_to_shortest_decimal_buf(value, val_str);
+#else
+	snprintf(val_str, sizeof(val_str), "%.17g", value);
+#endif
+
+	snprintf(qd_str, sizeof(qd_str), "%s (P%i U:%i/%i)",
+			val_str, data->quantile, data->undef_num, data->val_num);
+
+	result = pstrdup(qd_str);
+	PG_RETURN_CSTRING(result);
+} /* qdata_out */
+
+Datum
+qdata_typmodin(PG_FUNCTION_ARGS)
+{
+	ArrayType *tm_array;
+
+	int32 *spec;
+	int    spec_elems = 0;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("qdata_typmodin() expects one argument"),
+					errhint("Usage: qdata_typmodin(array)")
+				));
+
+	tm_array = PG_GETARG_ARRAYTYPE_P(0);
+
+	spec = ArrayGetIntegerTypmods(tm_array, &spec_elems);
+	if ((spec_elems != 1) || (spec[0] < 0) || (spec[0] > 100))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid qdata type modifier"),
+					errhint("Usage: qdata(<percentile>)")
+				));
+
+	PG_RETURN_INT32(spec[0]);
+} /* qdata_typmodin */
+
+Datum
+qdata_typmodout(PG_FUNCTION_ARGS)
+{
+	int32 typmod;
+	char  tm_str[32];
+	char *result;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("qdata_typmodout() expects one argument"),
+					errhint("Usage: qdata_typmodout(typmod)")
+				));
+
+	typmod = PG_GETARG_INT32(0);
+	snprintf(tm_str, sizeof(tm_str), "(%d)", typmod);
+	tm_str[sizeof(tm_str) - 1] = '\0';
+	result = pstrdup(tm_str);
+	PG_RETURN_CSTRING(result);
+} /* qdata_typmodout */
+
+Datum
+qdata_to_qdata(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+	int32 typmod;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("qdata_to_qdata() "
+						"expects three arguments"),
+					errhint("Usage: qdata_to_qdata"
+						"(qdata, typmod, is_explicit)")
+				));
+
+	data   = PG_GETARG_QDATA_P(0);
+	typmod = PG_GETARG_INT32(1);
+
+	if (typmod >= 0) {
+		qdata_t *copy = (qdata_t *)palloc(sizeof(*copy));
+
+		memcpy(copy, data, sizeof(*copy));
+		copy->quantile = typmod;
+		data = copy;
+	}
+
+	PG_RETURN_QDATA_P(data);
+} /* qdata_to_qdata */
+
+Datum
+qdata_to_float8(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("qdata_to_float8() expects one argument"),
+					errhint("Usage: qdata_to_float8(qdata)")
+				));
+
+	data = PG_GETARG_QDATA_P(0);
+	PG_RETURN_FLOAT8(qdata_quantile_internal(data,
+				(float8)data->quantile / 100.0));
+} /* qdata_to_float8 */
+
+Datum
+qdata_to_cdata(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+	float8   value = NAN;
+	int32    def_num;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("qdata_to_cdata() expects one argument"),
+					errhint("Usage: qdata_to_cdata(qdata)")
+				));
+
+	data = PG_GETARG_QDATA_P(0);
+
+	def_num = data->val_num - data->undef_num;
+	if (def_num > 0)
+		value = data->sum / def_num;
+
+	PG_RETURN_CDATA_P(cdata_create(value, data->undef_num, data->val_num,
+				/* cf = AVG */ 0));
+} /* qdata_to_cdata */
+
+Datum
+qdata_update(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+	qdata_t *update;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("qdata_update() expects two arguments"),
+					errhint("Usage: qdata_update(qdata, qdata)")
+				));
+
+	if (PG_ARGISNULL(0) && PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+	else if (PG_ARGISNULL(0))
+		PG_RETURN_DATUM(PG_GETARG_DATUM(1));
+	else if (PG_ARGISNULL(1))
+		PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+
+	update = PG_GETARG_QDATA_P(1);
+
+	/* modify the first argument in place only if it's an aggregate's
+	 * transition value */
+	if (AggCheckCallContext(fcinfo, NULL))
+		data = PG_GETARG_QDATA_P(0);
+	else {
+		data = (qdata_t *)palloc(sizeof(*data));
+		memcpy(data, PG_GETARG_QDATA_P(0), sizeof(*data));
+	}
+
+	qdata_merge(data, update);
+	PG_RETURN_QDATA_P(data);
+} /* qdata_update */
+
+Datum
+qdata_quantile(PG_FUNCTION_ARGS)
+{
+	qdata_t *data;
+	float8   q;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("qdata_quantile() expects two arguments"),
+					errhint("Usage: qdata_quantile(qdata, quantile)")
+				));
+
+	data = PG_GETARG_QDATA_P(0);
+	q    = PG_GETARG_FLOAT8(1);
+
+	if ((q < 0.0) || (q > 1.0))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid quantile %g: "
+						"must be in the range [0, 1]", q)
+				));
+
+	PG_RETURN_FLOAT8(qdata_quantile_internal(data, q));
+} /* qdata_quantile */
+
+float8
+qdata_quantile_internal(qdata_t *data, float8 q)
+{
+	int32  def_num = data->val_num - data->undef_num;
+	float8 rank;
+	float8 value;
+	int32  count;
+	int32  i;
+
+	if (def_num <= 0)
+		return NAN;
+
+	if (q <= 0.0)
+		return data->min;
+	if (q >= 1.0)
+		return data->max;
+
+	rank  = q * (float8)(def_num - 1);
+	count = 0;
+	value = data->max;
+
+	/* negative values, starting with the largest absolute value */
+	if (data->neg.bins_num > 0)
+		for (i = QDATA_BINS - 1; i >= 0; --i) {
+			count += (int32)data->neg.bins[i];
+			if (rank < (float8)count)
+				return qdata_clamp(data,
+						-qdata_key_value(data->neg.key_offset + i));
+		}
+
+	count += data->zero_num;
+	if (rank < (float8)count)
+		return qdata_clamp(data, 0.0);
+
+	if (data->pos.bins_num > 0)
+		for (i = 0; i < QDATA_BINS; ++i) {
+			count += (int32)data->pos.bins[i];
+			if (rank < (float8)count) {
+				value = qdata_key_value(data->pos.key_offset + i);
+				break;
+			}
+		}
+
+	return qdata_clamp(data, value);
+} /* qdata_quantile_internal */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
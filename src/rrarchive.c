@@ -0,0 +1,1942 @@
+/*
+ * PostRR - src/rrarchive.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Functions operating on round-robin archives, that is, tables containing
+ * an RRTimeslice and a CData column.
+ */
+
+#include "postrr.h"
+#include "rrcore.h"
+#include "utils/pg_spi.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+
+/* Postgres utilities */
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+#include <utils/tuplestore.h>
+#include <miscadmin.h> /* work_mem */
+
+enum {
+	FILL_NONE = 0,
+	FILL_NAN,
+	FILL_LAST,
+	FILL_LINEAR
+};
+
+#define FILL_TO_STR(f) \
+	(((f) == FILL_NONE) \
+		? "none" \
+		: ((f) == FILL_NAN) \
+			? "nan" \
+			: ((f) == FILL_LAST) \
+				? "last" \
+				: ((f) == FILL_LINEAR) \
+					? "linear" : "unknown")
+
+/* a slice stored in the archive, as far as required for filling in
+ * missing slices */
+typedef struct {
+	TimestampTz tstamp;
+	float8      value;
+	int32       cf;
+} fetch_point_t;
+
+typedef struct {
+	int fill;
+
+	/* current position in the ring and end of the time window */
+	rrtimeslice_t *cur;
+	TimestampTz    last;
+
+	/* the most recent slice stored in the archive before the current
+	 * position (possibly before the start of the time window) */
+	fetch_point_t  prev;
+	bool           have_prev;
+
+	Tuplestorestate *tupstore;
+	TupleDesc        tupdesc;
+} fetch_state_t;
+
+typedef struct {
+	int32       typmod;
+	TimestampTz first;
+	TimestampTz last;
+} window_t;
+
+/* data source types (as known from RRDtool) */
+enum {
+	DSTYPE_GAUGE = 0,
+	DSTYPE_COUNTER,
+	DSTYPE_DERIVE,
+	DSTYPE_ABSOLUTE
+};
+
+#define DSTYPE_TO_STR(t) \
+	(((t) == DSTYPE_GAUGE) \
+		? "GAUGE" \
+		: ((t) == DSTYPE_COUNTER) \
+			? "COUNTER" \
+			: ((t) == DSTYPE_DERIVE) \
+				? "DERIVE" \
+				: ((t) == DSTYPE_ABSOLUTE) \
+					? "ABSOLUTE" : "unknown")
+
+/* counter ranges used to detect wrap-arounds */
+#define COUNTER_MAX_32 4294967296.0
+#define COUNTER_MAX_64 18446744073709551616.0
+
+enum {
+	DOWNSAMPLE_LTTB = 0,
+	DOWNSAMPLE_MINMAX
+};
+
+#define DOWNSAMPLE_TO_STR(m) \
+	(((m) == DOWNSAMPLE_LTTB) \
+		? "lttb" \
+		: ((m) == DOWNSAMPLE_MINMAX) \
+			? "minmax" : "unknown")
+
+/* number of rows to fetch from the archive at once */
+#define DOWNSAMPLE_BATCH_SIZE 1000
+
+typedef struct {
+	TimestampTz tstamp;
+	float8      value;
+	Datum       slice;
+	Datum       data;
+} ds_point_t;
+
+typedef struct {
+	int64       idx;
+	ds_point_t *points;
+	int         points_num;
+	int         points_len;
+} ds_bucket_t;
+
+typedef struct {
+	int method;
+
+	/* time window and bucket layout */
+	TimestampTz first;
+	TimestampTz last;
+	int64       buckets_num;
+
+	int16 slice_len, data_len;
+	bool  slice_byval, data_byval;
+
+	Tuplestorestate *tupstore;
+	TupleDesc        tupdesc;
+
+	/* LTTB: last selected point, the two most recent buckets, and the most
+	 * recent point (which is not assigned to a bucket yet since it might be
+	 * the last point of the window) */
+	ds_point_t  selected;
+	bool        have_selected;
+	ds_point_t  held;
+	bool        have_held;
+	ds_bucket_t cur;
+	ds_bucket_t next;
+
+	/* min/max: extreme points of the current bucket */
+	int64       minmax_idx;
+	ds_point_t  min;
+	ds_point_t  max;
+	bool        have_minmax;
+} ds_state_t;
+
+/* the archive of an rraname selected for a time window */
+typedef struct {
+	char *rraname;
+	char *tbl;
+	char *tscol;
+	char *vcol;
+	int64 len;
+} source_t;
+
+/* a candidate of a top-K query, i.e. the consolidated window of an rraname */
+typedef struct {
+	char  *rraname;
+	float8 value;
+	int32  undef_num;
+	int32  val_num;
+	int32  cf;
+} topk_entry_t;
+
+/* min-heap of the best 'k' candidates seen so far */
+typedef struct {
+	topk_entry_t *entries;
+	int           entries_num;
+	int           k;
+} topk_heap_t;
+
+/* number of rranames to fetch at once when scanning all archives */
+#define TOPK_BATCH_SIZE 100
+
+/*
+ * internal helper functions
+ */
+
+/*
+ * rrarchive_get_typmod:
+ * Determine the typmod of the specified column and, optionally, whether the
+ * table is a partitioned table. The caller has to be connected to the SPI
+ * manager.
+ */
+static int32
+rrarchive_get_typmod(const char *tbl, const char *col, bool *partitioned)
+{
+	StringInfoData query;
+	int32 typmod = -1;
+	int32 is_partitioned = 0;
+	int   spi_rc;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT a.atttypmod, (c.relkind = 'p')::integer "
+				"FROM pg_catalog.pg_attribute AS a "
+					"JOIN pg_catalog.pg_class AS c ON c.oid = a.attrelid "
+				"WHERE a.attrelid = %s::regclass AND a.attname = %s",
+			quote_literal_cstr(tbl), quote_literal_cstr(col));
+
+	spi_rc = pg_spi_get_int(query.data, 2, &typmod, &is_partitioned);
+	if (spi_rc != PG_SPI_OK)
+		pg_spi_ereport(ERROR, "determine typmod of archive column", spi_rc);
+
+	if (partitioned)
+		*partitioned = is_partitioned != 0;
+
+	pfree(query.data);
+	return typmod;
+} /* rrarchive_get_typmod */
+
+/*
+ * window_init:
+ * Determine the first and last slice of the time window [start, end] and
+ * build a query retrieving all slices of that window from the specified
+ * archive in chronological order. The query expects the first and last
+ * slice's timestamps as parameters $1 and $2. If 'idcol' is not NULL, the
+ * archive is a multi-series archive and only the slices of series 'id' are
+ * retrieved. The caller has to be connected to the SPI manager.
+ */
+static void
+window_init(window_t *window, StringInfo query,
+		const char *tbl, const char *idcol, int64 id,
+		const char *tscol, const char *vcol,
+		TimestampTz start, TimestampTz end)
+{
+	rrtimeslice_t *first;
+	rrtimeslice_t *last;
+
+	int64 len = 0;
+	int32 num = 0;
+	int64 slices_num;
+	bool  partitioned = false;
+
+	if (end < start)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid time window: end lies before start")
+				));
+
+	window->typmod = rrarchive_get_typmod(tbl, tscol, &partitioned);
+	if (rrtimeslice_get_spec(window->typmod, &len, &num))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid archive: %s.%s is not an "
+						"RRTimeslice column with typmod", tbl, tscol)
+				));
+
+	first = rrtimeslice_create(start, window->typmod);
+	last  = rrtimeslice_create(end, window->typmod);
+
+	window->first = rrtimeslice_get_tstamp(first);
+	window->last  = rrtimeslice_get_tstamp(last);
+
+	slices_num = (window->last - window->first) / len + 1;
+
+	tscol = quote_identifier(tscol);
+	vcol  = quote_identifier(vcol);
+
+	/* the cast allows for other value types (e.g., QData) as well */
+	appendStringInfo(query, "SELECT %s, CAST(%s AS cdata) FROM %s WHERE ",
+			tscol, vcol, tbl);
+
+	/* the (series, timeslice) index restricts the scan to a single ring */
+	if (idcol)
+		appendStringInfo(query, "%s = " INT64_FORMAT " AND ",
+				quote_identifier(idcol), id);
+
+	/* restrict the scan to the sequence numbers of the time window (making
+	 * use of an index on the timeslice column), wrapping around at the end
+	 * of the ring if necessary */
+	if (slices_num < num) {
+		if (rrtimeslice_get_seq(first) <= rrtimeslice_get_seq(last))
+			appendStringInfo(query, "%s >= $1 AND %s <= $2 AND ",
+					tscol, tscol);
+		else
+			appendStringInfo(query, "(%s >= $1 OR %s <= $2) AND ",
+					tscol, tscol);
+
+		/* partitioned archives use the sequence number as partition key;
+		 * spell it out as constants to let the planner prune partitions
+		 * not covering the window */
+		if (partitioned) {
+			const char *op = (rrtimeslice_get_seq(first)
+					<= rrtimeslice_get_seq(last)) ? "AND" : "OR";
+
+			appendStringInfo(query, "(RRTimeslice_seq(%s) >= %u %s "
+						"RRTimeslice_seq(%s) <= %u) AND ",
+					tscol, rrtimeslice_get_seq(first), op,
+					tscol, rrtimeslice_get_seq(last));
+		}
+	}
+
+	appendStringInfo(query, "Tstamptz(%s) >= $1 AND Tstamptz(%s) <= $2 "
+				"ORDER BY Tstamptz(%s)", tscol, tscol, tscol);
+
+	pfree(first);
+	pfree(last);
+} /* window_init */
+
+/*
+ * window_prev_query:
+ * Build a query retrieving the most recent slice stored in the archive
+ * before the time window initialized by window_init(). The query expects
+ * the first slice's timestamp as parameter $1.
+ */
+static void
+window_prev_query(StringInfo query,
+		const char *tbl, const char *idcol, int64 id,
+		const char *tscol, const char *vcol)
+{
+	tscol = quote_identifier(tscol);
+	vcol  = quote_identifier(vcol);
+
+	appendStringInfo(query, "SELECT %s, CAST(%s AS cdata) FROM %s WHERE ",
+			tscol, vcol, tbl);
+	if (idcol)
+		appendStringInfo(query, "%s = " INT64_FORMAT " AND ",
+				quote_identifier(idcol), id);
+	appendStringInfo(query, "Tstamptz(%s) < $1 "
+				"ORDER BY Tstamptz(%s) DESC LIMIT 1", tscol, tscol);
+} /* window_prev_query */
+
+static int
+fetch_parse_fill(const char *fill_str)
+{
+	int fill;
+
+	for (fill = FILL_NONE; fill <= FILL_LINEAR; ++fill)
+		if (! strcasecmp(fill_str, FILL_TO_STR(fill)))
+			return fill;
+
+	ereport(ERROR, (
+				errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid fill method: %s", fill_str),
+				errhint("Valid fill methods: none, nan, last, linear")
+			));
+	return -1;
+} /* fetch_parse_fill */
+
+/*
+ * fetch_point_init:
+ * Remember the timestamp and value of a slice stored in the archive.
+ */
+static void
+fetch_point_init(fetch_point_t *point, Datum slice, Datum value)
+{
+	cdata_t *data = (cdata_t *)DatumGetPointer(value);
+
+	point->tstamp = rrtimeslice_get_tstamp(
+			(rrtimeslice_t *)DatumGetPointer(slice));
+	point->value  = cdata_get_value(data);
+	point->cf     = cdata_get_cf(data);
+} /* fetch_point_init */
+
+/*
+ * fetch_fill_value:
+ * Determine the value of a slice missing from the archive based on the
+ * surrounding values ('next' may be NULL if there is no slice stored after
+ * the missing one). Filled in values do not have any data points associated
+ * with them.
+ */
+static cdata_t *
+fetch_fill_value(fetch_state_t *state, TimestampTz tstamp,
+		const fetch_point_t *next)
+{
+	const fetch_point_t *prev = state->have_prev ? &state->prev : NULL;
+
+	float8 value = NAN;
+	int32  cf    = 0;
+
+	if (prev)
+		cf = prev->cf;
+	else if (next)
+		cf = next->cf;
+
+	if ((state->fill == FILL_LAST) && prev) {
+		value = prev->value;
+	}
+	else if ((state->fill == FILL_LINEAR) && prev && next) {
+		TimestampTz t0 = prev->tstamp;
+		TimestampTz t1 = next->tstamp;
+
+		/* NaN values propagate */
+		value = prev->value + (next->value - prev->value)
+			* ((float8)(tstamp - t0) / (float8)(t1 - t0));
+	}
+
+	return cdata_create(value, /* undef_num = */ 0, /* val_num = */ 0, cf);
+} /* fetch_fill_value */
+
+static void
+fetch_emit(fetch_state_t *state, Datum slice, Datum value)
+{
+	Datum values[2];
+	bool  nulls[2] = { false, false };
+
+	values[0] = slice;
+	values[1] = value;
+	tuplestore_putvalues(state->tupstore, state->tupdesc, values, nulls);
+} /* fetch_emit */
+
+/*
+ * fetch_fill:
+ * Advance the current position up to (but not including) the specified
+ * timestamp (or up to the end of the time window), filling in all slices
+ * in between according to the fill method.
+ */
+static void
+fetch_fill(fetch_state_t *state, TimestampTz until, const fetch_point_t *next)
+{
+	TimestampTz tstamp;
+
+	while (((tstamp = rrtimeslice_get_tstamp(state->cur)) < until)
+			&& (tstamp <= state->last)) {
+		if (state->fill != FILL_NONE) {
+			cdata_t *data = fetch_fill_value(state, tstamp, next);
+
+			fetch_emit(state, PointerGetDatum(state->cur),
+					PointerGetDatum(data));
+			pfree(data);
+		}
+		rrtimeslice_next(state->cur);
+	}
+} /* fetch_fill */
+
+/*
+ * fetch_run:
+ * Retrieve all slices of the time window in batches and emit them along
+ * with filled in values for missing slices. Only the most recent slice is
+ * kept in memory. The caller has to be connected to the SPI manager.
+ */
+static void
+fetch_run(fetch_state_t *state, window_t *window,
+		const char *query, const char *prev_query)
+{
+	Oid   argtypes[] = { TIMESTAMPTZOID, TIMESTAMPTZOID };
+	Datum args[2];
+	Portal portal;
+
+	args[0] = TimestampTzGetDatum(window->first);
+	args[1] = TimestampTzGetDatum(window->last);
+
+	/* slices before the window are taken into account when filling in
+	 * slices missing at its start */
+	if (prev_query) {
+		int spi_rc;
+
+		spi_rc = SPI_execute_with_args(prev_query, 1, argtypes, args,
+				/* nulls = */ NULL, /* read only = */ true,
+				/* count = */ 1);
+		if (spi_rc != SPI_OK_SELECT)
+			ereport(ERROR, (
+						errmsg("failed to fetch archive data: "
+							"failed to execute query: %s",
+							SPI_result_code_string(spi_rc))
+					));
+
+		if (SPI_processed == 1) {
+			Datum slice, value;
+			bool  slice_null = false, value_null = false;
+
+			slice = SPI_getbinval(SPI_tuptable->vals[0],
+					SPI_tuptable->tupdesc, 1, &slice_null);
+			value = SPI_getbinval(SPI_tuptable->vals[0],
+					SPI_tuptable->tupdesc, 2, &value_null);
+			if ((! slice_null) && (! value_null)) {
+				fetch_point_init(&state->prev, slice, value);
+				state->have_prev = true;
+			}
+		}
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	portal = SPI_cursor_open_with_args(/* name = */ NULL, query,
+			2, argtypes, args, /* nulls = */ NULL,
+			/* read only = */ true, /* cursor options = */ 0);
+
+	while (42) {
+		uint64 i;
+
+		SPI_cursor_fetch(portal, /* forward = */ true, DOWNSAMPLE_BATCH_SIZE);
+		if (SPI_processed <= 0)
+			break;
+
+		for (i = 0; i < SPI_processed; ++i) {
+			HeapTuple     tuple = SPI_tuptable->vals[i];
+			fetch_point_t point;
+
+			Datum slice, value;
+			bool  slice_null = false, value_null = false;
+
+			slice = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 1, &slice_null);
+			value = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 2, &value_null);
+			if (slice_null || value_null)
+				continue;
+
+			fetch_point_init(&point, slice, value);
+			if (point.tstamp < rrtimeslice_get_tstamp(state->cur))
+				continue;
+
+			fetch_fill(state, point.tstamp, &point);
+			fetch_emit(state, slice, value);
+			rrtimeslice_next(state->cur);
+
+			state->prev      = point;
+			state->have_prev = true;
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+		CHECK_FOR_INTERRUPTS();
+	}
+	SPI_cursor_close(portal);
+
+	/* fill in slices missing at the end of the window */
+	fetch_fill(state, DT_NOEND, /* next = */ NULL);
+} /* fetch_run */
+
+/*
+ * data sources
+ */
+
+static int
+rate_parse_dstype(const char *dstype_str)
+{
+	int dstype;
+
+	for (dstype = DSTYPE_GAUGE; dstype <= DSTYPE_ABSOLUTE; ++dstype)
+		if (! strcasecmp(dstype_str, DSTYPE_TO_STR(dstype)))
+			return dstype;
+
+	ereport(ERROR, (
+				errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid data source type: \"%s\"", dstype_str),
+				errhint("Valid data source types are: GAUGE, COUNTER, "
+					"DERIVE, ABSOLUTE")
+			));
+	return -1;
+} /* rate_parse_dstype */
+
+/*
+ * rate_compute:
+ * Determine the rate (per second) of a data source based on the previous and
+ * the current raw value. COUNTER values are assumed to be monotonically
+ * increasing; if the counter went down, a 32 bit wrap-around is assumed, or a
+ * 64 bit wrap-around if the value is still out of range.
+ */
+static float8
+rate_compute(int dstype, float8 last_value, float8 value, float8 interval)
+{
+	float8 delta;
+
+	if (dstype == DSTYPE_GAUGE)
+		return value;
+
+	if (isnan(value) || (interval <= 0.0))
+		return NAN;
+
+	if (dstype == DSTYPE_ABSOLUTE)
+		return value / interval;
+
+	if (isnan(last_value))
+		return NAN;
+
+	delta = value - last_value;
+	if ((dstype == DSTYPE_COUNTER) && (delta < 0.0)) {
+		delta += COUNTER_MAX_32;
+		if (delta < 0.0)
+			delta += COUNTER_MAX_64 - COUNTER_MAX_32;
+	}
+	return delta / interval;
+} /* rate_compute */
+
+/*
+ * downsampling
+ */
+
+static int
+downsample_parse_method(const char *method_str)
+{
+	int method;
+
+	for (method = DOWNSAMPLE_LTTB; method <= DOWNSAMPLE_MINMAX; ++method)
+		if (! strcasecmp(method_str, DOWNSAMPLE_TO_STR(method)))
+			return method;
+
+	ereport(ERROR, (
+				errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid downsampling method: %s", method_str),
+				errhint("Valid downsampling methods: lttb, minmax")
+			));
+	return -1;
+} /* downsample_parse_method */
+
+static int64
+downsample_bucket(ds_state_t *state, TimestampTz tstamp)
+{
+	int64 idx;
+
+	if (state->last <= state->first)
+		return 0;
+
+	idx = (int64)((float8)(tstamp - state->first)
+			/ (float8)(state->last - state->first)
+			* (float8)state->buckets_num);
+	return Min(idx, state->buckets_num - 1);
+} /* downsample_bucket */
+
+static void
+downsample_emit(ds_state_t *state, ds_point_t *point)
+{
+	Datum values[2];
+	bool  nulls[2] = { false, false };
+
+	values[0] = point->slice;
+	values[1] = point->data;
+	tuplestore_putvalues(state->tupstore, state->tupdesc, values, nulls);
+} /* downsample_emit */
+
+static void
+downsample_point_free(ds_point_t *point)
+{
+	pfree(DatumGetPointer(point->slice));
+	pfree(DatumGetPointer(point->data));
+} /* downsample_point_free */
+
+static void
+downsample_bucket_add(ds_bucket_t *bucket, ds_point_t *point)
+{
+	if (bucket->points_num >= bucket->points_len) {
+		bucket->points_len = bucket->points_len
+			? 2 * bucket->points_len : 16;
+		if (bucket->points)
+			bucket->points = (ds_point_t *)repalloc(bucket->points,
+					bucket->points_len * sizeof(*bucket->points));
+		else
+			bucket->points = (ds_point_t *)palloc(
+					bucket->points_len * sizeof(*bucket->points));
+	}
+	bucket->points[bucket->points_num] = *point;
+	++bucket->points_num;
+} /* downsample_bucket_add */
+
+static void
+downsample_bucket_clear(ds_bucket_t *bucket)
+{
+	int i;
+
+	for (i = 0; i < bucket->points_num; ++i)
+		downsample_point_free(&bucket->points[i]);
+	bucket->points_num = 0;
+} /* downsample_bucket_clear */
+
+/*
+ * lttb_select:
+ * Select the point of the bucket forming the largest triangle with the
+ * previously selected point and the specified (average) point of the next
+ * bucket. The selected point is emitted and remembered as the new
+ * previously selected point.
+ */
+static void
+lttb_select(ds_state_t *state, ds_bucket_t *bucket,
+		float8 next_t, float8 next_v)
+{
+	float8 a_t = (float8)(state->selected.tstamp - state->first);
+	float8 a_v = state->selected.value;
+
+	float8 max_area = -1.0;
+	int    max_idx  = 0;
+	int    i;
+
+	for (i = 0; i < bucket->points_num; ++i) {
+		float8 p_t = (float8)(bucket->points[i].tstamp - state->first);
+		float8 p_v = bucket->points[i].value;
+		float8 area;
+
+		/* twice the area, which doesn't matter for the comparison */
+		area = fabs((a_t - next_t) * (p_v - a_v) - (a_t - p_t) * (next_v - a_v));
+		if (area > max_area) {
+			max_area = area;
+			max_idx  = i;
+		}
+	}
+
+	downsample_emit(state, &bucket->points[max_idx]);
+
+	downsample_point_free(&state->selected);
+	state->selected = bucket->points[max_idx];
+
+	/* the selected point is now owned by state->selected */
+	bucket->points[max_idx] = bucket->points[bucket->points_num - 1];
+	--bucket->points_num;
+	downsample_bucket_clear(bucket);
+} /* lttb_select */
+
+static void
+lttb_bucket_avg(ds_state_t *state, ds_bucket_t *bucket,
+		float8 *avg_t, float8 *avg_v)
+{
+	int i;
+
+	*avg_t = *avg_v = 0.0;
+	for (i = 0; i < bucket->points_num; ++i) {
+		*avg_t += (float8)(bucket->points[i].tstamp - state->first);
+		*avg_v += bucket->points[i].value;
+	}
+	*avg_t /= bucket->points_num;
+	*avg_v /= bucket->points_num;
+} /* lttb_bucket_avg */
+
+static void
+lttb_add(ds_state_t *state, ds_point_t *point)
+{
+	ds_point_t held;
+	int64      idx;
+
+	if (! state->have_selected) {
+		/* the first point is always part of the result */
+		downsample_emit(state, point);
+		state->selected      = *point;
+		state->have_selected = true;
+		return;
+	}
+
+	if (! state->have_held) {
+		state->held      = *point;
+		state->have_held = true;
+		return;
+	}
+
+	held = state->held;
+	state->held = *point;
+
+	idx = downsample_bucket(state, held.tstamp);
+	if (state->next.points_num && (state->next.idx != idx)) {
+		/* the next bucket is complete; select a point from the current one */
+		if (state->cur.points_num) {
+			float8 avg_t, avg_v;
+
+			lttb_bucket_avg(state, &state->next, &avg_t, &avg_v);
+			lttb_select(state, &state->cur, avg_t, avg_v);
+		}
+
+		/* swap buckets; the current bucket is empty at this point */
+		{
+			ds_bucket_t tmp = state->cur;
+			state->cur  = state->next;
+			state->next = tmp;
+		}
+	}
+
+	state->next.idx = idx;
+	downsample_bucket_add(&state->next, &held);
+} /* lttb_add */
+
+static void
+lttb_finish(ds_state_t *state)
+{
+	float8 last_t, last_v;
+
+	if (! state->have_held)
+		return;
+
+	/* the last point is always part of the result */
+	last_t = (float8)(state->held.tstamp - state->first);
+	last_v = state->held.value;
+
+	if (state->cur.points_num) {
+		float8 avg_t = last_t, avg_v = last_v;
+
+		if (state->next.points_num)
+			lttb_bucket_avg(state, &state->next, &avg_t, &avg_v);
+		lttb_select(state, &state->cur, avg_t, avg_v);
+	}
+	if (state->next.points_num)
+		lttb_select(state, &state->next, last_t, last_v);
+
+	downsample_emit(state, &state->held);
+} /* lttb_finish */
+
+static void
+minmax_flush(ds_state_t *state)
+{
+	if (! state->have_minmax)
+		return;
+
+	if (state->min.tstamp < state->max.tstamp) {
+		downsample_emit(state, &state->min);
+		downsample_emit(state, &state->max);
+	}
+	else if (state->min.tstamp > state->max.tstamp) {
+		downsample_emit(state, &state->max);
+		downsample_emit(state, &state->min);
+	}
+	else
+		downsample_emit(state, &state->min);
+
+	downsample_point_free(&state->min);
+	if (state->min.tstamp != state->max.tstamp)
+		downsample_point_free(&state->max);
+	state->have_minmax = false;
+} /* minmax_flush */
+
+static void
+minmax_add(ds_state_t *state, ds_point_t *point)
+{
+	int64 idx = downsample_bucket(state, point->tstamp);
+
+	if (state->have_minmax && (state->minmax_idx != idx))
+		minmax_flush(state);
+
+	if (! state->have_minmax) {
+		state->minmax_idx  = idx;
+		state->min         = *point;
+		state->max         = *point;
+		state->have_minmax = true;
+		return;
+	}
+
+	if (point->value < state->min.value) {
+		if (state->min.tstamp != state->max.tstamp)
+			downsample_point_free(&state->min);
+		state->min = *point;
+	}
+	else if (point->value > state->max.value) {
+		if (state->min.tstamp != state->max.tstamp)
+			downsample_point_free(&state->max);
+		state->max = *point;
+	}
+	else
+		downsample_point_free(point);
+} /* minmax_add */
+
+static void
+downsample_run(ds_state_t *state, const char *query)
+{
+	Oid   argtypes[] = { TIMESTAMPTZOID, TIMESTAMPTZOID };
+	Datum args[2];
+	Portal portal;
+
+	bool have_types = false;
+
+	args[0] = TimestampTzGetDatum(state->first);
+	args[1] = TimestampTzGetDatum(state->last);
+
+	portal = SPI_cursor_open_with_args(/* name = */ NULL, query,
+			2, argtypes, args, /* nulls = */ NULL,
+			/* read only = */ true, /* cursor options = */ 0);
+
+	while (42) {
+		uint64 i;
+
+		SPI_cursor_fetch(portal, /* forward = */ true, DOWNSAMPLE_BATCH_SIZE);
+		if (SPI_processed <= 0)
+			break;
+
+		if (! have_types) {
+			get_typlenbyval(SPI_gettypeid(SPI_tuptable->tupdesc, 1),
+					&state->slice_len, &state->slice_byval);
+			get_typlenbyval(SPI_gettypeid(SPI_tuptable->tupdesc, 2),
+					&state->data_len, &state->data_byval);
+			have_types = true;
+		}
+
+		for (i = 0; i < SPI_processed; ++i) {
+			HeapTuple  tuple = SPI_tuptable->vals[i];
+			ds_point_t point;
+
+			Datum slice, data;
+			bool  slice_null = false, data_null = false;
+
+			slice = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 1, &slice_null);
+			data  = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 2, &data_null);
+			if (slice_null || data_null)
+				continue;
+
+			point.value = cdata_get_value((cdata_t *)DatumGetPointer(data));
+			if (isnan(point.value))
+				continue;
+
+			point.slice  = datumCopy(slice, state->slice_byval,
+					state->slice_len);
+			point.data   = datumCopy(data, state->data_byval,
+					state->data_len);
+			point.tstamp = rrtimeslice_get_tstamp(
+					(rrtimeslice_t *)DatumGetPointer(point.slice));
+
+			if (state->method == DOWNSAMPLE_LTTB)
+				lttb_add(state, &point);
+			else
+				minmax_add(state, &point);
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+		CHECK_FOR_INTERRUPTS();
+	}
+	SPI_cursor_close(portal);
+
+	if (state->method == DOWNSAMPLE_LTTB)
+		lttb_finish(state);
+	else
+		minmax_flush(state);
+} /* downsample_run */
+
+/*
+ * archive selection
+ */
+
+/*
+ * source_init:
+ * Select the archive of 'rraname' best suited for the time window and
+ * determine its slice length. The caller has to be connected to the SPI
+ * manager.
+ */
+static void
+source_init(source_t *source, const char *rraname,
+		TimestampTz start, TimestampTz end, int32 points)
+{
+	const char *query = "SELECT tbl, tscol, vcol, idcol "
+		"FROM PostRR_select_archive($1, $2, $3, $4)";
+	Oid   argtypes[] = { TEXTOID, TIMESTAMPTZOID, TIMESTAMPTZOID, INT4OID };
+	Datum args[4];
+
+	char *idcol;
+	int32 typmod;
+	int32 num = 0;
+	int   spi_rc;
+
+	args[0] = CStringGetTextDatum(rraname);
+	args[1] = TimestampTzGetDatum(start);
+	args[2] = TimestampTzGetDatum(end);
+	args[3] = Int32GetDatum(points);
+
+	spi_rc = SPI_execute_with_args(query, 4, argtypes, args,
+			/* nulls = */ NULL, /* read only = */ true, /* count = */ 1);
+	if ((spi_rc != SPI_OK_SELECT) || (SPI_processed != 1))
+		ereport(ERROR, (
+					errmsg("failed to select archive of %s: %s", rraname,
+						SPI_result_code_string(spi_rc))
+				));
+
+	source->rraname = pstrdup(rraname);
+	source->tbl     = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 1);
+	source->tscol   = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 2);
+	source->vcol    = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 3);
+
+	idcol           = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 4);
+	SPI_freetuptable(SPI_tuptable);
+
+	if (idcol)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("%s.%s is a multi-series archive",
+						rraname, source->tbl),
+					errhint("Only single-series archives are supported.")
+				));
+
+	typmod = rrarchive_get_typmod(source->tbl, source->tscol,
+			/* partitioned = */ NULL);
+	if (rrtimeslice_get_spec(typmod, &source->len, &num))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid archive: %s.%s is not an "
+						"RRTimeslice column with typmod",
+						source->tbl, source->tscol)
+				));
+} /* source_init */
+
+/*
+ * source_consolidate:
+ * Consolidate all slices of the time window [start, end] of the archive
+ * into a single value using the consolidation function of the values.
+ * Undefined slices are ignored but counted. The caller has to be connected
+ * to the SPI manager.
+ */
+static void
+source_consolidate(source_t *source, TimestampTz start, TimestampTz end,
+		topk_entry_t *entry)
+{
+	window_t window;
+
+	StringInfoData query;
+	Oid    argtypes[] = { TIMESTAMPTZOID, TIMESTAMPTZOID };
+	Datum  args[2];
+	Portal portal;
+
+	entry->value     = NAN;
+	entry->undef_num = 0;
+	entry->val_num   = 0;
+	entry->cf        = RRCORE_CF_AVG;
+
+	initStringInfo(&query);
+	window_init(&window, &query, source->tbl, /* idcol = */ NULL, 0,
+			source->tscol, source->vcol, start, end);
+
+	args[0] = TimestampTzGetDatum(window.first);
+	args[1] = TimestampTzGetDatum(window.last);
+
+	portal = SPI_cursor_open_with_args(/* name = */ NULL, query.data,
+			2, argtypes, args, /* nulls = */ NULL,
+			/* read only = */ true, /* cursor options = */ 0);
+
+	while (42) {
+		uint64 i;
+
+		SPI_cursor_fetch(portal, /* forward = */ true, DOWNSAMPLE_BATCH_SIZE);
+		if (SPI_processed <= 0)
+			break;
+
+		for (i = 0; i < SPI_processed; ++i) {
+			cdata_t *data;
+			Datum    value;
+			bool     value_null = false;
+			float8   v;
+
+			value = SPI_getbinval(SPI_tuptable->vals[i],
+					SPI_tuptable->tupdesc, 2, &value_null);
+			if (value_null)
+				continue;
+
+			data = (cdata_t *)DatumGetPointer(value);
+			v    = cdata_get_value(data);
+
+			++entry->val_num;
+			if (isnan(v)) {
+				++entry->undef_num;
+				continue;
+			}
+
+			entry->cf    = cdata_get_cf(data);
+			entry->value = cdata_consolidate(entry->cf, entry->value,
+					entry->val_num - entry->undef_num - 1, v, 1);
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+		CHECK_FOR_INTERRUPTS();
+	}
+	SPI_cursor_close(portal);
+	pfree(query.data);
+} /* source_consolidate */
+
+/*
+ * CDEF expressions
+ */
+
+/*
+ * cdef_source_load:
+ * Load the values of the archive into 'values', consolidating all slices
+ * ending within each of the 'n' steps of 'step' microseconds ending at
+ * 'first', 'first' + 'step', etc. Steps without any defined values are
+ * undefined. The caller has to be connected to the SPI manager.
+ */
+static void
+cdef_source_load(source_t *source, TimestampTz first, int64 step,
+		int64 n, float8 *values, int32 *val_nums)
+{
+	window_t window;
+
+	StringInfoData query;
+	Oid    argtypes[] = { TIMESTAMPTZOID, TIMESTAMPTZOID };
+	Datum  args[2];
+	Portal portal;
+
+	int64 i;
+
+	for (i = 0; i < n; ++i) {
+		values[i]   = NAN;
+		val_nums[i] = 0;
+	}
+
+	initStringInfo(&query);
+	window_init(&window, &query, source->tbl, /* idcol = */ NULL, 0,
+			source->tscol, source->vcol,
+			first - step + 1, first + (n - 1) * step);
+
+	args[0] = TimestampTzGetDatum(window.first);
+	args[1] = TimestampTzGetDatum(window.last);
+
+	portal = SPI_cursor_open_with_args(/* name = */ NULL, query.data,
+			2, argtypes, args, /* nulls = */ NULL,
+			/* read only = */ true, /* cursor options = */ 0);
+
+	while (42) {
+		SPI_cursor_fetch(portal, /* forward = */ true, DOWNSAMPLE_BATCH_SIZE);
+		if (SPI_processed <= 0)
+			break;
+
+		for (i = 0; i < (int64)SPI_processed; ++i) {
+			HeapTuple tuple = SPI_tuptable->vals[i];
+			cdata_t  *data;
+
+			Datum slice, value;
+			bool  slice_null = false, value_null = false;
+
+			TimestampTz tstamp;
+			int64  idx;
+			float8 v;
+
+			slice = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 1, &slice_null);
+			value = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 2, &value_null);
+			if (slice_null || value_null)
+				continue;
+
+			data = (cdata_t *)DatumGetPointer(value);
+			v    = cdata_get_value(data);
+			if (isnan(v))
+				continue;
+
+			/* the step covering the end of the slice */
+			tstamp = rrtimeslice_get_tstamp(
+					(rrtimeslice_t *)DatumGetPointer(slice));
+			idx = (tstamp - first + step - 1) / step;
+			if ((idx < 0) || (idx >= n))
+				continue;
+
+			values[idx] = cdata_consolidate(cdata_get_cf(data),
+					values[idx], val_nums[idx], v, 1);
+			++val_nums[idx];
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+		CHECK_FOR_INTERRUPTS();
+	}
+	SPI_cursor_close(portal);
+	pfree(query.data);
+} /* cdef_source_load */
+
+/*
+ * top-K queries
+ */
+
+static void
+topk_sift_down(topk_heap_t *heap, int i)
+{
+	while (42) {
+		int min = i;
+		int l = 2 * i + 1;
+		int r = 2 * i + 2;
+		topk_entry_t tmp;
+
+		if ((l < heap->entries_num)
+				&& (heap->entries[l].value < heap->entries[min].value))
+			min = l;
+		if ((r < heap->entries_num)
+				&& (heap->entries[r].value < heap->entries[min].value))
+			min = r;
+		if (min == i)
+			break;
+
+		tmp = heap->entries[i];
+		heap->entries[i] = heap->entries[min];
+		heap->entries[min] = tmp;
+		i = min;
+	}
+} /* topk_sift_down */
+
+static void
+topk_sift_up(topk_heap_t *heap, int i)
+{
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		topk_entry_t tmp;
+
+		if (heap->entries[parent].value <= heap->entries[i].value)
+			break;
+
+		tmp = heap->entries[i];
+		heap->entries[i] = heap->entries[parent];
+		heap->entries[parent] = tmp;
+		i = parent;
+	}
+} /* topk_sift_up */
+
+/*
+ * topk_is_full, topk_min:
+ * Once the heap is full, candidates have to exceed the smallest value kept
+ * so far (the root of the heap).
+ */
+static bool
+topk_is_full(topk_heap_t *heap)
+{
+	return heap->entries_num >= heap->k;
+} /* topk_is_full */
+
+static float8
+topk_min(topk_heap_t *heap)
+{
+	return heap->entries[0].value;
+} /* topk_min */
+
+/*
+ * topk_add:
+ * Add a candidate to the heap, replacing the smallest value if the heap is
+ * full. The rraname is copied to 'mcxt' if the candidate is kept. Undefined
+ * values are ignored.
+ */
+static void
+topk_add(topk_heap_t *heap, topk_entry_t *entry, const char *rraname,
+		MemoryContext mcxt)
+{
+	if (isnan(entry->value))
+		return;
+
+	if (! topk_is_full(heap)) {
+		entry->rraname = MemoryContextStrdup(mcxt, rraname);
+		heap->entries[heap->entries_num] = *entry;
+		++heap->entries_num;
+		topk_sift_up(heap, heap->entries_num - 1);
+		return;
+	}
+
+	if (entry->value <= topk_min(heap))
+		return;
+
+	pfree(heap->entries[0].rraname);
+	entry->rraname = MemoryContextStrdup(mcxt, rraname);
+	heap->entries[0] = *entry;
+	topk_sift_down(heap, 0);
+} /* topk_add */
+
+static int
+topk_entry_cmp(const void *a, const void *b)
+{
+	const topk_entry_t *e1 = (const topk_entry_t *)a;
+	const topk_entry_t *e2 = (const topk_entry_t *)b;
+
+	if (e1->value > e2->value)
+		return -1;
+	else if (e1->value < e2->value)
+		return 1;
+	return strcmp(e1->rraname, e2->rraname);
+} /* topk_entry_cmp */
+
+/*
+ * topk_bound:
+ * Determine an upper bound of any consolidated value of 'rraname' in the
+ * time window [start, end] from an archive using the MAX consolidation
+ * function covering the entire window and being coarser than the selected
+ * archive (and, thus, cheaper to scan). Cascaded archives lag behind the
+ * updates, so they are only used once they have been cascaded up to the
+ * end of the window. The caller has to be connected to the SPI manager.
+ *
+ * Returns:
+ *  - true if a bound has been determined
+ *  - false else
+ */
+static bool
+topk_bound(const char *rraname, source_t *selected,
+		TimestampTz start, TimestampTz end, float8 *bound)
+{
+	StringInfoData query;
+	Oid   argtypes[] = { TEXTOID, TIMESTAMPTZOID, TEXTOID, FLOAT8OID,
+		TIMESTAMPTZOID };
+	Datum args[5];
+
+	source_t     summary;
+	topk_entry_t max;
+	int spi_rc;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT a.tbl, a.tscol, a.vcol "
+				"FROM PostRR_archives($1) AS a "
+				"JOIN postrr.rrarchives AS r "
+					"ON r.rraname = $1 AND r.tbl = a.tbl "
+					"AND r.tscol = a.tscol AND r.vcol = a.vcol "
+				"JOIN pg_catalog.pg_attribute AS att "
+					"ON att.attrelid = a.tbl::regclass "
+					"AND att.attname = a.vcol "
+				"WHERE a.idcol IS NULL "
+					"AND att.atttypid = 'cdata'::regtype "
+					"AND att.atttypmod = %d "
+					"AND a.tslen * a.tsnum >= "
+						"extract(epoch FROM now() - $2) "
+					"AND a.tbl::text <> $3 AND a.tslen > $4 "
+					"AND (NOT r.cascade OR r.cascaded_until >= $5) "
+				"ORDER BY a.tslen DESC LIMIT 1", RRCORE_CF_MAX);
+
+	args[0] = CStringGetTextDatum(rraname);
+	args[1] = TimestampTzGetDatum(start);
+	args[2] = CStringGetTextDatum(selected->tbl);
+	args[3] = Float8GetDatum((float8)selected->len / (float8)USECS_PER_SEC);
+	args[4] = TimestampTzGetDatum(end);
+
+	spi_rc = SPI_execute_with_args(query.data, 5, argtypes, args,
+			/* nulls = */ NULL, /* read only = */ true, /* count = */ 1);
+	if (spi_rc != SPI_OK_SELECT)
+		ereport(ERROR, (
+					errmsg("failed to look up summary archive of %s: %s",
+						rraname, SPI_result_code_string(spi_rc))
+				));
+	pfree(query.data);
+
+	if (SPI_processed != 1) {
+		SPI_freetuptable(SPI_tuptable);
+		return false;
+	}
+
+	memset(&summary, 0, sizeof(summary));
+	summary.tbl   = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 1);
+	summary.tscol = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 2);
+	summary.vcol  = SPI_getvalue(SPI_tuptable->vals[0],
+			SPI_tuptable->tupdesc, 3);
+	SPI_freetuptable(SPI_tuptable);
+
+	source_consolidate(&summary, start, end, &max);
+	if (isnan(max.value))
+		return false;
+
+	*bound = max.value;
+	return true;
+} /* topk_bound */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_fetch);
+PG_FUNCTION_INFO_V1(postrr_downsample);
+PG_FUNCTION_INFO_V1(postrr_rate);
+PG_FUNCTION_INFO_V1(postrr_cdef);
+PG_FUNCTION_INFO_V1(postrr_topk);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_fetch(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext  oldcontext;
+	TupleDesc      tupdesc;
+
+	fetch_state_t state;
+	window_t      window;
+
+	StringInfoData query;
+	StringInfoData prev_query;
+	int spi_rc;
+	int off;
+
+	if ((PG_NARGS() != 6) && (PG_NARGS() != 8))
+		ereport(ERROR, (
+					errmsg("PostRR_fetch() expects six or eight arguments"),
+					errhint("Usage: PostRR_fetch(table, [series column, "
+						"series id,] timeslice column, value column, "
+						"start, end, fill)")
+				));
+
+	/* multi-series archives: series column and id follow the table name */
+	off = (PG_NARGS() == 8) ? 2 : 0;
+
+	if ((! rsinfo) || (! IsA(rsinfo, ReturnSetInfo))
+			|| (! (rsinfo->allowedModes & SFRM_Materialize)))
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("set-valued function called in context "
+						"that cannot accept a set")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	memset(&state, 0, sizeof(state));
+	state.fill = fetch_parse_fill(
+			text_to_cstring(PG_GETARG_TEXT_P(5 + off)));
+
+	oldcontext = MemoryContextSwitchTo(
+			rsinfo->econtext->ecxt_per_query_memory);
+	state.tupdesc  = CreateTupleDescCopy(tupdesc);
+	state.tupstore = tuplestore_begin_heap(/* random access = */ true,
+			/* inter xact = */ false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to fetch archive data: "
+						"could not connect to SPI manager: %s",
+						SPI_result_code_string(spi_rc))
+				));
+
+	initStringInfo(&query);
+	window_init(&window, &query, NameStr(*PG_GETARG_NAME(0)),
+			off ? NameStr(*PG_GETARG_NAME(1)) : NULL,
+			off ? PG_GETARG_INT64(2) : 0,
+			NameStr(*PG_GETARG_NAME(1 + off)),
+			NameStr(*PG_GETARG_NAME(2 + off)),
+			PG_GETARG_TIMESTAMPTZ(3 + off), PG_GETARG_TIMESTAMPTZ(4 + off));
+
+	initStringInfo(&prev_query);
+	if ((state.fill == FILL_LAST) || (state.fill == FILL_LINEAR))
+		window_prev_query(&prev_query, NameStr(*PG_GETARG_NAME(0)),
+				off ? NameStr(*PG_GETARG_NAME(1)) : NULL,
+				off ? PG_GETARG_INT64(2) : 0,
+				NameStr(*PG_GETARG_NAME(1 + off)),
+				NameStr(*PG_GETARG_NAME(2 + off)));
+
+	state.cur  = rrtimeslice_create(window.first, window.typmod);
+	state.last = window.last;
+
+	fetch_run(&state, &window, query.data,
+			prev_query.len ? prev_query.data : NULL);
+	SPI_finish();
+
+	tuplestore_donestoring(state.tupstore);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = state.tupstore;
+	rsinfo->setDesc    = state.tupdesc;
+	return (Datum)0;
+} /* postrr_fetch */
+
+Datum
+postrr_downsample(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext  oldcontext;
+	TupleDesc      tupdesc;
+
+	ds_state_t state;
+	window_t   window;
+	int32      points;
+
+	StringInfoData query;
+	int spi_rc;
+	int off;
+
+	if ((PG_NARGS() != 7) && (PG_NARGS() != 9))
+		ereport(ERROR, (
+					errmsg("PostRR_downsample() expects seven or nine "
+						"arguments"),
+					errhint("Usage: PostRR_downsample(table, [series column, "
+						"series id,] timeslice column, value column, "
+						"start, end, points, method)")
+				));
+
+	/* multi-series archives: series column and id follow the table name */
+	off = (PG_NARGS() == 9) ? 2 : 0;
+
+	if ((! rsinfo) || (! IsA(rsinfo, ReturnSetInfo))
+			|| (! (rsinfo->allowedModes & SFRM_Materialize)))
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("set-valued function called in context "
+						"that cannot accept a set")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	memset(&state, 0, sizeof(state));
+	state.method = downsample_parse_method(
+			text_to_cstring(PG_GETARG_TEXT_P(6 + off)));
+
+	points = PG_GETARG_INT32(5 + off);
+	if (points < ((state.method == DOWNSAMPLE_LTTB) ? 3 : 2))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid number of points for %s downsampling: %d",
+						DOWNSAMPLE_TO_STR(state.method), points)
+				));
+
+	/* LTTB: first and last point go into buckets of their own;
+	 * min/max: up to two points per bucket */
+	if (state.method == DOWNSAMPLE_LTTB)
+		state.buckets_num = points - 2;
+	else
+		state.buckets_num = points / 2;
+
+	oldcontext = MemoryContextSwitchTo(
+			rsinfo->econtext->ecxt_per_query_memory);
+	state.tupdesc  = CreateTupleDescCopy(tupdesc);
+	state.tupstore = tuplestore_begin_heap(/* random access = */ true,
+			/* inter xact = */ false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to downsample archive data: "
+						"could not connect to SPI manager: %s",
+						SPI_result_code_string(spi_rc))
+				));
+
+	initStringInfo(&query);
+	window_init(&window, &query, NameStr(*PG_GETARG_NAME(0)),
+			off ? NameStr(*PG_GETARG_NAME(1)) : NULL,
+			off ? PG_GETARG_INT64(2) : 0,
+			NameStr(*PG_GETARG_NAME(1 + off)),
+			NameStr(*PG_GETARG_NAME(2 + off)),
+			PG_GETARG_TIMESTAMPTZ(3 + off), PG_GETARG_TIMESTAMPTZ(4 + off));
+
+	state.first = window.first;
+	state.last  = window.last;
+
+	downsample_run(&state, query.data);
+	SPI_finish();
+
+	tuplestore_donestoring(state.tupstore);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = state.tupstore;
+	rsinfo->setDesc    = state.tupdesc;
+	return (Datum)0;
+} /* postrr_downsample */
+
+Datum
+postrr_rate(PG_FUNCTION_ARGS)
+{
+	int         dstype;
+	TimestampTz tstamp;
+	float8      value;
+	float8      last_value = NAN;
+	float8      interval = 0.0;
+
+	if (PG_NARGS() != 5)
+		ereport(ERROR, (
+					errmsg("PostRR_rate() expects five arguments"),
+					errhint("Usage: PostRR_rate(dstype, "
+						"last_update, last_value, timestamp, value)")
+				));
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(3))
+		PG_RETURN_NULL();
+
+	dstype = rate_parse_dstype(text_to_cstring(PG_GETARG_TEXT_P(0)));
+	tstamp = PG_GETARG_TIMESTAMPTZ(3);
+	value  = PG_ARGISNULL(4) ? NAN : PG_GETARG_FLOAT8(4);
+
+	if ((dstype == DSTYPE_GAUGE) || PG_ARGISNULL(1))
+		PG_RETURN_FLOAT8(rate_compute(dstype, last_value, value, interval));
+
+	if (PG_GETARG_TIMESTAMPTZ(1) >= tstamp)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("illegal attempt to update using time %s "
+						"when last update time is %s",
+						timestamptz_to_str(tstamp),
+						timestamptz_to_str(PG_GETARG_TIMESTAMPTZ(1)))
+				));
+
+	if (! PG_ARGISNULL(2))
+		last_value = PG_GETARG_FLOAT8(2);
+
+	interval = (float8)(tstamp - PG_GETARG_TIMESTAMPTZ(1))
+		/ (float8)USECS_PER_SEC;
+	PG_RETURN_FLOAT8(rate_compute(dstype, last_value, value, interval));
+} /* postrr_rate */
+
+Datum
+postrr_cdef(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext  mcxt = CurrentMemoryContext;
+	MemoryContext  oldcontext;
+	TupleDesc      tupdesc;
+	Tuplestorestate *tupstore;
+
+	rrcore_cdef_t cdef;
+	char          errbuf[256];
+
+	source_t *sources;
+	const char   **names;
+	float8       **vars;
+	float8        *times;
+	float8        *result;
+	int32         *val_nums;
+
+	Datum *elems;
+	bool  *elem_nulls;
+	int    sources_num;
+
+	TimestampTz start, end, first, last;
+	int32 points;
+	int64  step = 0;
+	int64  n, i;
+	uint32 seq;
+	int    spi_rc;
+	int    s;
+
+	if (PG_NARGS() != 5)
+		ereport(ERROR, (
+					errmsg("PostRR_cdef() expects five arguments"),
+					errhint("Usage: PostRR_cdef(expression, rranames, "
+						"start, end, points)")
+				));
+
+	if ((! rsinfo) || (! IsA(rsinfo, ReturnSetInfo))
+			|| (! (rsinfo->allowedModes & SFRM_Materialize)))
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("set-valued function called in context "
+						"that cannot accept a set")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	deconstruct_array(PG_GETARG_ARRAYTYPE_P(1), TEXTOID, -1, false, 'i',
+			&elems, &elem_nulls, &sources_num);
+	if (sources_num < 1)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("CDEF expressions require at least one rraname")
+				));
+
+	names = (const char **)palloc(sources_num * sizeof(*names));
+	for (s = 0; s < sources_num; ++s) {
+		if (elem_nulls[s])
+			ereport(ERROR, (
+						errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("rraname of CDEF variable $%d is NULL", s + 1)
+					));
+		names[s] = TextDatumGetCString(elems[s]);
+	}
+
+	/* compile the expression once, before touching any data */
+	if (rrcore_cdef_compile(&cdef, text_to_cstring(PG_GETARG_TEXT_P(0)),
+				names, sources_num, errbuf, sizeof(errbuf)))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid CDEF expression: %s", errbuf)
+				));
+
+	start  = PG_GETARG_TIMESTAMPTZ(2);
+	end    = PG_GETARG_TIMESTAMPTZ(3);
+	points = PG_GETARG_INT32(4);
+
+	if (end < start)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid time window: end lies before start")
+				));
+
+	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to evaluate CDEF expression: "
+						"could not connect to SPI manager: %s",
+						SPI_result_code_string(spi_rc))
+				));
+
+	sources = (source_t *)palloc0(sources_num * sizeof(*sources));
+	for (s = 0; s < sources_num; ++s) {
+		source_init(sources + s, names[s], start, end, points);
+		step = Max(step, sources[s].len);
+	}
+
+	/* all archives are aligned to the coarsest one; as for casting
+	 * timeslices, this requires the lengths to divide evenly */
+	for (s = 0; s < sources_num; ++s)
+		if (step % sources[s].len != 0)
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("cannot align archive %s of %s "
+							"(slices of " INT64_FORMAT "us) to slices "
+							"of " INT64_FORMAT "us", sources[s].tbl,
+							sources[s].rraname, sources[s].len, step),
+						errhint("The lengths of the slices of all archives "
+							"have to divide evenly.")
+					));
+
+	rrtimeslice_locate(start, step, 1, &first, &seq);
+	rrtimeslice_locate(end, step, 1, &last, &seq);
+	n = (last - first) / step + 1;
+
+	if (n > (int64)(MaxAllocSize / sizeof(float8)))
+		ereport(ERROR, (
+					errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					errmsg("time window too large for CDEF expression: "
+						INT64_FORMAT " steps", n)
+				));
+
+	/* the aligned vectors are used after disconnecting from SPI */
+	vars     = (float8 **)MemoryContextAlloc(mcxt,
+			sources_num * sizeof(*vars));
+	val_nums = (int32 *)palloc(n * sizeof(*val_nums));
+	for (s = 0; s < sources_num; ++s) {
+		vars[s] = (float8 *)MemoryContextAlloc(mcxt, n * sizeof(float8));
+		cdef_source_load(sources + s, first, step, n, vars[s], val_nums);
+	}
+
+	SPI_finish();
+
+	times  = (float8 *)palloc(n * sizeof(*times));
+	result = (float8 *)palloc(n * sizeof(*result));
+	for (i = 0; i < n; ++i)
+		times[i] = (float8)(first + i * step - time_t_to_timestamptz(0))
+			/ (float8)USECS_PER_SEC;
+
+	rrcore_cdef_eval(&cdef, (const double * const *)vars, times,
+			(float8)step / (float8)USECS_PER_SEC, (size_t)n, result);
+
+	oldcontext = MemoryContextSwitchTo(
+			rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc  = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(/* random access = */ true,
+			/* inter xact = */ false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; i < n; ++i) {
+		Datum values[2];
+		bool  nulls[2] = { false, false };
+
+		values[0] = TimestampTzGetDatum(first + i * step);
+		values[1] = Float8GetDatum(result[i]);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+	return (Datum)0;
+} /* postrr_cdef */
+
+Datum
+postrr_topk(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext  mcxt = CurrentMemoryContext;
+	MemoryContext  scan_cxt;
+	MemoryContext  oldcontext;
+	TupleDesc      tupdesc;
+	Tuplestorestate *tupstore;
+
+	/* rranames with any multi-series archives are skipped altogether;
+	 * source_init() might select one of those */
+	const char *query = "SELECT rraname FROM postrr.rrarchives "
+		"WHERE rraname LIKE $1 GROUP BY rraname "
+		"HAVING bool_and(idcol IS NULL) ORDER BY rraname";
+	Oid    argtypes[] = { TEXTOID };
+	Datum  args[1];
+	Portal portal;
+
+	topk_heap_t heap;
+	TimestampTz start, end;
+	bool  prune;
+	int32 k;
+
+	int64 scanned = 0, pruned = 0;
+	int   spi_rc;
+	int   i;
+
+	if (PG_NARGS() != 5)
+		ereport(ERROR, (
+					errmsg("PostRR_topk() expects five arguments"),
+					errhint("Usage: PostRR_topk(pattern, start, end, k, "
+						"prune)")
+				));
+
+	if ((! rsinfo) || (! IsA(rsinfo, ReturnSetInfo))
+			|| (! (rsinfo->allowedModes & SFRM_Materialize)))
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("set-valued function called in context "
+						"that cannot accept a set")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	start = PG_GETARG_TIMESTAMPTZ(1);
+	end   = PG_GETARG_TIMESTAMPTZ(2);
+	k     = PG_GETARG_INT32(3);
+	prune = PG_GETARG_BOOL(4);
+
+	if ((k < 1) || ((Size)k > MaxAllocSize / sizeof(topk_entry_t)))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid number of series requested: %d", k)
+				));
+
+	if (end < start)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid time window: end lies before start")
+				));
+
+	/* the heap keeps memory usage independent of the number of archives */
+	memset(&heap, 0, sizeof(heap));
+	heap.k       = k;
+	heap.entries = (topk_entry_t *)palloc(k * sizeof(*heap.entries));
+
+	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to query top-K series: "
+						"could not connect to SPI manager: %s",
+						SPI_result_code_string(spi_rc))
+				));
+
+	/* everything allocated while processing an rraname is released before
+	 * moving on to the next one */
+	scan_cxt = AllocSetContextCreate(CurrentMemoryContext,
+			"PostRR top-K scan", ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+
+	args[0] = PG_GETARG_DATUM(0);
+	portal = SPI_cursor_open_with_args(/* name = */ NULL, query,
+			1, argtypes, args, /* nulls = */ NULL,
+			/* read only = */ true, /* cursor options = */ 0);
+
+	while (42) {
+		SPITupleTable *batch;
+		uint64 batch_num, j;
+
+		SPI_cursor_fetch(portal, /* forward = */ true, TOPK_BATCH_SIZE);
+		if (SPI_processed <= 0)
+			break;
+
+		/* further queries replace SPI_tuptable */
+		batch     = SPI_tuptable;
+		batch_num = SPI_processed;
+
+		for (j = 0; j < batch_num; ++j) {
+			char        *rraname;
+			source_t     source;
+			topk_entry_t entry;
+			float8       bound;
+
+			oldcontext = MemoryContextSwitchTo(scan_cxt);
+
+			rraname = SPI_getvalue(batch->vals[j], batch->tupdesc, 1);
+			source_init(&source, rraname, start, end, /* points = */ 1);
+
+			/* skip the archive if even its maximum can't make it */
+			if (prune && topk_is_full(&heap)
+					&& topk_bound(rraname, &source, start, end, &bound)
+					&& (bound <= topk_min(&heap))) {
+				++pruned;
+			}
+			else {
+				source_consolidate(&source, start, end, &entry);
+				topk_add(&heap, &entry, rraname, mcxt);
+				++scanned;
+			}
+
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(scan_cxt);
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		SPI_freetuptable(batch);
+	}
+	SPI_cursor_close(portal);
+
+	MemoryContextDelete(scan_cxt);
+	SPI_finish();
+
+	elog(DEBUG1, "PostRR_topk(): scanned " INT64_FORMAT " archives, "
+			"pruned " INT64_FORMAT " archives", scanned, pruned);
+
+	qsort(heap.entries, heap.entries_num, sizeof(*heap.entries),
+			topk_entry_cmp);
+
+	oldcontext = MemoryContextSwitchTo(
+			rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc  = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(/* random access = */ true,
+			/* inter xact = */ false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; i < heap.entries_num; ++i) {
+		topk_entry_t *entry = heap.entries + i;
+
+		Datum values[2];
+		bool  nulls[2] = { false, false };
+
+		values[0] = CStringGetTextDatum(entry->rraname);
+		values[1] = PointerGetDatum(cdata_create(entry->value,
+					entry->undef_num, entry->val_num, entry->cf));
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+	return (Datum)0;
+} /* postrr_topk */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,692 @@
+/*
+ * PostRR - src/rrcache.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A shared memory cache of the most recent slice of each archive (and
+ * series of multi-series archives), allowing to look up current values
+ * without accessing the archive tables. Archives are identified by their
+ * table and the timeslice and value columns (a table may hold more than one
+ * archive). Updates are queued by PostRR_update() and applied to the cache
+ * once the updating transaction commits, such that the cache never exposes
+ * uncommitted data. Deleted (or truncated) slices are removed from the cache
+ * the same way by a trigger on the archive table; dropping the table removes
+ * all of its entries. Once the cache is full, entries are replaced using a
+ * clock (approximating LRU). Lookups fall back to the archive table on a
+ * miss (see PostRR_latest()).
+ *
+ * The cache requires PostRR to be loaded using shared_preload_libraries and
+ * is available for PostgreSQL 9.6 or later only.
+ */
+
+#include "postrr.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+
+/* Postgres utilities */
+#include <access/htup_details.h>
+#include <access/xact.h>
+#include <catalog/objectaccess.h>
+#include <catalog/pg_class.h>
+#include <commands/trigger.h>
+#include <executor/spi.h>
+#include <miscadmin.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/guc.h>
+#include <utils/hsearch.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/rel.h>
+#include <utils/timestamp.h>
+
+#if PG_VERSION_NUM >= 90600
+
+/*
+ * data types
+ */
+
+typedef struct {
+	Oid        relid;
+	AttrNumber tsattnum;
+	AttrNumber vattnum;
+	int64      id;
+} rrcache_key_t;
+
+typedef struct {
+	rrcache_key_t key;
+
+	/* end of the most recent slice and its value */
+	TimestampTz tstamp;
+	float8      value;
+	int32       undef_num;
+	int32       val_num;
+	int32       cf;
+
+	/* position in the clock */
+	int         slot;
+} rrcache_entry_t;
+
+/* a position in the clock used to pick the entry to be replaced once the
+ * cache is full; recently used entries get another chance */
+typedef struct {
+	rrcache_key_t key;
+	bool          used;
+	bool          referenced;
+} rrcache_slot_t;
+
+typedef struct {
+	LWLock *lock;
+
+	int            hand;
+	rrcache_slot_t slots[FLEXIBLE_ARRAY_MEMBER];
+} rrcache_shared_t;
+
+enum {
+	/* store the slice unless a newer one is cached */
+	RRCACHE_PUT,
+	/* remove the entry if it does not hold a newer slice */
+	RRCACHE_DELETE,
+	/* remove all entries of the table (key.relid) */
+	RRCACHE_DELETE_REL
+};
+
+typedef struct {
+	rrcache_entry_t entry;
+	int op;
+
+	/* (sub-)transaction level of the update */
+	int level;
+} rrcache_pending_t;
+
+/*
+ * configuration
+ */
+
+static int cache_size = 10000;
+
+/*
+ * shared state
+ */
+
+static rrcache_shared_t *rrcache_shared = NULL;
+static HTAB             *rrcache_hash   = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static object_access_hook_type prev_object_access_hook = NULL;
+
+/* updates of the current transaction (allocated in TopTransactionContext) */
+static rrcache_pending_t *pending      = NULL;
+static int                pending_num  = 0;
+static int                pending_size = 0;
+
+/*
+ * internal helper functions
+ */
+
+static Size
+rrcache_shmem_size(void)
+{
+	Size size;
+
+	size = add_size(offsetof(rrcache_shared_t, slots),
+			mul_size(cache_size, sizeof(rrcache_slot_t)));
+	return add_size(MAXALIGN(size),
+			hash_estimate_size(cache_size, sizeof(rrcache_entry_t)));
+} /* rrcache_shmem_size */
+
+static void
+rrcache_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(rrcache_shmem_size());
+	RequestNamedLWLockTranche("postrr_cache", 1);
+} /* rrcache_shmem_request */
+
+static void
+rrcache_shmem_startup(void)
+{
+	HASHCTL ctl;
+	bool    found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	rrcache_shared = ShmemInitStruct("postrr_cache",
+			add_size(offsetof(rrcache_shared_t, slots),
+				mul_size(cache_size, sizeof(rrcache_slot_t))), &found);
+	if (! found) {
+		rrcache_shared->lock = &(GetNamedLWLockTranche("postrr_cache"))->lock;
+		rrcache_shared->hand = 0;
+		memset(rrcache_shared->slots, 0,
+				cache_size * sizeof(*rrcache_shared->slots));
+	}
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize   = sizeof(rrcache_key_t);
+	ctl.entrysize = sizeof(rrcache_entry_t);
+
+	rrcache_hash = ShmemInitHash("postrr_cache hash",
+			cache_size, cache_size, &ctl, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+} /* rrcache_shmem_startup */
+
+static rrcache_pending_t *
+rrcache_pending_add(int op)
+{
+	rrcache_pending_t *update;
+
+	if (pending_num >= pending_size) {
+		pending_size = pending_size ? 2 * pending_size : 16;
+		if (pending)
+			pending = (rrcache_pending_t *)repalloc(pending,
+					pending_size * sizeof(*pending));
+		else
+			pending = (rrcache_pending_t *)MemoryContextAlloc(
+					TopTransactionContext, pending_size * sizeof(*pending));
+	}
+
+	update = &pending[pending_num];
+	++pending_num;
+
+	memset(update, 0, sizeof(*update));
+	update->op    = op;
+	update->level = GetCurrentTransactionNestLevel();
+	return update;
+} /* rrcache_pending_add */
+
+static void
+rrcache_key_init(rrcache_key_t *key, Oid relid,
+		const char *tscol, const char *vcol, int64 id)
+{
+	memset(key, 0, sizeof(*key));
+	key->relid    = relid;
+	key->tsattnum = get_attnum(relid, tscol);
+	key->vattnum  = get_attnum(relid, vcol);
+	key->id       = id;
+
+	if ((key->tsattnum == InvalidAttrNumber)
+			|| (key->vattnum == InvalidAttrNumber))
+		ereport(ERROR, (
+					errcode(ERRCODE_UNDEFINED_COLUMN),
+					errmsg("archive %s.%s/%s does not exist",
+						get_rel_name(relid), tscol, vcol)
+				));
+} /* rrcache_key_init */
+
+/*
+ * rrcache_enter:
+ * Create a new entry, replacing an entry which has not been used recently
+ * if the cache is full. The caller has to hold the lock in exclusive mode.
+ * Returns NULL if no entry could be created.
+ */
+static rrcache_entry_t *
+rrcache_enter(const rrcache_key_t *key)
+{
+	rrcache_slot_t  *slot;
+	rrcache_entry_t *entry;
+	bool found;
+
+	/* unused slots are taken right away; all others are taken within two
+	 * rounds of the clock */
+	while (42) {
+		slot = &rrcache_shared->slots[rrcache_shared->hand];
+		rrcache_shared->hand = (rrcache_shared->hand + 1) % cache_size;
+
+		if (! slot->used)
+			break;
+		if (! slot->referenced) {
+			hash_search(rrcache_hash, &slot->key, HASH_REMOVE, NULL);
+			slot->used = false;
+			break;
+		}
+		slot->referenced = false;
+	}
+
+	entry = (rrcache_entry_t *)hash_search(rrcache_hash, key,
+			HASH_ENTER_NULL, &found);
+	if (! entry)
+		return NULL;
+
+	entry->slot      = (int)(slot - rrcache_shared->slots);
+	slot->key        = *key;
+	slot->used       = true;
+	slot->referenced = true;
+	return entry;
+} /* rrcache_enter */
+
+static void
+rrcache_remove(rrcache_entry_t *entry)
+{
+	rrcache_shared->slots[entry->slot].used = false;
+	hash_search(rrcache_hash, &entry->key, HASH_REMOVE, NULL);
+} /* rrcache_remove */
+
+static void
+rrcache_remove_rel(Oid relid)
+{
+	HASH_SEQ_STATUS  status;
+	rrcache_entry_t *entry;
+
+	hash_seq_init(&status, rrcache_hash);
+	while ((entry = (rrcache_entry_t *)hash_seq_search(&status)) != NULL)
+		if (entry->key.relid == relid)
+			rrcache_remove(entry);
+} /* rrcache_remove_rel */
+
+/*
+ * rrcache_flush:
+ * Apply all pending updates to the cache. Older slices never replace newer
+ * ones. New entries replace old ones once the cache is full. If 'prepared' is
+ * true, all entries touched by the transaction are removed instead: its
+ * changes become visible with COMMIT PREPARED, which may happen in a
+ * different session, and the cache must not keep serving the old slices.
+ */
+static void
+rrcache_flush(bool prepared)
+{
+	int i;
+
+	if ((! pending_num) || (! rrcache_hash))
+		return;
+
+	LWLockAcquire(rrcache_shared->lock, LW_EXCLUSIVE);
+	for (i = 0; i < pending_num; ++i) {
+		rrcache_entry_t *update = &pending[i].entry;
+		rrcache_entry_t *entry;
+		bool found;
+
+		if (pending[i].op == RRCACHE_DELETE_REL) {
+			rrcache_remove_rel(update->key.relid);
+			continue;
+		}
+
+		entry = (rrcache_entry_t *)hash_search(rrcache_hash, &update->key,
+				HASH_FIND, &found);
+
+		if (prepared || (pending[i].op == RRCACHE_DELETE)) {
+			if (entry && (prepared || (entry->tstamp <= update->tstamp)))
+				rrcache_remove(entry);
+			continue;
+		}
+
+		if (! entry)
+			entry = rrcache_enter(&update->key);
+		else if (entry->tstamp > update->tstamp)
+			continue;
+
+		if (entry) {
+			int slot = entry->slot;
+
+			memcpy(entry, update, sizeof(*entry));
+			entry->slot = slot;
+			rrcache_shared->slots[slot].referenced = true;
+		}
+	}
+	LWLockRelease(rrcache_shared->lock);
+} /* rrcache_flush */
+
+static void
+rrcache_xact_callback(XactEvent event, void *arg)
+{
+	switch (event) {
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			rrcache_flush(/* prepared = */ event == XACT_EVENT_PREPARE);
+			/* fall through */
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* the memory is released along with the transaction */
+			pending      = NULL;
+			pending_num  = 0;
+			pending_size = 0;
+			break;
+		default:
+			break;
+	}
+} /* rrcache_xact_callback */
+
+static void
+rrcache_subxact_callback(SubXactEvent event, SubTransactionId subid,
+		SubTransactionId parent_subid, void *arg)
+{
+	int level = GetCurrentTransactionNestLevel();
+	int i, n;
+
+	if (event == SUBXACT_EVENT_ABORT_SUB) {
+		/* forget about all updates of the aborted subtransaction */
+		for (i = 0, n = 0; i < pending_num; ++i)
+			if (pending[i].level < level)
+				pending[n++] = pending[i];
+		pending_num = n;
+	}
+	else if (event == SUBXACT_EVENT_COMMIT_SUB) {
+		for (i = 0; i < pending_num; ++i)
+			if (pending[i].level >= level)
+				pending[i].level = level - 1;
+	}
+} /* rrcache_subxact_callback */
+
+/*
+ * rrcache_object_access:
+ * Remove the entries (and statistics) of dropped tables, such that they do
+ * not fill up the cache. The entries are removed once the transaction
+ * commits.
+ */
+static void
+rrcache_object_access(ObjectAccessType access, Oid classId, Oid objectId,
+		int subId, void *arg)
+{
+	rrcache_pending_t *update;
+	char relkind;
+
+	if (prev_object_access_hook)
+		prev_object_access_hook(access, classId, objectId, subId, arg);
+
+	if ((access != OAT_DROP) || (classId != RelationRelationId)
+			|| (subId != 0))
+		return;
+
+	/* indexes, sequences, views, etc. never hold archives */
+	relkind = get_rel_relkind(objectId);
+	if ((relkind != RELKIND_RELATION)
+#if PG_VERSION_NUM >= 100000
+			&& (relkind != RELKIND_PARTITIONED_TABLE)
+#endif
+			)
+		return;
+
+	if (rrcache_hash) {
+		update = rrcache_pending_add(RRCACHE_DELETE_REL);
+		update->entry.key.relid = objectId;
+	}
+	rrstat_forget_rel(objectId);
+} /* rrcache_object_access */
+
+#endif /* PG_VERSION_NUM >= 90600 */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_cache_put);
+PG_FUNCTION_INFO_V1(postrr_cache_get);
+PG_FUNCTION_INFO_V1(postrr_cache_invalidate);
+PG_FUNCTION_INFO_V1(postrr_cache_forget);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_cache_put(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 90600
+	rrcache_pending_t *update;
+	rrcache_key_t      key;
+	rrtimeslice_t     *tslice;
+	cdata_t           *data;
+
+	if (PG_NARGS() != 6)
+		ereport(ERROR, (
+					errmsg("PostRR_cache_put() expects six arguments"),
+					errhint("Usage: PostRR_cache_put(table, tscol, vcol, "
+						"series id, timeslice, value)")
+				));
+
+	/* the cache is not available */
+	if (! rrcache_hash)
+		PG_RETURN_VOID();
+
+	rrcache_key_init(&key, PG_GETARG_OID(0),
+			NameStr(*PG_GETARG_NAME(1)), NameStr(*PG_GETARG_NAME(2)),
+			PG_GETARG_INT64(3));
+	tslice = PG_GETARG_RRTIMESLICE_P(4);
+	data   = PG_GETARG_CDATA_P(5);
+
+	update = rrcache_pending_add(RRCACHE_PUT);
+	update->entry.key        = key;
+	update->entry.tstamp     = rrtimeslice_get_tstamp(tslice);
+	update->entry.value      = cdata_get_value(data);
+	update->entry.undef_num  = cdata_get_undef_num(data);
+	update->entry.val_num    = cdata_get_val_num(data);
+	update->entry.cf         = cdata_get_cf(data);
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	PG_RETURN_VOID();
+} /* postrr_cache_put */
+
+Datum
+postrr_cache_get(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 90600
+	rrcache_key_t    key;
+	rrcache_entry_t  entry;
+	rrcache_entry_t *e;
+	bool             found = false;
+
+	TupleDesc tupdesc;
+	HeapTuple tuple;
+	Datum     values[2];
+	bool      nulls[2] = { false, false };
+
+	if (PG_NARGS() != 4)
+		ereport(ERROR, (
+					errmsg("PostRR_cache_get() expects four arguments"),
+					errhint("Usage: PostRR_cache_get(table, tscol, vcol, "
+						"series id)")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	if (! rrcache_hash)
+		PG_RETURN_NULL();
+
+	rrcache_key_init(&key, PG_GETARG_OID(0),
+			NameStr(*PG_GETARG_NAME(1)), NameStr(*PG_GETARG_NAME(2)),
+			PG_GETARG_INT64(3));
+
+	LWLockAcquire(rrcache_shared->lock, LW_SHARED);
+	e = (rrcache_entry_t *)hash_search(rrcache_hash, &key, HASH_FIND, &found);
+	if (e) {
+		memcpy(&entry, e, sizeof(entry));
+		/* setting the flag without an exclusive lock is fine; at worst,
+		 * the entry is not kept for another round of the clock */
+		rrcache_shared->slots[e->slot].referenced = true;
+	}
+	LWLockRelease(rrcache_shared->lock);
+
+	if (! found)
+		PG_RETURN_NULL();
+
+	values[0] = TimestampTzGetDatum(entry.tstamp);
+	values[1] = PointerGetDatum(cdata_create(entry.value,
+				entry.undef_num, entry.val_num, entry.cf));
+
+	tuple = heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+#else /* PG_VERSION_NUM < 90600 */
+	PG_RETURN_NULL();
+#endif /* PG_VERSION_NUM */
+} /* postrr_cache_get */
+
+Datum
+postrr_cache_invalidate(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 90600
+	TriggerData *trigdata;
+	char       **tgargs;
+	int          tgnargs;
+
+	rrcache_pending_t *update;
+	Oid relid;
+
+	if (! CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR, (
+					errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					errmsg("PostRR_cache_invalidate() not called by "
+						"trigger manager")
+				));
+
+	trigdata = (TriggerData *)fcinfo->context;
+	tgnargs  = trigdata->tg_trigger->tgnargs;
+	tgargs   = trigdata->tg_trigger->tgargs;
+
+	if ((! TRIGGER_FIRED_AFTER(trigdata->tg_event))
+			|| (! (TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event)
+					|| (TRIGGER_FIRED_BY_DELETE(trigdata->tg_event)
+						&& TRIGGER_FIRED_FOR_ROW(trigdata->tg_event)))))
+		ereport(ERROR, (
+					errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					errmsg("PostRR_cache_invalidate() must be fired "
+						"AFTER DELETE FOR EACH ROW or AFTER TRUNCATE")
+				));
+
+	if ((tgnargs != 3) && (tgnargs != 4))
+		ereport(ERROR, (
+					errmsg("PostRR_cache_invalidate() expects three or "
+						"four arguments"),
+					errhint("Usage: PostRR_cache_invalidate(archive oid, "
+						"tscol, vcol [, idcol])")
+				));
+
+	if (! rrcache_hash)
+		return PointerGetDatum(NULL);
+
+	/* the trigger may be defined on a partition of the archive table */
+	relid = (Oid)strtoul(tgargs[0], NULL, 10);
+
+	if (TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event)) {
+		update = rrcache_pending_add(RRCACHE_DELETE_REL);
+		update->entry.key.relid = relid;
+	}
+	else {
+		HeapTuple  tuple   = trigdata->tg_trigtuple;
+		TupleDesc  tupdesc = RelationGetDescr(trigdata->tg_relation);
+		rrcache_key_t key;
+		Datum      d;
+		bool       isnull = false;
+		int64      id = 0;
+
+		if (tgnargs > 3) {
+			d = heap_getattr(tuple, SPI_fnumber(tupdesc, tgargs[3]),
+					tupdesc, &isnull);
+			if (! isnull)
+				id = DatumGetInt64(d);
+		}
+		rrcache_key_init(&key, relid, tgargs[1], tgargs[2], id);
+
+		d = heap_getattr(tuple, SPI_fnumber(tupdesc, tgargs[1]),
+				tupdesc, &isnull);
+		if (isnull)
+			return PointerGetDatum(NULL);
+
+		update = rrcache_pending_add(RRCACHE_DELETE);
+		update->entry.key    = key;
+		update->entry.tstamp = rrtimeslice_get_tstamp(
+				(rrtimeslice_t *)DatumGetPointer(d));
+	}
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	return PointerGetDatum(NULL);
+} /* postrr_cache_invalidate */
+
+Datum
+postrr_cache_forget(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 90600
+	rrcache_pending_t *update;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("PostRR_cache_forget() expects one argument"),
+					errhint("Usage: PostRR_cache_forget(table)")
+				));
+
+	if (! rrcache_hash)
+		PG_RETURN_VOID();
+
+	/* the entries are removed once the transaction commits */
+	update = rrcache_pending_add(RRCACHE_DELETE_REL);
+	update->entry.key.relid = PG_GETARG_OID(0);
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	PG_RETURN_VOID();
+} /* postrr_cache_forget */
+
+void
+rrcache_init(void)
+{
+#if PG_VERSION_NUM >= 90600
+	DefineCustomIntVariable("postrr.cache_size",
+			"Number of archives (and series) in the latest value cache.",
+			"The cache is disabled if this is set to zero.",
+			&cache_size, /* boot_value = */ 10000,
+			/* min = */ 0, /* max = */ INT_MAX / 2, PGC_POSTMASTER,
+			/* flags = */ 0, NULL, NULL, NULL);
+
+	RegisterXactCallback(rrcache_xact_callback, NULL);
+	RegisterSubXactCallback(rrcache_subxact_callback, NULL);
+
+	prev_object_access_hook = object_access_hook;
+	object_access_hook      = rrcache_object_access;
+
+	if ((! process_shared_preload_libraries_in_progress) || (! cache_size))
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook      = rrcache_shmem_request;
+#else
+	rrcache_shmem_request();
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook      = rrcache_shmem_startup;
+#endif /* PG_VERSION_NUM >= 90600 */
+} /* rrcache_init */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
+
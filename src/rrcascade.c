@@ -0,0 +1,338 @@
+/*
+ * PostRR - src/rrcascade.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A background worker cascading consolidated data from the finest archive
+ * of each rraname to coarser archives. Cascaded archives (marked as such in
+ * postrr.rrarchives) are not updated by PostRR_update(); instead, the worker
+ * periodically consolidates all completed slices using PostRR_cascade().
+ *
+ * The worker requires PostRR to be loaded using shared_preload_libraries
+ * and is available for PostgreSQL 9.4 or later only.
+ */
+
+#include "postrr.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+
+#if PG_VERSION_NUM >= 90400
+
+#include <errno.h>
+#include <signal.h>
+
+#include <access/xact.h>
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <postmaster/bgworker.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <storage/proc.h>
+#include <utils/builtins.h>
+#include <utils/guc.h>
+#include <utils/resowner.h>
+#include <utils/snapmgr.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+
+#if PG_VERSION_NUM < 90500
+#	define MyLatch (&MyProc->procLatch)
+#endif
+
+#if PG_VERSION_NUM >= 100000
+#	define RRCASCADE_WAIT(events, timeout) \
+		WaitLatch(MyLatch, (events), (timeout), PG_WAIT_EXTENSION)
+#else
+#	define RRCASCADE_WAIT(events, timeout) \
+		WaitLatch(MyLatch, (events), (timeout))
+#endif
+
+#if PG_VERSION_NUM >= 110000
+#	define RRCASCADE_CONNECT(db) \
+		BackgroundWorkerInitializeConnection((db), NULL, 0)
+#else
+#	define RRCASCADE_CONNECT(db) \
+		BackgroundWorkerInitializeConnection((db), NULL)
+#endif
+
+/* the cascaded archives are distributed among the workers by name */
+#define RRCASCADE_LIST_QUERY \
+	"SELECT rraname, tbl, tscol, vcol " \
+	"FROM postrr.rrarchives WHERE cascade " \
+	"AND (hashtext(rraname || tbl) & 2147483647) % $1 = $2"
+
+#define RRCASCADE_QUERY \
+	"SELECT PostRR_cascade($1, $2::name, $3::name, $4::name, $5)"
+
+/*
+ * configuration
+ */
+
+static char *cascade_database = NULL;
+static int   cascade_naptime  = 60;
+static int   cascade_workers  = 1;
+static int   cascade_batch    = 100;
+
+static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup  = false;
+
+/*
+ * internal helper functions
+ */
+
+static void
+rrcascade_sigterm(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sigterm = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+} /* rrcascade_sigterm */
+
+static void
+rrcascade_sighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+} /* rrcascade_sighup */
+
+/*
+ * Cascade a single archive. Errors are reported as warnings only, such that
+ * a broken archive does not keep all other archives from being cascaded.
+ */
+static void
+rrcascade_archive(char *values[4])
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner   = CurrentResourceOwner;
+
+	Oid   argtypes[5] = { TEXTOID, TEXTOID, TEXTOID, TEXTOID, INT4OID };
+	Datum args[5];
+	int   i;
+
+	for (i = 0; i < 4; ++i)
+		args[i] = CStringGetTextDatum(values[i]);
+	args[4] = Int32GetDatum(cascade_batch);
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		int ret;
+
+		ret = SPI_execute_with_args(RRCASCADE_QUERY, 5, argtypes, args,
+				/* nulls = */ NULL, /* read_only = */ false, /* count = */ 0);
+		if (ret != SPI_OK_SELECT)
+			ereport(ERROR, (
+						errmsg("%s", SPI_result_code_string(ret))
+					));
+		SPI_freetuptable(SPI_tuptable);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		ereport(WARNING, (
+					errmsg("failed to cascade round-robin archive %s "
+						"(%s.%s.%s): %s", values[0], values[1], values[2],
+						values[3], edata->message)
+				));
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+} /* rrcascade_archive */
+
+static void
+rrcascade_run(int32 worker_id)
+{
+	Oid   argtypes[2] = { INT4OID, INT4OID };
+	Datum args[2];
+
+	char ***archives;
+	int    n, i;
+	int    ret;
+
+	args[0] = Int32GetDatum(cascade_workers);
+	args[1] = Int32GetDatum(worker_id);
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, RRCASCADE_LIST_QUERY);
+
+	ret = SPI_execute_with_args(RRCASCADE_LIST_QUERY, 2, argtypes, args,
+			/* nulls = */ NULL, /* read_only = */ true, /* count = */ 0);
+	if (ret != SPI_OK_SELECT)
+		ereport(ERROR, (
+					errmsg("failed to list round-robin archives to cascade: "
+						"%s", SPI_result_code_string(ret))
+				));
+
+	/* the result set does not survive the following queries */
+	n = (int)SPI_processed;
+	archives = palloc(Max(n, 1) * sizeof(*archives));
+	for (i = 0; i < n; ++i) {
+		int j;
+
+		archives[i] = palloc(4 * sizeof(**archives));
+		for (j = 0; j < 4; ++j)
+			archives[i][j] = SPI_getvalue(SPI_tuptable->vals[i],
+					SPI_tuptable->tupdesc, j + 1);
+	}
+	SPI_freetuptable(SPI_tuptable);
+
+	pgstat_report_activity(STATE_RUNNING, RRCASCADE_QUERY);
+	for (i = 0; (i < n) && (! got_sigterm); ++i)
+		rrcascade_archive(archives[i]);
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+} /* rrcascade_run */
+
+/*
+ * public API
+ */
+
+void
+rrcascade_main(Datum main_arg)
+{
+	int32 worker_id = DatumGetInt32(main_arg);
+
+	pqsignal(SIGTERM, rrcascade_sigterm);
+	pqsignal(SIGHUP, rrcascade_sighup);
+	BackgroundWorkerUnblockSignals();
+
+	RRCASCADE_CONNECT(cascade_database);
+
+	while (! got_sigterm) {
+		int rc;
+
+		rc = RRCASCADE_WAIT(WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				cascade_naptime * 1000L);
+		ResetLatch(MyLatch);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup) {
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		if (got_sigterm)
+			break;
+
+		rrcascade_run(worker_id);
+	}
+
+	proc_exit(0);
+} /* rrcascade_main */
+
+void
+rrcascade_init(void)
+{
+	BackgroundWorker worker;
+	int i;
+
+	DefineCustomStringVariable("postrr.cascade_database",
+			"Database to cascade round-robin archives in.",
+			"The cascade workers are not started if this is not set.",
+			&cascade_database, /* boot_value = */ NULL, PGC_POSTMASTER,
+			/* flags = */ 0, NULL, NULL, NULL);
+	DefineCustomIntVariable("postrr.cascade_workers",
+			"Number of workers cascading round-robin archives.",
+			NULL, &cascade_workers, /* boot_value = */ 1,
+			/* min = */ 1, /* max = */ 64, PGC_POSTMASTER,
+			/* flags = */ 0, NULL, NULL, NULL);
+	DefineCustomIntVariable("postrr.cascade_naptime",
+			"Time to sleep between cascading round-robin archives.",
+			NULL, &cascade_naptime, /* boot_value = */ 60,
+			/* min = */ 1, /* max = */ INT_MAX / 1000, PGC_SIGHUP,
+			GUC_UNIT_S, NULL, NULL, NULL);
+	DefineCustomIntVariable("postrr.cascade_batch_size",
+			"Maximum number of slices consolidated per archive at once.",
+			NULL, &cascade_batch, /* boot_value = */ 100,
+			/* min = */ 1, /* max = */ INT_MAX, PGC_SIGHUP,
+			/* flags = */ 0, NULL, NULL, NULL);
+
+	if ((! process_shared_preload_libraries_in_progress)
+			|| (! cascade_database) || (! *cascade_database))
+		return;
+
+	for (i = 0; i < cascade_workers; ++i) {
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS
+			| BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time   = BgWorkerStart_RecoveryFinished;
+		worker.bgw_restart_time = cascade_naptime;
+		worker.bgw_main_arg     = Int32GetDatum(i);
+		worker.bgw_notify_pid   = 0;
+
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, "%s",
+				POSTRR_LIBRARY_NAME);
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "rrcascade_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN,
+				"postrr cascade worker %d", i);
+
+		RegisterBackgroundWorker(&worker);
+	}
+} /* rrcascade_init */
+
+#else /* PG_VERSION_NUM < 90400 */
+
+void
+rrcascade_init(void)
+{
+	/* background workers are not supported */
+} /* rrcascade_init */
+
+#endif /* PG_VERSION_NUM */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
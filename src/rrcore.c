@@ -0,0 +1,560 @@
+/*
+ * PostRR - src/rrcore.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Core computations of PostRR, independent of PostgreSQL.
+ */
+
+#include "rrcore.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* CDEF instructions */
+enum {
+	CDEF_PUSH_VAR = 0,
+	CDEF_PUSH_CONST,
+	CDEF_TIME,
+	CDEF_STEPWIDTH,
+
+	/* stack manipulation */
+	CDEF_DUP,
+	CDEF_POP,
+	CDEF_EXC,
+
+	/* unary operators */
+	CDEF_UN,
+	CDEF_ISINF,
+	CDEF_ABS,
+	CDEF_SQRT,
+	CDEF_LOG,
+	CDEF_EXP,
+	CDEF_FLOOR,
+	CDEF_CEIL,
+	CDEF_SIN,
+	CDEF_COS,
+
+	/* binary operators */
+	CDEF_ADD,
+	CDEF_SUB,
+	CDEF_MUL,
+	CDEF_DIV,
+	CDEF_MOD,
+	CDEF_POW,
+	CDEF_ATAN2,
+	CDEF_ADDNAN,
+	CDEF_MIN,
+	CDEF_MAX,
+	CDEF_MINNAN,
+	CDEF_MAXNAN,
+	CDEF_LT,
+	CDEF_LE,
+	CDEF_GT,
+	CDEF_GE,
+	CDEF_EQ,
+	CDEF_NE,
+
+	/* ternary operators */
+	CDEF_IF,
+	CDEF_LIMIT
+};
+
+/* number of elements evaluated at once; this keeps the stack in the cache
+ * while the loops over each chunk are simple enough to be vectorized */
+#define CDEF_CHUNK 128
+
+static const struct {
+	const char *name;
+	int32_t     op;
+	/* number of values popped from and pushed to the stack */
+	int         pop;
+	int         push;
+	double      value;
+} cdef_ops[] = {
+	{ "UNKN",      CDEF_PUSH_CONST, 0, 1, NAN },
+	{ "INF",       CDEF_PUSH_CONST, 0, 1, INFINITY },
+	{ "NEGINF",    CDEF_PUSH_CONST, 0, 1, -INFINITY },
+	{ "TIME",      CDEF_TIME,       0, 1, 0.0 },
+	{ "STEPWIDTH", CDEF_STEPWIDTH,  0, 1, 0.0 },
+	{ "DUP",       CDEF_DUP,        1, 2, 0.0 },
+	{ "POP",       CDEF_POP,        1, 0, 0.0 },
+	{ "EXC",       CDEF_EXC,        2, 2, 0.0 },
+	{ "UN",        CDEF_UN,         1, 1, 0.0 },
+	{ "ISINF",     CDEF_ISINF,      1, 1, 0.0 },
+	{ "ABS",       CDEF_ABS,        1, 1, 0.0 },
+	{ "SQRT",      CDEF_SQRT,       1, 1, 0.0 },
+	{ "LOG",       CDEF_LOG,        1, 1, 0.0 },
+	{ "EXP",       CDEF_EXP,        1, 1, 0.0 },
+	{ "FLOOR",     CDEF_FLOOR,      1, 1, 0.0 },
+	{ "CEIL",      CDEF_CEIL,       1, 1, 0.0 },
+	{ "SIN",       CDEF_SIN,        1, 1, 0.0 },
+	{ "COS",       CDEF_COS,        1, 1, 0.0 },
+	{ "+",         CDEF_ADD,        2, 1, 0.0 },
+	{ "-",         CDEF_SUB,        2, 1, 0.0 },
+	{ "*",         CDEF_MUL,        2, 1, 0.0 },
+	{ "/",         CDEF_DIV,        2, 1, 0.0 },
+	{ "%",         CDEF_MOD,        2, 1, 0.0 },
+	{ "POW",       CDEF_POW,        2, 1, 0.0 },
+	{ "ATAN2",     CDEF_ATAN2,      2, 1, 0.0 },
+	{ "ADDNAN",    CDEF_ADDNAN,     2, 1, 0.0 },
+	{ "MIN",       CDEF_MIN,        2, 1, 0.0 },
+	{ "MAX",       CDEF_MAX,        2, 1, 0.0 },
+	{ "MINNAN",    CDEF_MINNAN,     2, 1, 0.0 },
+	{ "MAXNAN",    CDEF_MAXNAN,     2, 1, 0.0 },
+	{ "LT",        CDEF_LT,         2, 1, 0.0 },
+	{ "LE",        CDEF_LE,         2, 1, 0.0 },
+	{ "GT",        CDEF_GT,         2, 1, 0.0 },
+	{ "GE",        CDEF_GE,         2, 1, 0.0 },
+	{ "EQ",        CDEF_EQ,         2, 1, 0.0 },
+	{ "NE",        CDEF_NE,         2, 1, 0.0 },
+	{ "IF",        CDEF_IF,         3, 1, 0.0 },
+	{ "LIMIT",     CDEF_LIMIT,      3, 1, 0.0 },
+};
+
+/*
+ * internal helper functions
+ */
+
+static int
+cdef_error(char *errbuf, size_t errbuf_len, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (errbuf && errbuf_len) {
+		va_start(ap, fmt);
+		vsnprintf(errbuf, errbuf_len, fmt, ap);
+		va_end(ap);
+		errbuf[errbuf_len - 1] = '\0';
+	}
+	return -1;
+} /* cdef_error */
+
+/*
+ * cdef_parse_token:
+ * Parse a single token of a CDEF expression into 'op'.
+ *
+ * Returns:
+ *  - the index of the operator in 'cdef_ops'
+ *  - -1 for variables and constants (pushing a single value)
+ *  - -2 if the token is unknown
+ */
+static int
+cdef_parse_token(const char *token, const char * const *vars, int vars_num,
+		rrcore_cdef_op_t *op)
+{
+	char  *end = NULL;
+	size_t i;
+
+	memset(op, 0, sizeof(*op));
+
+	for (i = 0; i < (size_t)vars_num; ++i) {
+		if (vars[i] && (! strcmp(token, vars[i]))) {
+			op->op  = CDEF_PUSH_VAR;
+			op->var = (int32_t)i;
+			return -1;
+		}
+	}
+
+	if ((token[0] == '$') && isdigit((unsigned char)token[1])) {
+		long idx;
+
+		errno = 0;
+		idx = strtol(token + 1, &end, 10);
+		if (errno || (*end != '\0') || (idx < 1) || (idx > vars_num))
+			return -2;
+
+		op->op  = CDEF_PUSH_VAR;
+		op->var = (int32_t)(idx - 1);
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(cdef_ops) / sizeof(cdef_ops[0]); ++i) {
+		if (! strcasecmp(token, cdef_ops[i].name)) {
+			op->op    = cdef_ops[i].op;
+			op->value = cdef_ops[i].value;
+			return (int)i;
+		}
+	}
+
+	errno = 0;
+	op->value = strtod(token, &end);
+	if (errno || (end == token) || (*end != '\0'))
+		return -2;
+
+	op->op = CDEF_PUSH_CONST;
+	return -1;
+} /* cdef_parse_token */
+
+/*
+ * public API
+ */
+
+void
+rrcore_locate(int64_t t, int64_t len, int32_t num,
+		int64_t *end, uint32_t *seq)
+{
+	if (t % len != 0)
+		t = t - (t % len) + len;
+
+	*end = t;
+	*seq = (uint32_t)(t % (len * num) / len % num);
+} /* rrcore_locate */
+
+int
+rrcore_cmp(int64_t end1, uint32_t seq1, int64_t end2, uint32_t seq2)
+{
+	if (end1 == end2)
+		return 0;
+	else if ((seq1 == seq2) && (end1 < end2))
+		return -1;
+	else if (end1 < end2)
+		return -2;
+	else if (seq1 == seq2)
+		return 1;
+	else
+		return 2;
+} /* rrcore_cmp */
+
+int
+rrcore_seq_cmp(uint32_t seq1, uint32_t seq2)
+{
+	if (seq1 < seq2)
+		return -1;
+	else if (seq1 == seq2)
+		return 0;
+	else
+		return 1;
+} /* rrcore_seq_cmp */
+
+int
+rrcore_consolidate(int32_t cf, double value, int32_t val_num,
+		double u_value, int32_t u_val_num, double *result)
+{
+	if (isnan(value) || isnan(u_value)) {
+		*result = isnan(value) ? u_value : value;
+		return 0;
+	}
+
+	switch (cf) {
+		case RRCORE_CF_AVG:
+			*result = ((value * val_num) + (u_value * u_val_num))
+				/ (val_num + u_val_num);
+			break;
+		case RRCORE_CF_MIN:
+			*result = (value < u_value) ? value : u_value;
+			break;
+		case RRCORE_CF_MAX:
+			*result = (value >= u_value) ? value : u_value;
+			break;
+		default:
+			*result = NAN;
+			return -1;
+	}
+	return 0;
+} /* rrcore_consolidate */
+
+int
+rrcore_cdef_compile(rrcore_cdef_t *cdef, const char *expr,
+		const char * const *vars, int vars_num,
+		char *errbuf, size_t errbuf_len)
+{
+	const char *pos = expr;
+	int depth = 0;
+
+	memset(cdef, 0, sizeof(*cdef));
+
+	while (42) {
+		char   token[256];
+		size_t len;
+		int    idx, pop = 0, push = 1;
+
+		const char *end = strchr(pos, ',');
+
+		if (! end)
+			end = pos + strlen(pos);
+
+		while ((pos < end) && isspace((unsigned char)*pos))
+			++pos;
+		len = (size_t)(end - pos);
+		while ((len > 0) && isspace((unsigned char)pos[len - 1]))
+			--len;
+
+		if (! len)
+			return cdef_error(errbuf, errbuf_len,
+					"empty token at position %d", (int)(pos - expr) + 1);
+		if (len >= sizeof(token))
+			return cdef_error(errbuf, errbuf_len,
+					"token at position %d too long", (int)(pos - expr) + 1);
+
+		memcpy(token, pos, len);
+		token[len] = '\0';
+
+		if (cdef->ops_num >= RRCORE_CDEF_OPS_MAX)
+			return cdef_error(errbuf, errbuf_len,
+					"expression too long (more than %d tokens)",
+					RRCORE_CDEF_OPS_MAX);
+
+		idx = cdef_parse_token(token, vars, vars_num,
+				&cdef->ops[cdef->ops_num]);
+		if (idx == -2)
+			return cdef_error(errbuf, errbuf_len,
+					"unknown variable or operator: %s", token);
+		if (idx >= 0) {
+			pop  = cdef_ops[idx].pop;
+			push = cdef_ops[idx].push;
+		}
+
+		if (depth < pop)
+			return cdef_error(errbuf, errbuf_len,
+					"stack underflow at %s (position %d)",
+					token, (int)(pos - expr) + 1);
+
+		depth += push - pop;
+		if (depth > RRCORE_CDEF_STACK_MAX)
+			return cdef_error(errbuf, errbuf_len,
+					"stack overflow at %s (more than %d values)",
+					token, RRCORE_CDEF_STACK_MAX);
+		if (depth > cdef->stack_max)
+			cdef->stack_max = depth;
+
+		++cdef->ops_num;
+
+		if (*end == '\0')
+			break;
+		pos = end + 1;
+	}
+
+	if (depth != 1)
+		return cdef_error(errbuf, errbuf_len,
+				"expression leaves %d values on the stack (expected 1)",
+				depth);
+	return 0;
+} /* rrcore_cdef_compile */
+
+/* helper macros for the loops of the evaluator, operating on the topmost
+ * stack elements */
+#define CDEF_UNARY(expr) \
+	do { \
+		double *a = stack[sp - 1]; \
+		for (j = 0; j < len; ++j) \
+			a[j] = (expr); \
+	} while (0)
+#define CDEF_BINARY(expr) \
+	do { \
+		double *a = stack[sp - 2]; \
+		double *b = stack[sp - 1]; \
+		for (j = 0; j < len; ++j) \
+			a[j] = (expr); \
+		--sp; \
+	} while (0)
+#define CDEF_TERNARY(expr) \
+	do { \
+		double *a = stack[sp - 3]; \
+		double *b = stack[sp - 2]; \
+		double *c = stack[sp - 1]; \
+		for (j = 0; j < len; ++j) \
+			a[j] = (expr); \
+		sp -= 2; \
+	} while (0)
+
+#define CDEF_ANYNAN2(x, y) (isnan(x) || isnan(y))
+#define CDEF_CMP(x, y, cmp) \
+	(CDEF_ANYNAN2(x, y) ? NAN : (((x) cmp (y)) ? 1.0 : 0.0))
+
+void
+rrcore_cdef_eval(const rrcore_cdef_t *cdef, const double * const *vars,
+		const double *times, double step, size_t n, double *result)
+{
+	double stack[RRCORE_CDEF_STACK_MAX][CDEF_CHUNK];
+	size_t off;
+
+	for (off = 0; off < n; off += CDEF_CHUNK) {
+		size_t len = (n - off < CDEF_CHUNK) ? n - off : CDEF_CHUNK;
+		size_t j;
+		int    sp = 0;
+		int    i;
+
+		for (i = 0; i < cdef->ops_num; ++i) {
+			const rrcore_cdef_op_t *op = cdef->ops + i;
+
+			switch (op->op) {
+				case CDEF_PUSH_VAR:
+					memcpy(stack[sp], vars[op->var] + off,
+							len * sizeof(double));
+					++sp;
+					break;
+				case CDEF_PUSH_CONST:
+					for (j = 0; j < len; ++j)
+						stack[sp][j] = op->value;
+					++sp;
+					break;
+				case CDEF_TIME:
+					for (j = 0; j < len; ++j)
+						stack[sp][j] = times ? times[off + j] : NAN;
+					++sp;
+					break;
+				case CDEF_STEPWIDTH:
+					for (j = 0; j < len; ++j)
+						stack[sp][j] = step;
+					++sp;
+					break;
+
+				case CDEF_DUP:
+					memcpy(stack[sp], stack[sp - 1], len * sizeof(double));
+					++sp;
+					break;
+				case CDEF_POP:
+					--sp;
+					break;
+				case CDEF_EXC:
+					{
+						double *a = stack[sp - 2];
+						double *b = stack[sp - 1];
+
+						for (j = 0; j < len; ++j) {
+							double tmp = a[j];
+							a[j] = b[j];
+							b[j] = tmp;
+						}
+					}
+					break;
+
+				case CDEF_UN:
+					CDEF_UNARY(isnan(a[j]) ? 1.0 : 0.0);
+					break;
+				case CDEF_ISINF:
+					CDEF_UNARY(isinf(a[j]) ? 1.0 : 0.0);
+					break;
+				case CDEF_ABS:
+					CDEF_UNARY(fabs(a[j]));
+					break;
+				case CDEF_SQRT:
+					CDEF_UNARY(sqrt(a[j]));
+					break;
+				case CDEF_LOG:
+					CDEF_UNARY(log(a[j]));
+					break;
+				case CDEF_EXP:
+					CDEF_UNARY(exp(a[j]));
+					break;
+				case CDEF_FLOOR:
+					CDEF_UNARY(floor(a[j]));
+					break;
+				case CDEF_CEIL:
+					CDEF_UNARY(ceil(a[j]));
+					break;
+				case CDEF_SIN:
+					CDEF_UNARY(sin(a[j]));
+					break;
+				case CDEF_COS:
+					CDEF_UNARY(cos(a[j]));
+					break;
+
+				case CDEF_ADD:
+					CDEF_BINARY(a[j] + b[j]);
+					break;
+				case CDEF_SUB:
+					CDEF_BINARY(a[j] - b[j]);
+					break;
+				case CDEF_MUL:
+					CDEF_BINARY(a[j] * b[j]);
+					break;
+				case CDEF_DIV:
+					CDEF_BINARY(a[j] / b[j]);
+					break;
+				case CDEF_MOD:
+					CDEF_BINARY(fmod(a[j], b[j]));
+					break;
+				case CDEF_POW:
+					CDEF_BINARY(pow(a[j], b[j]));
+					break;
+				case CDEF_ATAN2:
+					CDEF_BINARY(atan2(a[j], b[j]));
+					break;
+				case CDEF_ADDNAN:
+					CDEF_BINARY(isnan(a[j]) ? b[j]
+							: (isnan(b[j]) ? a[j] : a[j] + b[j]));
+					break;
+				case CDEF_MIN:
+					CDEF_BINARY(CDEF_ANYNAN2(a[j], b[j]) ? NAN
+							: ((a[j] < b[j]) ? a[j] : b[j]));
+					break;
+				case CDEF_MAX:
+					CDEF_BINARY(CDEF_ANYNAN2(a[j], b[j]) ? NAN
+							: ((a[j] >= b[j]) ? a[j] : b[j]));
+					break;
+				case CDEF_MINNAN:
+					CDEF_BINARY(isnan(a[j]) ? b[j]
+							: ((isnan(b[j]) || (a[j] < b[j])) ? a[j] : b[j]));
+					break;
+				case CDEF_MAXNAN:
+					CDEF_BINARY(isnan(a[j]) ? b[j]
+							: ((isnan(b[j]) || (a[j] >= b[j])) ? a[j] : b[j]));
+					break;
+				case CDEF_LT:
+					CDEF_BINARY(CDEF_CMP(a[j], b[j], <));
+					break;
+				case CDEF_LE:
+					CDEF_BINARY(CDEF_CMP(a[j], b[j], <=));
+					break;
+				case CDEF_GT:
+					CDEF_BINARY(CDEF_CMP(a[j], b[j], >));
+					break;
+				case CDEF_GE:
+					CDEF_BINARY(CDEF_CMP(a[j], b[j], >=));
+					break;
+				case CDEF_EQ:
+					CDEF_BINARY(CDEF_CMP(a[j], b[j], ==));
+					break;
+				case CDEF_NE:
+					CDEF_BINARY(CDEF_CMP(a[j], b[j], !=));
+					break;
+
+				/* an undefined condition yields an undefined value */
+				case CDEF_IF:
+					CDEF_TERNARY(isnan(a[j]) ? NAN
+							: ((a[j] != 0.0) ? b[j] : c[j]));
+					break;
+				case CDEF_LIMIT:
+					CDEF_TERNARY((isnan(b[j]) || isnan(c[j])
+								|| (a[j] < b[j]) || (a[j] > c[j]))
+							? NAN : a[j]);
+					break;
+			}
+		}
+
+		memcpy(result + off, stack[0], len * sizeof(double));
+	}
+} /* rrcore_cdef_eval */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,148 @@
+/*
+ * PostRR - src/rrcore.h
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The core computations of PostRR (slice arithmetic and consolidation) as
+ * plain C, independent of PostgreSQL. They are used by the extension as well
+ * as by the micro-benchmark (rrcore_bench), which allows to measure them in
+ * isolation.
+ *
+ * Timestamps are specified as microseconds since an arbitrary epoch.
+ */
+
+#ifndef POSTRR_RRCORE_H
+#define POSTRR_RRCORE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RRCORE_USECS_PER_SEC INT64_C(1000000)
+
+/* consolidation functions */
+enum {
+	RRCORE_CF_AVG = 0,
+	RRCORE_CF_MIN = 1,
+	RRCORE_CF_MAX = 2
+};
+
+/*
+ * rrcore_locate:
+ * Determine the end of the timeslice of the specified length (in
+ * microseconds) covering 't' and its position in a ring of 'num' slices.
+ */
+void
+rrcore_locate(int64_t t, int64_t len, int32_t num,
+		int64_t *end, uint32_t *seq);
+
+/*
+ * rrcore_cmp:
+ * Compare two timeslices of the same length and number of slices given by
+ * their end and position in the ring.
+ *
+ * Returns:
+ *  - 0 if both slices are the same
+ *  - -1 (1) if the first slice is older (newer) and both share the same
+ *    position in the ring
+ *  - -2 (2) if the first slice is older (newer) otherwise
+ */
+int
+rrcore_cmp(int64_t end1, uint32_t seq1, int64_t end2, uint32_t seq2);
+
+/*
+ * rrcore_seq_cmp:
+ * Compare two timeslices based on their position in the ring.
+ */
+int
+rrcore_seq_cmp(uint32_t seq1, uint32_t seq2);
+
+/*
+ * rrcore_consolidate:
+ * Consolidate 'value' (based on 'val_num' defined values) and 'u_value'
+ * (based on 'u_val_num' defined values) using the consolidation function
+ * 'cf'. Undefined (NaN) values are ignored.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if the consolidation function is unknown
+ */
+int
+rrcore_consolidate(int32_t cf, double value, int32_t val_num,
+		double u_value, int32_t u_val_num, double *result);
+
+/*
+ * CDEF expressions
+ */
+
+/* maximum number of instructions and stack depth of a compiled expression */
+#define RRCORE_CDEF_OPS_MAX   256
+#define RRCORE_CDEF_STACK_MAX 32
+
+typedef struct {
+	int32_t op;
+	int32_t var;
+	double  value;
+} rrcore_cdef_op_t;
+
+typedef struct {
+	rrcore_cdef_op_t ops[RRCORE_CDEF_OPS_MAX];
+	int ops_num;
+	int stack_max;
+} rrcore_cdef_t;
+
+/*
+ * rrcore_cdef_compile:
+ * Compile the RPN expression 'expr' (a comma-separated list of numbers,
+ * variables, and operators as known from RRDtool's CDEF) into 'cdef'.
+ * Variables are referenced by one of the names in 'vars' or by position
+ * ('$1', '$2', ...). On error, a description of the problem is written to
+ * 'errbuf'.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+rrcore_cdef_compile(rrcore_cdef_t *cdef, const char *expr,
+		const char * const *vars, int vars_num,
+		char *errbuf, size_t errbuf_len);
+
+/*
+ * rrcore_cdef_eval:
+ * Evaluate a compiled expression over 'n' aligned elements of the input
+ * arrays 'vars', writing the results to 'result'. 'times' (which may be
+ * NULL) specifies the time (in seconds since the epoch) of each element and
+ * 'step' the distance between elements (in seconds). Undefined (NaN)
+ * values propagate through all operators except UN, ISINF, ADDNAN, MINNAN,
+ * and MAXNAN.
+ */
+void
+rrcore_cdef_eval(const rrcore_cdef_t *cdef, const double * const *vars,
+		const double *times, double step, size_t n, double *result);
+
+#endif /* ! POSTRR_RRCORE_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,319 @@
+/*
+ * PostRR - src/rrcore_bench.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Micro-benchmark of the PostRR core computations. Each kernel is run over
+ * large arrays of (reproducible) pseudo-random input data, reporting the
+ * best time of all rounds.
+ *
+ * Usage: rrcore_bench [-n <elements>] [-r <rounds>]
+ */
+
+#if HAVE_CONFIG_H
+#	include "postrr_config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "rrcore.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* slice specification used for all timeslice kernels: 1 day of minutes */
+#define BENCH_LEN (60 * RRCORE_USECS_PER_SEC)
+#define BENCH_NUM 1440
+
+/* 2012-01-01 00:00:00 UTC (relative to the PostgreSQL epoch) */
+#define BENCH_START (INT64_C(378691200) * RRCORE_USECS_PER_SEC)
+
+typedef struct {
+	size_t n;
+
+	int64_t  *tstamps;
+	int64_t  *ends;
+	uint32_t *seqs;
+	double   *values;
+	double   *results;
+
+	/* sink for the results, making sure no kernel gets optimized away */
+	int64_t checksum;
+} bench_data_t;
+
+/*
+ * helper functions
+ */
+
+static uint64_t rand_state = UINT64_C(0x2545f4914f6cdd1d);
+
+/* xorshift64*: fast and good enough for generating input data */
+static uint64_t
+bench_rand(void)
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return rand_state * UINT64_C(2685821657736338717);
+} /* bench_rand */
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+} /* bench_now */
+
+static int
+bench_data_init(bench_data_t *data, size_t n)
+{
+	int64_t t = BENCH_START;
+	size_t i;
+
+	memset(data, 0, sizeof(*data));
+	data->n = n;
+
+	data->tstamps = malloc(n * sizeof(*data->tstamps));
+	data->ends    = malloc(n * sizeof(*data->ends));
+	data->seqs    = malloc(n * sizeof(*data->seqs));
+	data->values  = malloc(n * sizeof(*data->values));
+	data->results = malloc(n * sizeof(*data->results));
+
+	if ((! data->tstamps) || (! data->ends) || (! data->seqs)
+			|| (! data->values) || (! data->results))
+		return -1;
+
+	for (i = 0; i < n; ++i) {
+		/* (mostly) increasing timestamps, up to 5 minutes apart */
+		t += (int64_t)(bench_rand() % (300 * (uint64_t)RRCORE_USECS_PER_SEC));
+		data->tstamps[i] = t;
+
+		/* about one percent of the values are undefined */
+		if (bench_rand() % 100 == 0)
+			data->values[i] = NAN;
+		else
+			data->values[i] = (double)(bench_rand() % 1000000) / 100.0;
+	}
+
+	/* the comparison kernels operate on located timeslices */
+	for (i = 0; i < n; ++i)
+		rrcore_locate(data->tstamps[i], BENCH_LEN, BENCH_NUM,
+				&data->ends[i], &data->seqs[i]);
+	return 0;
+} /* bench_data_init */
+
+static void
+bench_data_destroy(bench_data_t *data)
+{
+	free(data->tstamps);
+	free(data->ends);
+	free(data->seqs);
+	free(data->values);
+	free(data->results);
+	memset(data, 0, sizeof(*data));
+} /* bench_data_destroy */
+
+/*
+ * kernels
+ */
+
+static void
+kernel_locate(bench_data_t *data, int32_t cf)
+{
+	size_t i;
+
+	(void)cf;
+	for (i = 0; i < data->n; ++i)
+		rrcore_locate(data->tstamps[i], BENCH_LEN, BENCH_NUM,
+				&data->ends[i], &data->seqs[i]);
+	data->checksum += data->ends[data->n - 1] + data->seqs[data->n - 1];
+} /* kernel_locate */
+
+static void
+kernel_cmp(bench_data_t *data, int32_t cf)
+{
+	int64_t sum = 0;
+	size_t i;
+
+	(void)cf;
+	for (i = 1; i < data->n; ++i)
+		sum += rrcore_cmp(data->ends[i - 1], data->seqs[i - 1],
+				data->ends[i], data->seqs[i]);
+	data->checksum += sum;
+} /* kernel_cmp */
+
+static void
+kernel_seq_cmp(bench_data_t *data, int32_t cf)
+{
+	int64_t sum = 0;
+	size_t i;
+
+	(void)cf;
+	for (i = 1; i < data->n; ++i)
+		sum += rrcore_seq_cmp(data->seqs[i - 1], data->seqs[i]);
+	data->checksum += sum;
+} /* kernel_seq_cmp */
+
+/* consolidate all values into a single one, as done by the Consolidate
+ * aggregate when rolling up an archive */
+static void
+kernel_consolidate(bench_data_t *data, int32_t cf)
+{
+	double value = NAN;
+	int32_t val_num = 0;
+	size_t i;
+
+	for (i = 0; i < data->n; ++i) {
+		if (rrcore_consolidate(cf, value, val_num,
+					data->values[i], 1, &value)) {
+			fprintf(stderr, "unknown consolidation function %d\n", cf);
+			exit(1);
+		}
+		if (! isnan(data->values[i]))
+			++val_num;
+	}
+	data->checksum += (int64_t)value;
+} /* kernel_consolidate */
+
+/* evaluate a CDEF expression combining two series (the values and the values
+ * shifted by one element) */
+static void
+kernel_cdef(bench_data_t *data, int32_t cf)
+{
+	const char *names[] = { "a", "b" };
+	const double *vars[2];
+	rrcore_cdef_t cdef;
+	char errbuf[256];
+
+	(void)cf;
+	if (rrcore_cdef_compile(&cdef, "a,UN,0,a,b,ADDNAN,2,/,IF,0,5000,LIMIT",
+				names, 2, errbuf, sizeof(errbuf))) {
+		fprintf(stderr, "failed to compile CDEF: %s\n", errbuf);
+		exit(1);
+	}
+
+	vars[0] = data->values + 1;
+	vars[1] = data->values;
+	rrcore_cdef_eval(&cdef, vars, /* times = */ NULL, /* step = */ 60.0,
+			data->n - 1, data->results);
+	data->checksum += (int64_t)data->results[data->n / 2];
+} /* kernel_cdef */
+
+static const struct {
+	const char *name;
+	void (*kernel)(bench_data_t *, int32_t);
+	int32_t cf;
+} kernels[] = {
+	{ "locate",           kernel_locate,      0 },
+	{ "cmp",              kernel_cmp,         0 },
+	{ "seq_cmp",          kernel_seq_cmp,     0 },
+	{ "consolidate(AVG)", kernel_consolidate, RRCORE_CF_AVG },
+	{ "consolidate(MIN)", kernel_consolidate, RRCORE_CF_MIN },
+	{ "consolidate(MAX)", kernel_consolidate, RRCORE_CF_MAX },
+	{ "cdef",             kernel_cdef,        0 },
+};
+
+static void
+exit_usage(const char *name, int status)
+{
+	printf("Usage: %s [-n <elements>] [-r <rounds>] [-h]\n"
+			"\nOptions:\n"
+			"  -n <elements>  number of array elements (default: 1000000)\n"
+			"  -r <rounds>    number of rounds per kernel (default: 10)\n"
+			"  -h             display this help and exit\n", name);
+	exit(status);
+} /* exit_usage */
+
+int
+main(int argc, char **argv)
+{
+	bench_data_t data;
+
+	long n = 1000000;
+	long rounds = 10;
+	size_t i;
+
+	while (42) {
+		int opt = getopt(argc, argv, "n:r:h");
+
+		if (opt == -1)
+			break;
+
+		switch (opt) {
+			case 'n':
+				n = strtol(optarg, NULL, 10);
+				break;
+			case 'r':
+				rounds = strtol(optarg, NULL, 10);
+				break;
+			case 'h':
+				exit_usage(argv[0], 0);
+				break;
+			default:
+				exit_usage(argv[0], 1);
+		}
+	}
+
+	if ((n < 2) || (rounds < 1))
+		exit_usage(argv[0], 1);
+
+	if (bench_data_init(&data, (size_t)n)) {
+		fprintf(stderr, "failed to allocate input data\n");
+		return 1;
+	}
+
+	printf("%-18s %10s %10s %10s\n", "kernel", "elements", "ns/elem",
+			"Melem/s");
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+		double best = -1.0;
+		long r;
+
+		for (r = 0; r < rounds; ++r) {
+			double start = bench_now();
+			double elapsed;
+
+			kernels[i].kernel(&data, kernels[i].cf);
+			elapsed = bench_now() - start;
+			if ((best < 0.0) || (elapsed < best))
+				best = elapsed;
+		}
+
+		printf("%-18s %10ld %10.3f %10.2f\n", kernels[i].name, n,
+				best * 1e9 / (double)n, (double)n / best / 1e6);
+	}
+
+	/* print the checksum to keep the compiler from discarding the results */
+	printf("\nchecksum: %lld\n", (long long)data.checksum);
+
+	bench_data_destroy(&data);
+	return 0;
+} /* main */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,1319 @@
+/*
+ * PostRR - src/rrdfdw.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A read-only foreign data wrapper providing access to RRDtool database
+ * files (.rrd) in place. The files are mapped into memory and each RRA is
+ * exposed as RRTimeslice / CData rows:
+ *
+ *   CREATE SERVER <name> FOREIGN DATA WRAPPER postrr_rrd;
+ *   CREATE FOREIGN TABLE <name> (file text, rra integer, cf text, ds text,
+ *           tstamp timestamptz, ts rrtimeslice, value cdata)
+ *       SERVER <name> OPTIONS (filename '/path/to/file.rrd');
+ *
+ * Columns are identified by name; all of them are optional. Restrictions on
+ * 'tstamp' are translated into the range of rows (ring offsets) to be read
+ * from each RRA, such that only the slots inside the time window are
+ * accessed. When reading all files of a directory, the files are
+ * distributed among the processes of a parallel scan.
+ *
+ * The files are expected to have been created on the same platform
+ * (RRDtool files are not portable between architectures). The FDW is
+ * available for PostgreSQL 9.6 or later only.
+ */
+
+#include "postrr.h"
+#include "rrcore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* Postgres utilities */
+#include <access/reloptions.h>
+#include <catalog/pg_foreign_table.h>
+#include <catalog/pg_type.h>
+#include <commands/defrem.h>
+#include <foreign/fdwapi.h>
+#include <foreign/foreign.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <nodes/makefuncs.h>
+#include <storage/fd.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/timestamp.h>
+
+#if PG_VERSION_NUM >= 90600
+#	include <access/parallel.h>
+#	include <executor/executor.h>
+#	include <optimizer/cost.h>
+#	include <optimizer/pathnode.h>
+#	include <optimizer/planmain.h>
+#	include <optimizer/restrictinfo.h>
+#	include <port/atomics.h>
+#	if PG_VERSION_NUM >= 120000
+#		include <optimizer/optimizer.h>
+#	else /* PG_VERSION_NUM < 120000 */
+#		include <optimizer/clauses.h>
+#		include <optimizer/var.h>
+#	endif /* PG_VERSION_NUM */
+#endif /* PG_VERSION_NUM >= 90600 */
+
+#if PG_VERSION_NUM < 110000
+#	define TupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
+#endif /* PG_VERSION_NUM < 110000 */
+
+#if PG_VERSION_NUM >= 90600
+
+/*
+ * RRDtool file format (see rrd_format.h of RRDtool); the files are written
+ * using the native layout of these structures
+ */
+
+#define RRD_COOKIE       "RRD"
+#define RRD_FLOAT_COOKIE ((double)8.642135E130)
+
+typedef union {
+	unsigned long u_cnt;
+	double        u_val;
+} rrd_unival_t;
+
+typedef struct {
+	char          cookie[4];
+	char          version[5];
+	double        float_cookie;
+	unsigned long ds_cnt;
+	unsigned long rra_cnt;
+	unsigned long pdp_step;
+	rrd_unival_t  par[10];
+} rrd_stat_head_t;
+
+typedef struct {
+	char          ds_nam[20];
+	char          dst[20];
+	rrd_unival_t  par[10];
+} rrd_ds_def_t;
+
+typedef struct {
+	char          cf_nam[20];
+	unsigned long row_cnt;
+	unsigned long pdp_cnt;
+	rrd_unival_t  par[10];
+} rrd_rra_def_t;
+
+typedef struct {
+	time_t        last_up;
+	long          last_up_usec; /* version 0003 or later */
+} rrd_live_head_t;
+
+typedef struct {
+	char          last_ds[30];
+	rrd_unival_t  scratch[10];
+} rrd_pdp_prep_t;
+
+typedef struct {
+	rrd_unival_t  scratch[10];
+} rrd_cdp_prep_t;
+
+typedef struct {
+	unsigned long cur_row;
+} rrd_rra_ptr_t;
+
+/*
+ * data types
+ */
+
+/* a memory mapping; it is released along with the memory context it has
+ * been registered with in case it has not been unmapped before, e.g. when
+ * aborting the transaction after an error */
+typedef struct {
+	char   *map;
+	size_t  map_len;
+	MemoryContextCallback cb;
+} rrd_map_t;
+
+/* a mapped RRD file */
+typedef struct {
+	const char *filename;
+	char       *map;
+	size_t      map_len;
+	rrd_map_t  *mapping;
+
+	const rrd_stat_head_t *stat_head;
+	const rrd_ds_def_t    *ds_defs;
+	const rrd_rra_def_t   *rra_defs;
+	const rrd_rra_ptr_t   *rra_ptrs;
+	time_t                 last_up;
+
+	/* start of the data of each RRA */
+	const double         **rra_data;
+} rrd_file_t;
+
+/* bounds of the time window */
+enum {
+	RRD_BOUND_START = 1 << 0,
+	RRD_BOUND_END   = 1 << 1
+};
+
+/*
+ * internal helper functions
+ */
+
+static int
+rrd_cf_from_name(const char *cf_nam)
+{
+	if (! strncmp(cf_nam, "AVERAGE", 20))
+		return RRCORE_CF_AVG;
+	else if (! strncmp(cf_nam, "MIN", 20))
+		return RRCORE_CF_MIN;
+	else if (! strncmp(cf_nam, "MAX", 20))
+		return RRCORE_CF_MAX;
+	return -1;
+} /* rrd_cf_from_name */
+
+static void
+rrd_map_release(void *arg)
+{
+	rrd_map_t *mapping = (rrd_map_t *)arg;
+
+	if (mapping->map)
+		munmap(mapping->map, mapping->map_len);
+	mapping->map = NULL;
+} /* rrd_map_release */
+
+static void
+rrd_file_close(rrd_file_t *file)
+{
+	if (file->mapping)
+		rrd_map_release(file->mapping);
+	if (file->rra_data)
+		pfree(file->rra_data);
+	memset(file, 0, sizeof(*file));
+} /* rrd_file_close */
+
+/*
+ * rrd_file_skip:
+ * Advance 'offset' by 'num1 * num2' elements of 'size' bytes each. All
+ * counts are read from the file, so the product is checked against the
+ * remaining bytes (before being computed) rather than after the fact.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value (leaving 'offset' untouched) if the elements exceed
+ *    'limit'
+ */
+static int
+rrd_file_skip(size_t *offset, unsigned long num1, unsigned long num2,
+		size_t size, size_t limit)
+{
+	size_t avail;
+
+	if (*offset > limit)
+		return -1;
+
+	avail = (limit - *offset) / size;
+	if (num2 && (num1 > avail / num2))
+		return -1;
+
+	*offset += (size_t)num1 * (size_t)num2 * size;
+	return 0;
+} /* rrd_file_skip */
+
+/*
+ * rrd_file_open:
+ * Map the specified file into memory and validate its layout. The mapping
+ * is tied to the current memory context.
+ */
+static void
+rrd_file_open(rrd_file_t *file, const char *filename)
+{
+	struct stat st;
+	size_t      offset;
+	size_t      live_head;
+	size_t      live_head_len;
+	unsigned long i;
+	int         fd;
+	int         status;
+
+	memset(file, 0, sizeof(*file));
+	file->filename = filename;
+
+	fd = OpenTransientFile((char *)filename, O_RDONLY | PG_BINARY
+#if PG_VERSION_NUM < 110000
+			, 0
+#endif /* PG_VERSION_NUM < 110000 */
+			);
+	if (fd < 0)
+		ereport(ERROR, (
+					errcode_for_file_access(),
+					errmsg("could not open file \"%s\": %m", filename)
+				));
+
+	if (fstat(fd, &st)) {
+		CloseTransientFile(fd);
+		ereport(ERROR, (
+					errcode_for_file_access(),
+					errmsg("could not stat file \"%s\": %m", filename)
+				));
+	}
+
+	file->map_len = (size_t)st.st_size;
+	if (file->map_len < sizeof(rrd_stat_head_t)) {
+		CloseTransientFile(fd);
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("invalid RRD file \"%s\": file too short",
+						filename)
+				));
+	}
+
+	/* allocate before mapping, such that the mapping cannot leak */
+	file->mapping = (rrd_map_t *)palloc0(sizeof(*file->mapping));
+
+	file->map = mmap(NULL, file->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	CloseTransientFile(fd);
+	if (file->map == MAP_FAILED) {
+		file->map = NULL;
+		ereport(ERROR, (
+					errcode_for_file_access(),
+					errmsg("could not map file \"%s\": %m", filename)
+				));
+	}
+
+	file->mapping->map     = file->map;
+	file->mapping->map_len = file->map_len;
+	file->mapping->cb.func = rrd_map_release;
+	file->mapping->cb.arg  = file->mapping;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext,
+			&file->mapping->cb);
+
+	file->stat_head = (const rrd_stat_head_t *)file->map;
+	if (strncmp(file->stat_head->cookie, RRD_COOKIE, 4)
+			|| (file->stat_head->float_cookie != RRD_FLOAT_COOKIE)) {
+		rrd_file_close(file);
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("invalid RRD file \"%s\"", filename),
+					errdetail("The file is not an RRD file or it has been "
+						"created on a different architecture.")
+				));
+	}
+
+	/* versions 0001 and 0002 do not store microseconds */
+	if (strncmp(file->stat_head->version, "0003", 4) < 0)
+		live_head_len = sizeof(time_t);
+	else
+		live_head_len = sizeof(rrd_live_head_t);
+
+	offset = sizeof(rrd_stat_head_t);
+	file->ds_defs = (const rrd_ds_def_t *)(file->map + offset);
+	status = rrd_file_skip(&offset, file->stat_head->ds_cnt, 1,
+			sizeof(rrd_ds_def_t), file->map_len);
+	file->rra_defs = (const rrd_rra_def_t *)(file->map + offset);
+	if (! status)
+		status = rrd_file_skip(&offset, file->stat_head->rra_cnt, 1,
+				sizeof(rrd_rra_def_t), file->map_len);
+	live_head = offset;
+	if (! status)
+		status = rrd_file_skip(&offset, 1, 1, live_head_len, file->map_len);
+	if (status) {
+		rrd_file_close(file);
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("invalid RRD file \"%s\": file too short",
+						filename)
+				));
+	}
+	file->last_up = ((const rrd_live_head_t *)(file->map
+				+ live_head))->last_up;
+
+	status = rrd_file_skip(&offset, file->stat_head->ds_cnt, 1,
+			sizeof(rrd_pdp_prep_t), file->map_len);
+	if (! status)
+		status = rrd_file_skip(&offset, file->stat_head->rra_cnt,
+				file->stat_head->ds_cnt, sizeof(rrd_cdp_prep_t),
+				file->map_len);
+	file->rra_ptrs = (const rrd_rra_ptr_t *)(file->map + offset);
+	if (! status)
+		status = rrd_file_skip(&offset, file->stat_head->rra_cnt, 1,
+				sizeof(rrd_rra_ptr_t), file->map_len);
+
+	/* the RRA definitions fit into the file, so rra_cnt is sane */
+	file->rra_data = (const double **)palloc0(
+			Max(file->stat_head->rra_cnt, 1) * sizeof(*file->rra_data));
+	for (i = 0; (! status) && (i < file->stat_head->rra_cnt); ++i) {
+		file->rra_data[i] = (const double *)(file->map + offset);
+		if (file->rra_ptrs[i].cur_row >= file->rra_defs[i].row_cnt)
+			status = -1;
+		else
+			status = rrd_file_skip(&offset, file->rra_defs[i].row_cnt,
+					file->stat_head->ds_cnt, sizeof(double), file->map_len);
+	}
+
+	if ((file->stat_head->pdp_step == 0) || status) {
+		rrd_file_close(file);
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("invalid RRD file \"%s\": "
+						"inconsistent or truncated data", filename)
+				));
+	}
+} /* rrd_file_open */
+
+/*
+ * rrd_rra_window:
+ * Determine the range of rows (specified by their age, the most recent row
+ * having age zero) of an RRA inside the time window [start, end].
+ *
+ * Returns:
+ *  - 0 if any rows are inside the window
+ *  - a negative value else
+ */
+static int
+rrd_rra_window(rrd_file_t *file, unsigned long rra,
+		int bounds, time_t start, time_t end,
+		long *min_age, long *max_age)
+{
+	const rrd_rra_def_t *def = &file->rra_defs[rra];
+	int64  row_len = (int64)file->stat_head->pdp_step * (int64)def->pdp_cnt;
+	int64  last;
+
+	if ((row_len <= 0) || (def->row_cnt == 0))
+		return -1;
+
+	last = (int64)file->last_up - ((int64)file->last_up % row_len);
+
+	*min_age = 0;
+	*max_age = (long)def->row_cnt - 1;
+
+	if (bounds & RRD_BOUND_START) {
+		if ((int64)start > last)
+			return -1;
+		*max_age = (long)Min((int64)*max_age, (last - (int64)start) / row_len);
+	}
+	if ((bounds & RRD_BOUND_END) && ((int64)end < last))
+		*min_age = (long)((last - (int64)end + row_len - 1) / row_len);
+
+	return (*min_age <= *max_age) ? 0 : -1;
+} /* rrd_rra_window */
+
+/* shared state of a parallel scan */
+typedef struct {
+	pg_atomic_uint32 next_file;
+} rrd_fdw_shared_t;
+
+/* planner information (the file list is stored in fdw_private as well) */
+typedef struct {
+	List  *files;
+	int    rra;
+	char  *ds;
+
+	/* slice lengths (seconds) and numbers of slices of the selected RRAs
+	 * as read from the file headers while planning */
+	List  *spec_lens;
+	List  *spec_cnts;
+
+	/* restrictions on the 'tstamp' column and their RRD_BOUND_* kinds */
+	List  *bound_exprs;
+	List  *bound_kinds;
+} rrd_fdw_plan_t;
+
+/* executor state */
+typedef struct {
+	MemoryContext cxt;
+
+	char **files;
+	int    files_num;
+	int    rra;
+	char  *ds;
+	List  *spec_lens;
+	List  *spec_cnts;
+
+	List  *bound_states;
+	List  *bound_kinds;
+	int    bounds;
+	time_t start;
+	time_t end;
+
+	/* attribute numbers (zero-based) of the known columns or -1 */
+	int    att_file;
+	int    att_rra;
+	int    att_cf;
+	int    att_ds;
+	int    att_tstamp;
+	int    att_ts;
+	int    att_value;
+
+	/* next file to be scanned in a non-parallel scan */
+	int    next_file;
+	rrd_fdw_shared_t *shared;
+
+	/* current position */
+	bool   file_open;
+	rrd_file_t file;
+	long   rra_idx;
+	int32  rra_typmod;
+	int    rra_cf;
+	int64  rra_last;
+	int64  rra_row_len;
+	long   min_age;
+	long   cur_age;
+	long   ds_first;
+	long   ds_last;
+	long   cur_ds;
+} rrd_fdw_state_t;
+
+static int
+rrd_fdw_filename_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+} /* rrd_fdw_filename_cmp */
+
+/*
+ * rrd_fdw_get_plan:
+ * Determine the options of the specified foreign table and the list of
+ * files to be scanned.
+ */
+static void
+rrd_fdw_get_plan(Oid foreigntableid, rrd_fdw_plan_t *plan)
+{
+	ForeignTable *table;
+	ListCell     *lc;
+	char         *filename = NULL;
+	char         *directory = NULL;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->rra = -1;
+
+	table = GetForeignTable(foreigntableid);
+	foreach(lc, table->options) {
+		DefElem *def = (DefElem *)lfirst(lc);
+
+		if (! strcmp(def->defname, "filename"))
+			filename = defGetString(def);
+		else if (! strcmp(def->defname, "directory"))
+			directory = defGetString(def);
+		else if (! strcmp(def->defname, "rra"))
+			plan->rra = atoi(defGetString(def));
+		else if (! strcmp(def->defname, "ds"))
+			plan->ds = defGetString(def);
+	}
+
+	if (filename) {
+		plan->files = list_make1(makeString(filename));
+	}
+	else if (directory) {
+		DIR           *dir;
+		struct dirent *de;
+		StringInfoData path;
+		char         **names;
+		int            names_num = 0;
+		int            names_size = 16;
+		int            i;
+
+		names = (char **)palloc(names_size * sizeof(*names));
+
+		dir = AllocateDir(directory);
+		while ((de = ReadDir(dir, directory)) != NULL) {
+			size_t len = strlen(de->d_name);
+
+			if ((len < 5) || strcmp(de->d_name + len - 4, ".rrd"))
+				continue;
+
+			if (names_num >= names_size) {
+				names_size *= 2;
+				names = (char **)repalloc(names,
+						names_size * sizeof(*names));
+			}
+			initStringInfo(&path);
+			appendStringInfo(&path, "%s/%s", directory, de->d_name);
+			names[names_num++] = path.data;
+		}
+		FreeDir(dir);
+
+		/* scan the files in a well-defined order */
+		qsort(names, names_num, sizeof(*names), rrd_fdw_filename_cmp);
+		for (i = 0; i < names_num; ++i)
+			plan->files = lappend(plan->files, makeString(names[i]));
+	}
+	else
+		ereport(ERROR, (
+					errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+					errmsg("either \"filename\" or \"directory\" is "
+						"required for postrr_rrd foreign tables")
+				));
+} /* rrd_fdw_get_plan */
+
+/*
+ * rrd_fdw_extract_bounds:
+ * Extract restrictions on the 'tstamp' column which may be used to limit
+ * the rows read from each RRA. The restrictions are still checked by the
+ * executor.
+ */
+static void
+rrd_fdw_extract_bounds(RelOptInfo *baserel, Oid foreigntableid,
+		rrd_fdw_plan_t *plan)
+{
+	AttrNumber attnum;
+	ListCell  *lc;
+
+	attnum = get_attnum(foreigntableid, "tstamp");
+	if (attnum == InvalidAttrNumber)
+		return;
+
+	foreach(lc, baserel->baserestrictinfo) {
+		RestrictInfo *ri = (RestrictInfo *)lfirst(lc);
+		OpExpr *op;
+		Node   *left, *right, *other;
+		Oid     ltype = InvalidOid, rtype = InvalidOid;
+		char   *opname;
+		bool    var_left;
+		int     kind;
+
+		if (! IsA(ri->clause, OpExpr))
+			continue;
+		op = (OpExpr *)ri->clause;
+		if (list_length(op->args) != 2)
+			continue;
+
+		op_input_types(op->opno, &ltype, &rtype);
+		if ((ltype != TIMESTAMPTZOID) || (rtype != TIMESTAMPTZOID))
+			continue;
+
+		left  = (Node *)linitial(op->args);
+		right = (Node *)lsecond(op->args);
+		if (IsA(left, Var) && (((Var *)left)->varno == baserel->relid)
+				&& (((Var *)left)->varattno == attnum)) {
+			var_left = true;
+			other = right;
+		}
+		else if (IsA(right, Var) && (((Var *)right)->varno == baserel->relid)
+				&& (((Var *)right)->varattno == attnum)) {
+			var_left = false;
+			other = left;
+		}
+		else
+			continue;
+
+		if (contain_var_clause(other) || contain_volatile_functions(other))
+			continue;
+
+		opname = get_opname(op->opno);
+		if (! opname)
+			continue;
+
+		if (! strcmp(opname, "="))
+			kind = RRD_BOUND_START | RRD_BOUND_END;
+		else if ((! strcmp(opname, "<")) || (! strcmp(opname, "<=")))
+			kind = var_left ? RRD_BOUND_END : RRD_BOUND_START;
+		else if ((! strcmp(opname, ">")) || (! strcmp(opname, ">=")))
+			kind = var_left ? RRD_BOUND_START : RRD_BOUND_END;
+		else
+			continue;
+
+		plan->bound_exprs = lappend(plan->bound_exprs, other);
+		plan->bound_kinds = lappend_int(plan->bound_kinds, kind);
+	}
+} /* rrd_fdw_extract_bounds */
+
+/*
+ * rrd_fdw_eval_bounds:
+ * Evaluate the restrictions on the 'tstamp' column.
+ */
+static void
+rrd_fdw_eval_bounds(ForeignScanState *node, rrd_fdw_state_t *state)
+{
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	ListCell    *ls, *lk;
+
+	state->bounds = 0;
+
+	forboth(ls, state->bound_states, lk, state->bound_kinds) {
+		ExprState *expr = (ExprState *)lfirst(ls);
+		int        kind = lfirst_int(lk);
+		bool       isnull = false;
+		Datum      d;
+		time_t     t;
+
+#if PG_VERSION_NUM >= 100000
+		d = ExecEvalExpr(expr, econtext, &isnull);
+#else /* PG_VERSION_NUM < 100000 */
+		d = ExecEvalExpr(expr, econtext, &isnull, NULL);
+#endif /* PG_VERSION_NUM */
+
+		if (isnull) {
+			/* the comparison will never be true */
+			state->bounds = RRD_BOUND_START | RRD_BOUND_END;
+			state->start  = 1;
+			state->end    = 0;
+			return;
+		}
+
+		t = (time_t)timestamptz_to_time_t(DatumGetTimestampTz(d));
+
+		if ((kind & RRD_BOUND_START)
+				&& ((! (state->bounds & RRD_BOUND_START))
+					|| (t > state->start)))
+			state->start = t;
+		if ((kind & RRD_BOUND_END)
+				&& ((! (state->bounds & RRD_BOUND_END))
+					|| (t < state->end)))
+			state->end = t;
+		state->bounds |= kind;
+	}
+} /* rrd_fdw_eval_bounds */
+
+/*
+ * rrd_fdw_setup_rra:
+ * Position the scan at the first row (inside the time window) of the
+ * current RRA. The RRA is skipped (cur_age < min_age) if it is not selected
+ * or does not contain any rows inside the time window.
+ */
+static void
+rrd_fdw_setup_rra(rrd_fdw_state_t *state)
+{
+	rrd_file_t *file = &state->file;
+	const rrd_rra_def_t *def = &file->rra_defs[state->rra_idx];
+	long max_age = -1;
+
+	state->min_age = 0;
+	state->cur_age = -1;
+	state->cur_ds  = state->ds_first;
+
+	if ((state->rra >= 0) && (state->rra_idx != state->rra))
+		return;
+
+	state->rra_cf = rrd_cf_from_name(def->cf_nam);
+	if (state->rra_cf < 0)
+		return;
+
+	if (rrd_rra_window(file, (unsigned long)state->rra_idx, state->bounds,
+				state->start, state->end, &state->min_age, &max_age))
+		return;
+
+	state->rra_row_len = (int64)file->stat_head->pdp_step
+		* (int64)def->pdp_cnt;
+	state->rra_last = (int64)file->last_up
+		- ((int64)file->last_up % state->rra_row_len);
+	state->cur_age  = max_age;
+
+	if ((state->att_ts >= 0) && (state->rra_row_len <= INT_MAX)
+			&& (def->row_cnt <= INT_MAX))
+		state->rra_typmod = rrtimeslice_set_spec(
+				state->rra_row_len * USECS_PER_SEC, (int32)def->row_cnt);
+	else
+		state->rra_typmod = -1;
+} /* rrd_fdw_setup_rra */
+
+/*
+ * rrd_fdw_add_spec:
+ * Remember the RRTimeslice spec of an RRA (unless known already).
+ */
+static void
+rrd_fdw_add_spec(rrd_fdw_plan_t *plan, int64 row_len, unsigned long row_cnt)
+{
+	ListCell *ll, *lc;
+
+	if ((row_len <= 0) || (row_len > INT_MAX)
+			|| (row_cnt == 0) || (row_cnt > INT_MAX))
+		return;
+
+	forboth(ll, plan->spec_lens, lc, plan->spec_cnts) {
+		if ((lfirst_int(ll) == (int)row_len)
+				&& (lfirst_int(lc) == (int)row_cnt))
+			return;
+	}
+
+	plan->spec_lens = lappend_int(plan->spec_lens, (int)row_len);
+	plan->spec_cnts = lappend_int(plan->spec_cnts, (int)row_cnt);
+} /* rrd_fdw_add_spec */
+
+/*
+ * rrd_fdw_register_specs:
+ * Register the RRTimeslice specs of all selected RRAs up front; parallel
+ * workers are not allowed to do so. This happens at the start of the
+ * execution (rather than while planning), such that EXPLAIN does not write
+ * to postrr.rrtimeslices. The specs have been determined while planning, so
+ * the files do not have to be mapped once more.
+ */
+static void
+rrd_fdw_register_specs(rrd_fdw_state_t *state)
+{
+	ListCell *ll, *lc;
+
+	if (state->att_ts < 0)
+		return;
+
+	forboth(ll, state->spec_lens, lc, state->spec_cnts)
+		rrtimeslice_set_spec((int64)lfirst_int(ll) * USECS_PER_SEC,
+				(int32)lfirst_int(lc));
+} /* rrd_fdw_register_specs */
+
+/*
+ * rrd_fdw_open_next_file:
+ * Open the next file to be scanned by this process.
+ *
+ * Returns:
+ *  - true if a file has been opened
+ *  - false if there are no more files to be scanned
+ */
+static bool
+rrd_fdw_open_next_file(rrd_fdw_state_t *state)
+{
+	MemoryContext old_cxt;
+	int idx;
+
+	if (state->shared)
+		idx = (int)pg_atomic_fetch_add_u32(&state->shared->next_file, 1);
+	else
+		idx = state->next_file++;
+
+	if (idx >= state->files_num)
+		return false;
+
+	old_cxt = MemoryContextSwitchTo(state->cxt);
+	rrd_file_open(&state->file, state->files[idx]);
+	MemoryContextSwitchTo(old_cxt);
+	state->file_open = true;
+
+	state->ds_first = 0;
+	state->ds_last  = (long)state->file.stat_head->ds_cnt - 1;
+	if (state->ds) {
+		long i;
+
+		/* an empty range if the file does not contain the data source */
+		state->ds_first = 0;
+		state->ds_last  = -1;
+		for (i = 0; i < (long)state->file.stat_head->ds_cnt; ++i) {
+			if (! strncmp(state->file.ds_defs[i].ds_nam, state->ds, 20)) {
+				state->ds_first = state->ds_last = i;
+				break;
+			}
+		}
+	}
+
+	state->rra_idx = -1;
+	state->min_age = 0;
+	state->cur_age = -1;
+	return true;
+} /* rrd_fdw_open_next_file */
+
+static void
+rrd_fdw_close_file(rrd_fdw_state_t *state)
+{
+	if (! state->file_open)
+		return;
+	rrd_file_close(&state->file);
+	state->file_open = false;
+} /* rrd_fdw_close_file */
+
+/*
+ * rrd_fdw_next_row:
+ * Store the next row of the current file in the specified slot.
+ *
+ * Returns:
+ *  - true if a row has been stored
+ *  - false if the end of the file has been reached
+ */
+static bool
+rrd_fdw_next_row(rrd_fdw_state_t *state, TupleTableSlot *slot)
+{
+	rrd_file_t *file = &state->file;
+	const rrd_rra_def_t *def;
+	unsigned long row;
+	double  value;
+	int64   t;
+
+	Datum  *values = slot->tts_values;
+	bool   *nulls  = slot->tts_isnull;
+	int     natts  = slot->tts_tupleDescriptor->natts;
+	char    name[21];
+
+	while (42) {
+		if (state->cur_age < state->min_age) {
+			if (++state->rra_idx >= (long)file->stat_head->rra_cnt)
+				return false;
+			rrd_fdw_setup_rra(state);
+			continue;
+		}
+		if (state->cur_ds > state->ds_last) {
+			--state->cur_age;
+			state->cur_ds = state->ds_first;
+			continue;
+		}
+		break;
+	}
+
+	def = &file->rra_defs[state->rra_idx];
+	row = (file->rra_ptrs[state->rra_idx].cur_row + def->row_cnt
+			- (unsigned long)state->cur_age) % def->row_cnt;
+	value = file->rra_data[state->rra_idx][row * file->stat_head->ds_cnt
+		+ (unsigned long)state->cur_ds];
+	t = state->rra_last - (int64)state->cur_age * state->rra_row_len;
+
+	memset(nulls, true, natts * sizeof(*nulls));
+
+	if (state->att_file >= 0) {
+		values[state->att_file] = CStringGetTextDatum(file->filename);
+		nulls[state->att_file] = false;
+	}
+	if (state->att_rra >= 0) {
+		values[state->att_rra] = Int32GetDatum((int32)state->rra_idx);
+		nulls[state->att_rra] = false;
+	}
+	if (state->att_cf >= 0) {
+		strncpy(name, def->cf_nam, 20);
+		name[20] = '\0';
+		values[state->att_cf] = CStringGetTextDatum(name);
+		nulls[state->att_cf] = false;
+	}
+	if (state->att_ds >= 0) {
+		strncpy(name, file->ds_defs[state->cur_ds].ds_nam, 20);
+		name[20] = '\0';
+		values[state->att_ds] = CStringGetTextDatum(name);
+		nulls[state->att_ds] = false;
+	}
+	if (state->att_tstamp >= 0) {
+		values[state->att_tstamp] = TimestampTzGetDatum(
+				time_t_to_timestamptz((pg_time_t)t));
+		nulls[state->att_tstamp] = false;
+	}
+	if (state->att_ts >= 0) {
+		values[state->att_ts] = PointerGetDatum(rrtimeslice_create(
+					time_t_to_timestamptz((pg_time_t)t),
+					state->rra_typmod));
+		nulls[state->att_ts] = false;
+	}
+	if (state->att_value >= 0) {
+		values[state->att_value] = PointerGetDatum(cdata_create(value,
+					/* undef_num = */ isnan(value) ? 1 : 0,
+					/* val_num = */ 1, state->rra_cf));
+		nulls[state->att_value] = false;
+	}
+
+	++state->cur_ds;
+	return true;
+} /* rrd_fdw_next_row */
+
+/*
+ * FDW callbacks
+ */
+
+static void
+rrd_fdw_get_rel_size(PlannerInfo *root, RelOptInfo *baserel,
+		Oid foreigntableid)
+{
+	rrd_fdw_plan_t *plan;
+	ListCell *lc;
+	double    rows = 0.0;
+
+	plan = (rrd_fdw_plan_t *)palloc0(sizeof(*plan));
+	rrd_fdw_get_plan(foreigntableid, plan);
+	rrd_fdw_extract_bounds(baserel, foreigntableid, plan);
+
+	/* read the headers to determine the total number of rows; the
+	 * restrictions are accounted for by their selectivity */
+	foreach(lc, plan->files) {
+		rrd_file_t    file;
+		unsigned long i;
+
+		rrd_file_open(&file, strVal(lfirst(lc)));
+		for (i = 0; i < file.stat_head->rra_cnt; ++i) {
+			if ((plan->rra >= 0) && ((unsigned long)plan->rra != i))
+				continue;
+			if (rrd_cf_from_name(file.rra_defs[i].cf_nam) < 0)
+				continue;
+
+			rows += (double)file.rra_defs[i].row_cnt
+				* (plan->ds ? 1.0 : (double)file.stat_head->ds_cnt);
+			rrd_fdw_add_spec(plan, (int64)file.stat_head->pdp_step
+					* (int64)file.rra_defs[i].pdp_cnt,
+					file.rra_defs[i].row_cnt);
+		}
+		rrd_file_close(&file);
+	}
+
+	baserel->rows = clamp_row_est(rows * clauselist_selectivity(root,
+				baserel->baserestrictinfo, 0, JOIN_INNER, NULL));
+	baserel->fdw_private = plan;
+} /* rrd_fdw_get_rel_size */
+
+static void
+rrd_fdw_get_paths(PlannerInfo *root, RelOptInfo *baserel,
+		Oid foreigntableid)
+{
+	rrd_fdw_plan_t *plan = (rrd_fdw_plan_t *)baserel->fdw_private;
+	Cost   startup_cost = baserel->baserestrictcost.startup;
+	Cost   run_cost;
+	int    files_num = list_length(plan->files);
+	Path  *path;
+
+	/* only the rows inside the time window are read from each file */
+	run_cost = (cpu_tuple_cost + baserel->baserestrictcost.per_tuple)
+		* baserel->rows + seq_page_cost * files_num;
+
+	path = (Path *)create_foreignscan_path(root, baserel,
+			/* target = */ NULL, baserel->rows,
+#if PG_VERSION_NUM >= 180000
+			/* disabled_nodes = */ 0,
+#endif /* PG_VERSION_NUM >= 180000 */
+			startup_cost, startup_cost + run_cost,
+			/* pathkeys = */ NIL, /* required_outer = */ NULL,
+			/* fdw_outerpath = */ NULL,
+#if PG_VERSION_NUM >= 170000
+			/* fdw_restrictinfo = */ NIL,
+#endif /* PG_VERSION_NUM >= 170000 */
+			/* fdw_private = */ NIL);
+	add_path(baserel, path);
+
+	/* files are distributed among the processes of a parallel scan */
+	if (baserel->consider_parallel && (files_num > 1)
+			&& (max_parallel_workers_per_gather > 0)) {
+		int    workers = Min(files_num - 1, max_parallel_workers_per_gather);
+		double divisor = (double)(workers + 1);
+
+		path = (Path *)create_foreignscan_path(root, baserel,
+				/* target = */ NULL, clamp_row_est(baserel->rows / divisor),
+#if PG_VERSION_NUM >= 180000
+				/* disabled_nodes = */ 0,
+#endif /* PG_VERSION_NUM >= 180000 */
+				startup_cost, startup_cost + run_cost / divisor,
+				/* pathkeys = */ NIL, /* required_outer = */ NULL,
+				/* fdw_outerpath = */ NULL,
+#if PG_VERSION_NUM >= 170000
+				/* fdw_restrictinfo = */ NIL,
+#endif /* PG_VERSION_NUM >= 170000 */
+				/* fdw_private = */ NIL);
+		path->parallel_aware   = true;
+		path->parallel_safe    = true;
+		path->parallel_workers = workers;
+		add_partial_path(baserel, path);
+	}
+} /* rrd_fdw_get_paths */
+
+static ForeignScan *
+rrd_fdw_get_plan_node(PlannerInfo *root, RelOptInfo *baserel,
+		Oid foreigntableid, ForeignPath *best_path, List *tlist,
+		List *scan_clauses, Plan *outer_plan)
+{
+	rrd_fdw_plan_t *plan = (rrd_fdw_plan_t *)baserel->fdw_private;
+	List *fdw_private;
+
+	/* all restrictions are checked by the executor */
+	scan_clauses = extract_actual_clauses(scan_clauses, false);
+
+	fdw_private = list_make4(plan->files, makeInteger(plan->rra),
+			makeString(plan->ds ? plan->ds : ""), plan->bound_kinds);
+	fdw_private = lappend(fdw_private, plan->spec_lens);
+	fdw_private = lappend(fdw_private, plan->spec_cnts);
+
+	return make_foreignscan(tlist, scan_clauses, baserel->relid,
+			/* fdw_exprs = */ plan->bound_exprs, fdw_private,
+			/* fdw_scan_tlist = */ NIL, /* fdw_recheck_quals = */ NIL,
+			outer_plan);
+} /* rrd_fdw_get_plan_node */
+
+static void
+rrd_fdw_begin(ForeignScanState *node, int eflags)
+{
+	ForeignScan     *fsplan = (ForeignScan *)node->ss.ps.plan;
+	rrd_fdw_state_t *state;
+	TupleDesc        tupdesc;
+	List            *files;
+	ListCell        *lc;
+	char            *ds;
+	int              i;
+
+	state = (rrd_fdw_state_t *)palloc0(sizeof(*state));
+	state->cxt = CurrentMemoryContext;
+	node->fdw_state = state;
+
+	files = (List *)linitial(fsplan->fdw_private);
+	state->rra = intVal(lsecond(fsplan->fdw_private));
+	ds = strVal(lthird(fsplan->fdw_private));
+	state->ds = (*ds != '\0') ? ds : NULL;
+	state->bound_kinds = (List *)lfourth(fsplan->fdw_private);
+	state->spec_lens = (List *)list_nth(fsplan->fdw_private, 4);
+	state->spec_cnts = (List *)list_nth(fsplan->fdw_private, 5);
+
+	state->files_num = list_length(files);
+	state->files = (char **)palloc(Max(state->files_num, 1)
+			* sizeof(*state->files));
+	i = 0;
+	foreach(lc, files)
+		state->files[i++] = strVal(lfirst(lc));
+
+	state->att_file = state->att_rra = state->att_cf = state->att_ds = -1;
+	state->att_tstamp = state->att_ts = state->att_value = -1;
+
+	tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	for (i = 0; i < tupdesc->natts; ++i) {
+		const char *name = NameStr(TupleDescAttr(tupdesc, i)->attname);
+
+		if (TupleDescAttr(tupdesc, i)->attisdropped)
+			continue;
+
+		if (! strcmp(name, "file"))
+			state->att_file = i;
+		else if (! strcmp(name, "rra"))
+			state->att_rra = i;
+		else if (! strcmp(name, "cf"))
+			state->att_cf = i;
+		else if (! strcmp(name, "ds"))
+			state->att_ds = i;
+		else if (! strcmp(name, "tstamp"))
+			state->att_tstamp = i;
+		else if (! strcmp(name, "ts"))
+			state->att_ts = i;
+		else if (! strcmp(name, "value"))
+			state->att_value = i;
+	}
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	if (! IsParallelWorker())
+		rrd_fdw_register_specs(state);
+
+	foreach(lc, fsplan->fdw_exprs)
+		state->bound_states = lappend(state->bound_states,
+				ExecInitExpr((Expr *)lfirst(lc), &node->ss.ps));
+	rrd_fdw_eval_bounds(node, state);
+} /* rrd_fdw_begin */
+
+static TupleTableSlot *
+rrd_fdw_iterate(ForeignScanState *node)
+{
+	rrd_fdw_state_t *state = (rrd_fdw_state_t *)node->fdw_state;
+	TupleTableSlot  *slot = node->ss.ss_ScanTupleSlot;
+
+	ExecClearTuple(slot);
+
+	while (42) {
+		if (! state->file_open) {
+			if (! rrd_fdw_open_next_file(state))
+				return slot;
+		}
+
+		if (rrd_fdw_next_row(state, slot)) {
+			ExecStoreVirtualTuple(slot);
+			return slot;
+		}
+		rrd_fdw_close_file(state);
+	}
+	return slot;
+} /* rrd_fdw_iterate */
+
+static void
+rrd_fdw_rescan(ForeignScanState *node)
+{
+	rrd_fdw_state_t *state = (rrd_fdw_state_t *)node->fdw_state;
+
+	rrd_fdw_close_file(state);
+	state->next_file = 0;
+	rrd_fdw_eval_bounds(node, state);
+} /* rrd_fdw_rescan */
+
+static void
+rrd_fdw_end(ForeignScanState *node)
+{
+	rrd_fdw_state_t *state = (rrd_fdw_state_t *)node->fdw_state;
+
+	if (state)
+		rrd_fdw_close_file(state);
+} /* rrd_fdw_end */
+
+static bool
+rrd_fdw_parallel_safe(PlannerInfo *root, RelOptInfo *rel,
+		RangeTblEntry *rte)
+{
+	return true;
+} /* rrd_fdw_parallel_safe */
+
+static Size
+rrd_fdw_estimate_dsm(ForeignScanState *node, ParallelContext *pcxt)
+{
+	return sizeof(rrd_fdw_shared_t);
+} /* rrd_fdw_estimate_dsm */
+
+static void
+rrd_fdw_init_dsm(ForeignScanState *node, ParallelContext *pcxt,
+		void *coordinate)
+{
+	rrd_fdw_state_t *state = (rrd_fdw_state_t *)node->fdw_state;
+
+	state->shared = (rrd_fdw_shared_t *)coordinate;
+	pg_atomic_init_u32(&state->shared->next_file, 0);
+} /* rrd_fdw_init_dsm */
+
+#if PG_VERSION_NUM >= 100000
+static void
+rrd_fdw_reinit_dsm(ForeignScanState *node, ParallelContext *pcxt,
+		void *coordinate)
+{
+	rrd_fdw_shared_t *shared = (rrd_fdw_shared_t *)coordinate;
+
+	pg_atomic_write_u32(&shared->next_file, 0);
+} /* rrd_fdw_reinit_dsm */
+#endif /* PG_VERSION_NUM >= 100000 */
+
+static void
+rrd_fdw_init_worker(ForeignScanState *node, shm_toc *toc,
+		void *coordinate)
+{
+	rrd_fdw_state_t *state = (rrd_fdw_state_t *)node->fdw_state;
+
+	state->shared = (rrd_fdw_shared_t *)coordinate;
+} /* rrd_fdw_init_worker */
+
+#endif /* PG_VERSION_NUM >= 90600 */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_rrd_fdw_handler);
+PG_FUNCTION_INFO_V1(postrr_rrd_fdw_validator);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_rrd_fdw_handler(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 90600
+	FdwRoutine *routine = makeNode(FdwRoutine);
+
+	routine->GetForeignRelSize  = rrd_fdw_get_rel_size;
+	routine->GetForeignPaths    = rrd_fdw_get_paths;
+	routine->GetForeignPlan     = rrd_fdw_get_plan_node;
+	routine->BeginForeignScan   = rrd_fdw_begin;
+	routine->IterateForeignScan = rrd_fdw_iterate;
+	routine->ReScanForeignScan  = rrd_fdw_rescan;
+	routine->EndForeignScan     = rrd_fdw_end;
+
+	routine->IsForeignScanParallelSafe   = rrd_fdw_parallel_safe;
+	routine->EstimateDSMForeignScan      = rrd_fdw_estimate_dsm;
+	routine->InitializeDSMForeignScan    = rrd_fdw_init_dsm;
+#if PG_VERSION_NUM >= 100000
+	routine->ReInitializeDSMForeignScan  = rrd_fdw_reinit_dsm;
+#endif /* PG_VERSION_NUM >= 100000 */
+	routine->InitializeWorkerForeignScan = rrd_fdw_init_worker;
+
+	PG_RETURN_POINTER(routine);
+#else /* PG_VERSION_NUM < 90600 */
+	ereport(ERROR, (
+				errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("the postrr_rrd foreign data wrapper requires "
+					"PostgreSQL 9.6 or later")
+			));
+	PG_RETURN_NULL();
+#endif /* PG_VERSION_NUM */
+} /* postrr_rrd_fdw_handler */
+
+Datum
+postrr_rrd_fdw_validator(PG_FUNCTION_ARGS)
+{
+	List     *options;
+	Oid       catalog;
+	ListCell *lc;
+	bool      have_file = false;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("postrr_rrd_fdw_validator() expects "
+						"two arguments"),
+					errhint("Usage: postrr_rrd_fdw_validator(options, "
+						"catalog)")
+				));
+
+	options = untransformRelOptions(PG_GETARG_DATUM(0));
+	catalog = PG_GETARG_OID(1);
+
+	foreach(lc, options) {
+		DefElem *def = (DefElem *)lfirst(lc);
+
+		if ((catalog != ForeignTableRelationId)
+				|| (strcmp(def->defname, "filename")
+					&& strcmp(def->defname, "directory")
+					&& strcmp(def->defname, "rra")
+					&& strcmp(def->defname, "ds")))
+			ereport(ERROR, (
+						errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+						errmsg("invalid option \"%s\"", def->defname),
+						errhint("Valid options for postrr_rrd foreign "
+							"tables: filename, directory, rra, ds")
+					));
+
+		if ((! strcmp(def->defname, "filename"))
+				|| (! strcmp(def->defname, "directory"))) {
+			if (have_file)
+				ereport(ERROR, (
+							errcode(ERRCODE_SYNTAX_ERROR),
+							errmsg("either \"filename\" or \"directory\" "
+								"may be specified, not both")
+						));
+			have_file = true;
+
+			/* the files are read with the privileges of the server */
+			if (! superuser())
+				ereport(ERROR, (
+							errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+							errmsg("only superuser may specify the "
+								"files of a postrr_rrd foreign table")
+						));
+		}
+		else if (! strcmp(def->defname, "rra")) {
+			char *end = NULL;
+			long  rra = strtol(defGetString(def), &end, 10);
+
+			if ((*end != '\0') || (rra < 0) || (rra > INT_MAX))
+				ereport(ERROR, (
+							errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("invalid value for option \"rra\": %s",
+								defGetString(def))
+						));
+		}
+	}
+
+	PG_RETURN_VOID();
+} /* postrr_rrd_fdw_validator */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,168 @@
+/*
+ * PostRR - src/rrforecast.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Incremental Holt-Winters forecasting (additive seasonality) as known from
+ * RRDtool's HWPREDICT, SEASONAL, and DEVSEASONAL RRAs. The state is kept in
+ * the tables postrr.rrforecasts (level and trend) and postrr.rrseasonals
+ * (seasonal coefficients and deviations indexed by the slot of the season).
+ */
+
+#include "postrr.h"
+
+#include <math.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+
+/*
+ * data type
+ */
+
+typedef struct {
+	float8 level;
+	float8 trend;
+	float8 seasonal;
+	float8 deviation;
+} hw_state_t;
+
+/*
+ * internal helper functions
+ */
+
+/*
+ * hw_step:
+ * Update the state based on the value observed for a completed slice.
+ * Returns the value predicted for that slice before taking the observation
+ * into account.
+ */
+static float8
+hw_step(hw_state_t *state, float8 alpha, float8 beta, float8 gamma,
+		float8 value)
+{
+	float8 prediction;
+	float8 level;
+
+	prediction = state->level + state->trend + state->seasonal;
+
+	/* missing values are replaced with the prediction */
+	if (isnan(value)) {
+		state->level += state->trend;
+		return prediction;
+	}
+
+	level = alpha * (value - state->seasonal)
+		+ (1.0 - alpha) * (state->level + state->trend);
+	state->trend = beta * (level - state->level)
+		+ (1.0 - beta) * state->trend;
+	state->level = level;
+
+	state->seasonal = gamma * (value - level)
+		+ (1.0 - gamma) * state->seasonal;
+	state->deviation = gamma * fabs(value - prediction)
+		+ (1.0 - gamma) * state->deviation;
+	return prediction;
+} /* hw_step */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_hw_step);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_hw_step(PG_FUNCTION_ARGS)
+{
+	TupleDesc  tupdesc;
+	Datum      values[5];
+	bool       nulls[5] = { false, false, false, false, false };
+	hw_state_t state;
+	float8     alpha, beta, gamma;
+	float8     value;
+	float8     prediction = NAN;
+	int        i;
+
+	if (PG_NARGS() != 8)
+		ereport(ERROR, (
+					errmsg("PostRR_hw_step() expects eight arguments"),
+					errhint("Usage: PostRR_hw_step(alpha, beta, gamma, "
+						"level, trend, seasonal, deviation, value)")
+				));
+
+	for (i = 0; i < 3; ++i)
+		if (PG_ARGISNULL(i))
+			ereport(ERROR, (
+						errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("Holt-Winters parameters "
+							"may not be NULL")
+					));
+
+	alpha = PG_GETARG_FLOAT8(0);
+	beta  = PG_GETARG_FLOAT8(1);
+	gamma = PG_GETARG_FLOAT8(2);
+
+	state.level     = PG_ARGISNULL(3) ? NAN : PG_GETARG_FLOAT8(3);
+	state.trend     = PG_ARGISNULL(4) ? 0.0 : PG_GETARG_FLOAT8(4);
+	state.seasonal  = PG_ARGISNULL(5) ? 0.0 : PG_GETARG_FLOAT8(5);
+	state.deviation = PG_ARGISNULL(6) ? 0.0 : PG_GETARG_FLOAT8(6);
+	value           = PG_ARGISNULL(7) ? NAN : PG_GETARG_FLOAT8(7);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in context "
+						"that cannot accept type record")
+				));
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	if (isnan(state.level)) {
+		/* the first observation initializes the model */
+		state.level = value;
+		state.trend = 0.0;
+	}
+	else
+		prediction = hw_step(&state, alpha, beta, gamma, value);
+
+	values[0] = Float8GetDatum(state.level);
+	values[1] = Float8GetDatum(state.trend);
+	values[2] = Float8GetDatum(state.seasonal);
+	values[3] = Float8GetDatum(state.deviation);
+	values[4] = Float8GetDatum(prediction);
+
+	/* the model is not initialized until a value has been observed */
+	nulls[0] = isnan(state.level);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc,
+					values, nulls)));
+} /* postrr_hw_step */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,796 @@
+/*
+ * PostRR - src/rrimport.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * An importer for XML dumps of RRDtool databases (as created by
+ * 'rrdtool dump'). The dump is processed in a single pass, using a minimal
+ * streaming XML tokenizer with constant memory usage: each RRA is mapped to
+ * one archive per data source using the RRA's step and number of rows as the
+ * RRTimeslice typmod and its consolidation function as the CData typmod.
+ * The archives are created and registered as soon as the first row of the
+ * RRA is read; all rows are then collected and inserted in batches of
+ * RRD_BATCH_SIZE rows per data source.
+ *
+ * The number of rows of an RRA is not part of the dump. It is derived from
+ * the timestamp of the first row (included as a comment by 'rrdtool dump')
+ * and the time of the last update, which determines the last row.
+ */
+
+#include "postrr.h"
+#include "rrcore.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* Postgres utilities */
+#include <catalog/namespace.h>
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <storage/fd.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+
+#define RRD_READ_BUFSIZE 8192
+#define RRD_TOKEN_SIZE   256
+#define RRD_PATH_SIZE    256
+#define RRD_BATCH_SIZE   1000
+
+/*
+ * data types
+ */
+
+enum {
+	RRD_TOKEN_EOF = 0,
+	RRD_TOKEN_OPEN,
+	RRD_TOKEN_CLOSE,
+	RRD_TOKEN_TEXT,
+	RRD_TOKEN_COMMENT
+};
+
+typedef struct {
+	/* file input (using a read buffer) */
+	FILE  *fh;
+	const char *filename;
+	char   buf[RRD_READ_BUFSIZE];
+	size_t buf_len;
+	size_t buf_pos;
+
+	/* in-memory input */
+	const char *data;
+	size_t data_len;
+	size_t data_pos;
+
+	/* one character of look-ahead */
+	int    peek;
+
+	/* a self-closing tag ("<name/>") is reported as open and close tags */
+	bool   pending_close;
+	char   pending_name[RRD_TOKEN_SIZE];
+} rrd_reader_t;
+
+typedef struct {
+	char  *rraname;
+
+	/* global RRD settings */
+	int64  step;
+	int64  lastupdate;
+	List  *ds_names;
+
+	/* current RRA */
+	int    rra_idx;
+	int32  cf;
+	bool   skip_rra;
+	int64  pdp_per_row;
+	SPIPlanPtr *plans;
+
+	/* rows not yet inserted (RRD_BATCH_SIZE per data source) */
+	Datum *batch_ts;
+	Datum *batch_values;
+	int   *batch_num;
+
+	/* current row */
+	int64  row_tstamp;
+	int    v_idx;
+
+	Oid    cdata_oid;
+	Oid    cdata_array_oid;
+	int16  cdata_len;
+	bool   cdata_byval;
+	char   cdata_align;
+	Oid    ts_array_oid;
+	MemoryContext batch_cxt;
+	int64  rows;
+} rrd_import_t;
+
+/*
+ * internal helper functions
+ */
+
+static int
+rrd_getc(rrd_reader_t *r)
+{
+	if (r->peek != EOF) {
+		int c = r->peek;
+		r->peek = EOF;
+		return c;
+	}
+
+	if (! r->fh) {
+		if (r->data_pos >= r->data_len)
+			return EOF;
+		return (unsigned char)r->data[r->data_pos++];
+	}
+
+	if (r->buf_pos >= r->buf_len) {
+		r->buf_pos = 0;
+		r->buf_len = fread(r->buf, 1, sizeof(r->buf), r->fh);
+		if (ferror(r->fh))
+			ereport(ERROR, (
+						errcode_for_file_access(),
+						errmsg("could not read file \"%s\": %m",
+							r->filename)
+					));
+		if (! r->buf_len)
+			return EOF;
+	}
+	return (unsigned char)r->buf[r->buf_pos++];
+} /* rrd_getc */
+
+static void
+rrd_unexpected_eof(void)
+{
+	ereport(ERROR, (
+				errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				errmsg("invalid RRD dump: unexpected end of input")
+			));
+} /* rrd_unexpected_eof */
+
+/*
+ * rrd_next_token:
+ * Read the next token (tag name, text or comment) into 'tok' (truncating it
+ * to RRD_TOKEN_SIZE - 1 characters) and return its type. Text is stripped of
+ * leading and trailing whitespace. XML declarations, processing
+ * instructions, DOCTYPE declarations and attributes are skipped.
+ */
+static int
+rrd_next_token(rrd_reader_t *r, char *tok)
+{
+	size_t len = 0;
+	int c;
+
+	tok[0] = '\0';
+
+	if (r->pending_close) {
+		r->pending_close = false;
+		memcpy(tok, r->pending_name, RRD_TOKEN_SIZE);
+		return RRD_TOKEN_CLOSE;
+	}
+
+	while (42) {
+		do {
+			c = rrd_getc(r);
+		} while ((c != EOF) && isspace(c));
+
+		if (c == EOF)
+			return RRD_TOKEN_EOF;
+
+		if (c != '<') {
+			/* text content */
+			while ((c != EOF) && (c != '<')) {
+				if (len < RRD_TOKEN_SIZE - 1)
+					tok[len++] = (char)c;
+				c = rrd_getc(r);
+			}
+			r->peek = c;
+
+			while ((len > 0) && isspace((unsigned char)tok[len - 1]))
+				--len;
+			tok[len] = '\0';
+			return RRD_TOKEN_TEXT;
+		}
+
+		c = rrd_getc(r);
+		if (c == '!') {
+			int dashes = 0;
+
+			c = rrd_getc(r);
+			if (c != '-') {
+				/* DOCTYPE or similar declaration */
+				while ((c != EOF) && (c != '>'))
+					c = rrd_getc(r);
+				if (c == EOF)
+					rrd_unexpected_eof();
+				continue;
+			}
+			if (rrd_getc(r) != '-')
+				ereport(ERROR, (
+							errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+							errmsg("invalid RRD dump: malformed comment")
+						));
+
+			/* read up to (and including) "-->" */
+			while (42) {
+				c = rrd_getc(r);
+				if (c == EOF)
+					rrd_unexpected_eof();
+				if ((c == '>') && (dashes >= 2))
+					break;
+				dashes = (c == '-') ? dashes + 1 : 0;
+				if (len < RRD_TOKEN_SIZE - 1)
+					tok[len++] = (char)c;
+			}
+
+			/* strip the trailing dashes */
+			len = (len >= 2) ? len - 2 : 0;
+			tok[len] = '\0';
+			return RRD_TOKEN_COMMENT;
+		}
+		else if (c == '?') {
+			int prev = 0;
+
+			while (((c = rrd_getc(r)) != EOF) && (! ((c == '>')
+							&& (prev == '?'))))
+				prev = c;
+			if (c == EOF)
+				rrd_unexpected_eof();
+			continue;
+		}
+		else {
+			int  type = RRD_TOKEN_OPEN;
+			int  prev = 0;
+
+			if (c == '/') {
+				type = RRD_TOKEN_CLOSE;
+				c = rrd_getc(r);
+			}
+
+			while ((c != EOF) && (c != '>') && (c != '/')
+					&& (! isspace(c))) {
+				if (len < RRD_TOKEN_SIZE - 1)
+					tok[len++] = (char)c;
+				c = rrd_getc(r);
+			}
+			tok[len] = '\0';
+
+			/* skip attributes */
+			while ((c != EOF) && (c != '>')) {
+				prev = c;
+				c = rrd_getc(r);
+			}
+			if (c == EOF)
+				rrd_unexpected_eof();
+
+			if ((type == RRD_TOKEN_OPEN) && (prev == '/')) {
+				r->pending_close = true;
+				memcpy(r->pending_name, tok, RRD_TOKEN_SIZE);
+			}
+			return type;
+		}
+	}
+	return RRD_TOKEN_EOF;
+} /* rrd_next_token */
+
+static int64
+rrd_parse_int(const char *str, const char *what)
+{
+	char  *endptr = NULL;
+	int64  value;
+
+	errno = 0;
+	value = (int64)strtoll(str, &endptr, 10);
+	if ((endptr == str) || errno)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid RRD dump: invalid %s: \"%s\"",
+						what, str)
+				));
+	return value;
+} /* rrd_parse_int */
+
+/*
+ * rrd_table_name:
+ * Derive a table name from the specified parts, replacing all characters
+ * which are not valid in an unquoted identifier by underscores.
+ */
+static char *
+rrd_table_name(const char *rraname, const char *ds, const char *cf,
+		int32 len, int rra_idx)
+{
+	StringInfoData name;
+	char *c;
+
+	initStringInfo(&name);
+	appendStringInfo(&name, "%s_%s_%s_%d_%d", rraname, ds, cf, len, rra_idx);
+	for (c = name.data; *c != '\0'; ++c) {
+		if (isalnum((unsigned char)*c))
+			*c = (char)tolower((unsigned char)*c);
+		else
+			*c = '_';
+	}
+	return name.data;
+} /* rrd_table_name */
+
+/*
+ * rrd_create_archives:
+ * Create and register one archive for each data source of the current RRA
+ * and prepare the statements to insert batches of rows.
+ */
+static void
+rrd_create_archives(rrd_import_t *imp, int32 len, int32 num)
+{
+	const char *cf_str = cdata_cf_to_str(imp->cf);
+	ListCell   *lc;
+	int         ds_num = Max(list_length(imp->ds_names), 1);
+	int         i = 0;
+
+	Oid   argtypes[5] = { TEXTOID, TEXTOID, INT4OID, INT4OID, TEXTOID };
+	Datum args[5];
+
+	imp->plans = (SPIPlanPtr *)palloc0(ds_num * sizeof(*imp->plans));
+	imp->batch_ts = (Datum *)palloc(ds_num * RRD_BATCH_SIZE
+			* sizeof(*imp->batch_ts));
+	imp->batch_values = (Datum *)palloc(ds_num * RRD_BATCH_SIZE
+			* sizeof(*imp->batch_values));
+	imp->batch_num = (int *)palloc0(ds_num * sizeof(*imp->batch_num));
+
+	foreach(lc, imp->ds_names) {
+		const char *ds = (const char *)lfirst(lc);
+		StringInfoData query;
+		char *tbl;
+		Oid   ins_argtypes[2];
+		int   ret;
+
+		initStringInfo(&query);
+
+		/* a single data source is stored using the specified rraname */
+		if (list_length(imp->ds_names) > 1)
+			appendStringInfo(&query, "%s_%s", imp->rraname, ds);
+		else
+			appendStringInfoString(&query, imp->rraname);
+		tbl = rrd_table_name(imp->rraname, ds, cf_str, len, imp->rra_idx);
+
+		args[0] = CStringGetTextDatum(query.data);
+		args[1] = CStringGetTextDatum(tbl);
+		args[2] = Int32GetDatum(len);
+		args[3] = Int32GetDatum(num);
+		args[4] = CStringGetTextDatum(cf_str);
+
+		ret = SPI_execute_with_args("SELECT PostRR_create_archive("
+					"$1, $2::name, $3 * interval '1 second', $4, false, "
+					"'none', NULL, $5)",
+				5, argtypes, args, /* nulls = */ NULL,
+				/* read_only = */ false, /* count = */ 0);
+		if (ret != SPI_OK_SELECT)
+			ereport(ERROR, (
+						errmsg("failed to create archive %s: %s", tbl,
+							SPI_result_code_string(ret))
+					));
+
+		resetStringInfo(&query);
+		appendStringInfo(&query, "INSERT INTO %s (ts, value) "
+				"SELECT * FROM unnest($1, $2)", quote_identifier(tbl));
+		ins_argtypes[0] = imp->ts_array_oid;
+		ins_argtypes[1] = imp->cdata_array_oid;
+		imp->plans[i] = SPI_prepare(query.data, 2, ins_argtypes);
+		if (! imp->plans[i])
+			ereport(ERROR, (
+						errmsg("failed to prepare insert into %s: %s", tbl,
+							SPI_result_code_string(SPI_result))
+					));
+
+		ereport(NOTICE, (
+					errmsg("importing %s RRA #%d (%s, %d x %d seconds) "
+						"into %s", ds, imp->rra_idx, cf_str, num, len, tbl)
+				));
+		++i;
+	}
+} /* rrd_create_archives */
+
+/*
+ * rrd_flush_rows:
+ * Insert all collected rows of the current RRA, using a single statement
+ * per data source.
+ */
+static void
+rrd_flush_rows(rrd_import_t *imp)
+{
+	MemoryContext old_cxt;
+	int i;
+
+	if (! imp->plans)
+		return;
+
+	old_cxt = MemoryContextSwitchTo(imp->batch_cxt);
+	for (i = 0; i < list_length(imp->ds_names); ++i) {
+		Datum args[2];
+		int   ret;
+
+		if (! imp->batch_num[i])
+			continue;
+
+		args[0] = PointerGetDatum(construct_array(
+					imp->batch_ts + i * RRD_BATCH_SIZE, imp->batch_num[i],
+					TIMESTAMPTZOID, sizeof(TimestampTz), FLOAT8PASSBYVAL,
+					'd'));
+		args[1] = PointerGetDatum(construct_array(
+					imp->batch_values + i * RRD_BATCH_SIZE,
+					imp->batch_num[i], imp->cdata_oid, imp->cdata_len,
+					imp->cdata_byval, imp->cdata_align));
+
+		ret = SPI_execute_plan(imp->plans[i], args, /* nulls = */ NULL,
+				/* read_only = */ false, /* count = */ 0);
+		if (ret != SPI_OK_INSERT)
+			ereport(ERROR, (
+						errmsg("failed to import rows of RRA #%d: %s",
+							imp->rra_idx, SPI_result_code_string(ret))
+					));
+		imp->batch_num[i] = 0;
+	}
+	MemoryContextSwitchTo(old_cxt);
+	MemoryContextReset(imp->batch_cxt);
+} /* rrd_flush_rows */
+
+static void
+rrd_free_plans(rrd_import_t *imp)
+{
+	int i;
+
+	if (! imp->plans)
+		return;
+
+	for (i = 0; i < list_length(imp->ds_names); ++i)
+		if (imp->plans[i])
+			SPI_freeplan(imp->plans[i]);
+	pfree(imp->plans);
+	pfree(imp->batch_ts);
+	pfree(imp->batch_values);
+	pfree(imp->batch_num);
+	imp->plans = NULL;
+	imp->batch_ts = imp->batch_values = NULL;
+	imp->batch_num = NULL;
+} /* rrd_free_plans */
+
+/*
+ * rrd_begin_row:
+ * Determine the timestamp of a new row of the current RRA, creating the
+ * archives when starting the first row.
+ */
+static void
+rrd_begin_row(rrd_import_t *imp, int64 comment_tstamp)
+{
+	int64 row_len = imp->step * imp->pdp_per_row;
+
+	imp->v_idx = 0;
+
+	if (imp->skip_rra)
+		return;
+
+	if (comment_tstamp > 0)
+		imp->row_tstamp = comment_tstamp;
+	else if (imp->plans)
+		imp->row_tstamp += row_len;
+	else
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid RRD dump: missing timestamp "
+						"of first row of RRA #%d", imp->rra_idx),
+					errhint("The timestamps are included as comments "
+						"by 'rrdtool dump'.")
+				));
+
+	if (! imp->plans) {
+		int64 last;
+		int64 num;
+
+		if ((imp->step <= 0) || (imp->pdp_per_row <= 0)
+				|| (row_len > INT_MAX))
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("invalid RRD dump: invalid step of "
+							"RRA #%d", imp->rra_idx)
+					));
+
+		last = imp->lastupdate - (imp->lastupdate % row_len);
+		num  = (last - imp->row_tstamp) / row_len + 1;
+		if ((num <= 0) || (num > INT_MAX))
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						errmsg("invalid RRD dump: first row of RRA #%d "
+							"does not match the last update",
+							imp->rra_idx)
+					));
+
+		rrd_create_archives(imp, (int32)row_len, (int32)num);
+	}
+} /* rrd_begin_row */
+
+static void
+rrd_add_value(rrd_import_t *imp, const char *str)
+{
+	MemoryContext old_cxt;
+	char  *endptr = NULL;
+	double value;
+	int    n;
+
+	if (imp->skip_rra || (! imp->plans))
+		return;
+
+	if (imp->v_idx >= list_length(imp->ds_names))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid RRD dump: too many values in row "
+						"of RRA #%d", imp->rra_idx)
+				));
+
+	value = strtod(str, &endptr);
+	if ((endptr == str) || (*endptr != '\0'))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid RRD dump: invalid value: \"%s\"", str)
+				));
+
+	/* unknown values are not stored at all */
+	if (isnan(value))
+		return;
+
+	if (imp->batch_num[imp->v_idx] >= RRD_BATCH_SIZE)
+		rrd_flush_rows(imp);
+
+	old_cxt = MemoryContextSwitchTo(imp->batch_cxt);
+
+	n = imp->v_idx * RRD_BATCH_SIZE + imp->batch_num[imp->v_idx];
+	imp->batch_ts[n] = TimestampTzGetDatum(time_t_to_timestamptz(
+				(pg_time_t)imp->row_tstamp));
+	imp->batch_values[n] = PointerGetDatum(cdata_create(value,
+				/* undef_num = */ 0, /* val_num = */ 1, imp->cf));
+	++imp->batch_num[imp->v_idx];
+
+	MemoryContextSwitchTo(old_cxt);
+	++imp->rows;
+} /* rrd_add_value */
+
+/*
+ * rrd_import:
+ * Import the RRD dump provided by the specified reader.
+ */
+static int64
+rrd_import(rrd_reader_t *r, char *rraname)
+{
+	rrd_import_t imp;
+
+	char  path[RRD_PATH_SIZE] = "";
+	char  tok[RRD_TOKEN_SIZE];
+	int64 comment_tstamp = 0;
+	int   type;
+	int   spi_rc;
+
+	memset(&imp, 0, sizeof(imp));
+	imp.rraname = rraname;
+	imp.rra_idx = -1;
+
+	imp.cdata_oid = TypenameGetTypid("cdata");
+	if (! OidIsValid(imp.cdata_oid))
+		ereport(ERROR, (
+					errcode(ERRCODE_UNDEFINED_OBJECT),
+					errmsg("type cdata does not exist"),
+					errhint("Make sure the PostRR schema is included "
+						"in the search_path.")
+				));
+	get_typlenbyvalalign(imp.cdata_oid, &imp.cdata_len, &imp.cdata_byval,
+			&imp.cdata_align);
+	imp.cdata_array_oid = get_array_type(imp.cdata_oid);
+	imp.ts_array_oid    = get_array_type(TIMESTAMPTZOID);
+
+	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to import RRD dump: "
+						"could not connect to SPI manager: %s",
+						SPI_result_code_string(spi_rc))
+				));
+
+	imp.batch_cxt = AllocSetContextCreate(CurrentMemoryContext,
+			"PostRR RRD import batch", ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE);
+
+	while ((type = rrd_next_token(r, tok)) != RRD_TOKEN_EOF) {
+		if (type == RRD_TOKEN_OPEN) {
+			size_t len = strlen(path);
+
+			if (len + strlen(tok) + 2 > sizeof(path))
+				ereport(ERROR, (
+							errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+							errmsg("invalid RRD dump: elements nested "
+								"too deeply")
+						));
+			snprintf(path + len, sizeof(path) - len, "/%s", tok);
+
+			if (! strcmp(path, "/rrd/rra")) {
+				++imp.rra_idx;
+				imp.cf = -1;
+				imp.skip_rra = false;
+				imp.pdp_per_row = 0;
+				imp.row_tstamp = 0;
+				comment_tstamp = 0;
+			}
+			else if (! strcmp(path, "/rrd/rra/database")) {
+				if (imp.cf < 0)
+					imp.skip_rra = true;
+			}
+			else if (! strcmp(path, "/rrd/rra/database/row")) {
+				rrd_begin_row(&imp, comment_tstamp);
+				comment_tstamp = 0;
+			}
+		}
+		else if (type == RRD_TOKEN_CLOSE) {
+			char *sep = strrchr(path, '/');
+
+			if ((! sep) || strcmp(sep + 1, tok))
+				ereport(ERROR, (
+							errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+							errmsg("invalid RRD dump: unexpected "
+								"closing tag </%s>", tok)
+						));
+
+			if (! strcmp(path, "/rrd/rra")) {
+				rrd_flush_rows(&imp);
+				rrd_free_plans(&imp);
+			}
+			else if (! strcmp(path, "/rrd/rra/database/row/v"))
+				++imp.v_idx;
+
+			*sep = '\0';
+		}
+		else if (type == RRD_TOKEN_COMMENT) {
+			char *sep;
+
+			/* row comments: <!-- YYYY-MM-DD HH:MM:SS TZ / epoch --> */
+			if (strcmp(path, "/rrd/rra/database")
+					|| (! (sep = strrchr(tok, '/'))))
+				continue;
+			comment_tstamp = rrd_parse_int(sep + 1, "row timestamp");
+		}
+		else if (! strcmp(path, "/rrd/rra/database/row/v"))
+			rrd_add_value(&imp, tok);
+		else if (! strcmp(path, "/rrd/step"))
+			imp.step = rrd_parse_int(tok, "step");
+		else if (! strcmp(path, "/rrd/lastupdate"))
+			imp.lastupdate = rrd_parse_int(tok, "last update");
+		else if (! strcmp(path, "/rrd/ds/name"))
+			imp.ds_names = lappend(imp.ds_names, pstrdup(tok));
+		else if (! strcmp(path, "/rrd/rra/pdp_per_row"))
+			imp.pdp_per_row = rrd_parse_int(tok, "pdp_per_row");
+		else if (! strcmp(path, "/rrd/rra/cf")) {
+			if (! strcmp(tok, "AVERAGE"))
+				imp.cf = RRCORE_CF_AVG;
+			else if (! strcmp(tok, "MIN"))
+				imp.cf = RRCORE_CF_MIN;
+			else if (! strcmp(tok, "MAX"))
+				imp.cf = RRCORE_CF_MAX;
+			else
+				ereport(WARNING, (
+							errmsg("skipping RRA #%d: unsupported "
+								"consolidation function %s",
+								imp.rra_idx, tok)
+						));
+		}
+	}
+
+	if (path[0] != '\0')
+		rrd_unexpected_eof();
+
+	rrd_free_plans(&imp);
+	MemoryContextDelete(imp.batch_cxt);
+	SPI_finish();
+	return imp.rows;
+} /* rrd_import */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_import_rrd);
+PG_FUNCTION_INFO_V1(postrr_import_rrd_file);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_import_rrd(PG_FUNCTION_ARGS)
+{
+	rrd_reader_t reader;
+	bytea *dump;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("postrr_import_rrd() expects two arguments"),
+					errhint("Usage: postrr_import_rrd(rraname, dump)")
+				));
+
+	dump = PG_GETARG_BYTEA_PP(1);
+
+	memset(&reader, 0, sizeof(reader));
+	reader.data     = VARDATA_ANY(dump);
+	reader.data_len = VARSIZE_ANY_EXHDR(dump);
+	reader.peek     = EOF;
+
+	PG_RETURN_INT64(rrd_import(&reader,
+				text_to_cstring(PG_GETARG_TEXT_PP(0))));
+} /* postrr_import_rrd */
+
+Datum
+postrr_import_rrd_file(PG_FUNCTION_ARGS)
+{
+	rrd_reader_t reader;
+	int64 rows;
+
+	if (PG_NARGS() != 2)
+		ereport(ERROR, (
+					errmsg("postrr_import_rrd_file() expects two arguments"),
+					errhint("Usage: postrr_import_rrd_file(rraname, "
+						"filename)")
+				));
+
+	if (! superuser())
+		ereport(ERROR, (
+					errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+					errmsg("must be superuser to import RRD dumps "
+						"from a file")
+				));
+
+	memset(&reader, 0, sizeof(reader));
+	reader.filename = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	reader.peek     = EOF;
+
+	reader.fh = AllocateFile(reader.filename, "r");
+	if (! reader.fh)
+		ereport(ERROR, (
+					errcode_for_file_access(),
+					errmsg("could not open file \"%s\" for reading: %m",
+						reader.filename)
+				));
+
+	rows = rrd_import(&reader, text_to_cstring(PG_GETARG_TEXT_PP(0)));
+
+	FreeFile(reader.fh);
+	PG_RETURN_INT64(rows);
+} /* postrr_import_rrd_file */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
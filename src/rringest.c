@@ -0,0 +1,687 @@
+/*
+ * PostRR - src/rringest.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Ingestion of batches of samples in the Graphite plaintext protocol or
+ * collectd's PUTVAL format (as used by the exec and unixsock plugins):
+ *
+ *   <path> <value> <timestamp>
+ *   PUTVAL <identifier> [<option>=<value> ...] <time>:<value>[:<value>...]
+ *
+ * The batch is parsed in place; metric paths are referenced rather than
+ * copied. Each distinct path is mapped to an rraname once per batch (using
+ * postrr.rrmetrics, falling back to the path itself) and all values of a
+ * path are consolidated per slice before being merged into the archives.
+ * A malformed line rejects the whole batch.
+ */
+
+#include "postrr.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* Postgres utilities */
+#include <access/hash.h>
+#include <catalog/pg_type.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+
+/* maximum length of a numeric field (value or timestamp) */
+#define INGEST_NUM_MAX 64
+
+/* maximum number of values of a single PUTVAL value list */
+#define INGEST_VALUES_MAX 64
+
+#define METRICS_QUERY \
+	"SELECT i, n.rraname, a.tbl, a.tscol, a.vcol, " \
+		"(a.tslen * 1000000)::bigint, a.tsnum, " \
+		"att.atttypid = 'cdata'::regtype, att.atttypmod, " \
+		"EXISTS (SELECT 1 FROM postrr.rrsources AS s " \
+				"WHERE s.rraname = n.rraname " \
+					"AND upper(s.dstype) <> 'GAUGE') " \
+			"OR EXISTS (SELECT 1 FROM postrr.rrforecasts AS f " \
+				"WHERE f.rraname = n.rraname), " \
+		"CASE WHEN c.relkind = 'p' THEN tsatt.atttypmod ELSE -1 END " \
+	"FROM generate_subscripts($1, 1) AS i " \
+		"CROSS JOIN LATERAL (SELECT coalesce((SELECT m.rraname " \
+				"FROM postrr.rrmetrics AS m WHERE m.path = $1[i]), " \
+			"$1[i]) AS rraname) AS n " \
+		"CROSS JOIN LATERAL PostRR_archives(n.rraname) AS a " \
+		"JOIN postrr.rrarchives AS r " \
+			"ON r.tbl = a.tbl AND r.tscol = a.tscol AND r.vcol = a.vcol " \
+		"JOIN pg_catalog.pg_attribute AS att " \
+			"ON att.attrelid = a.tbl::text::regclass " \
+				"AND att.attname = a.vcol " \
+		"JOIN pg_catalog.pg_attribute AS tsatt " \
+			"ON tsatt.attrelid = att.attrelid AND tsatt.attname = a.tscol " \
+		"JOIN pg_catalog.pg_class AS c ON c.oid = att.attrelid " \
+	"WHERE r.rraname = n.rraname AND r.idcol IS NULL AND NOT r.cascade"
+
+/*
+ * data types
+ */
+
+/* a metric path (pointing into the batch) and the index of the data source
+ * (PUTVAL value lists with more than one value only; -1 else) */
+typedef struct {
+	const char *path;
+	int32       path_len;
+	int32       ds;
+} ingest_key_t;
+
+typedef struct {
+	/* hash key */
+	ingest_key_t key;
+
+	/* index into the array of paths looked up */
+	int32        idx;
+
+	TimestampTz *tstamps;
+	float8      *values;
+	uint64       values_num;
+	uint64       values_size;
+
+	/* the samples have been applied using PostRR_update() */
+	bool         done;
+} ingest_metric_t;
+
+typedef struct {
+	HTAB        *metrics;
+	TimestampTz  now;
+
+	/* the line being parsed (for error reporting) */
+	int64        line;
+} ingest_state_t;
+
+/*
+ * internal helper functions
+ */
+
+static uint32
+ingest_key_hash(const void *key, Size keysize)
+{
+	const ingest_key_t *k = (const ingest_key_t *)key;
+	uint32 h;
+
+	h = DatumGetUInt32(hash_any((const unsigned char *)k->path,
+				k->path_len));
+	return h ^ (uint32)(k->ds + 1) * 0x9e3779b1U;
+} /* ingest_key_hash */
+
+static int
+ingest_key_match(const void *key1, const void *key2, Size keysize)
+{
+	const ingest_key_t *k1 = (const ingest_key_t *)key1;
+	const ingest_key_t *k2 = (const ingest_key_t *)key2;
+
+	if ((k1->path_len != k2->path_len) || (k1->ds != k2->ds))
+		return 1;
+	return memcmp(k1->path, k2->path, k1->path_len);
+} /* ingest_key_match */
+
+/*
+ * ingest_parse_number:
+ * Parse a numeric field of the specified length. 'U' (collectd) denotes an
+ * undefined value.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+static int
+ingest_parse_number(const char *str, size_t len, float8 *number)
+{
+	char  buf[INGEST_NUM_MAX];
+	char *end = NULL;
+
+	if ((len == 0) || (len >= sizeof(buf)))
+		return -1;
+
+	if ((len == 1) && (*str == 'U')) {
+		*number = NAN;
+		return 0;
+	}
+
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+
+	errno = 0;
+	*number = strtod(buf, &end);
+	if (errno || (*end != '\0'))
+		return -1;
+	return 0;
+} /* ingest_parse_number */
+
+/*
+ * ingest_parse_time:
+ * Parse a UNIX timestamp (possibly including fractional seconds). Negative
+ * values (Graphite) and 'N' (collectd) refer to the current time.
+ */
+static int
+ingest_parse_time(ingest_state_t *state, const char *str, size_t len,
+		TimestampTz *tstamp)
+{
+	float8 t;
+	float8 secs;
+
+	if ((len == 1) && (*str == 'N')) {
+		*tstamp = state->now;
+		return 0;
+	}
+
+	if (ingest_parse_number(str, len, &t) || isnan(t) || isinf(t))
+		return -1;
+
+	if (t < 0.0) {
+		*tstamp = state->now;
+		return 0;
+	}
+
+	/* reject anything not representable as a timestamp */
+	if (t >= 1e13)
+		return -1;
+
+	secs = floor(t);
+	*tstamp = time_t_to_timestamptz((pg_time_t)secs)
+		+ (TimestampTz)rint((t - secs) * USECS_PER_SEC);
+	return 0;
+} /* ingest_parse_time */
+
+/*
+ * ingest_add:
+ * Record a sample of the specified metric.
+ */
+static void
+ingest_add(ingest_state_t *state, const char *path, size_t path_len,
+		int32 ds, TimestampTz tstamp, float8 value)
+{
+	ingest_metric_t *metric;
+	ingest_key_t     key;
+	bool             found = false;
+
+	memset(&key, 0, sizeof(key));
+	key.path     = path;
+	key.path_len = (int32)path_len;
+	key.ds       = ds;
+
+	metric = (ingest_metric_t *)hash_search(state->metrics, &key,
+			HASH_ENTER, &found);
+	if (! found) {
+		metric->idx         = 0;
+		metric->values_num  = 0;
+		metric->values_size = 16;
+		metric->tstamps = (TimestampTz *)palloc(metric->values_size
+				* sizeof(*metric->tstamps));
+		metric->values  = (float8 *)palloc(metric->values_size
+				* sizeof(*metric->values));
+		metric->done    = false;
+	}
+
+	if (metric->values_num >= metric->values_size) {
+		metric->values_size *= 2;
+		metric->tstamps = (TimestampTz *)repalloc(metric->tstamps,
+				metric->values_size * sizeof(*metric->tstamps));
+		metric->values  = (float8 *)repalloc(metric->values,
+				metric->values_size * sizeof(*metric->values));
+	}
+
+	metric->tstamps[metric->values_num] = tstamp;
+	metric->values[metric->values_num]  = value;
+	++metric->values_num;
+} /* ingest_add */
+
+/*
+ * ingest_next_field:
+ * Determine the next whitespace separated field of a line. A field starting
+ * with a double quote extends up to the next unescaped double quote; the
+ * quotes are not included in the field and escape sequences are not
+ * interpreted.
+ *
+ * Returns:
+ *  - 0 if a field has been found
+ *  - a positive value at the end of the line
+ *  - a negative value on error (unterminated quotes)
+ */
+static int
+ingest_next_field(const char **pos, const char *end,
+		const char **field, size_t *field_len)
+{
+	const char *p = *pos;
+
+	while ((p < end) && ((*p == ' ') || (*p == '\t')))
+		++p;
+	if (p >= end)
+		return 1;
+
+	if (*p == '"') {
+		const char *start = ++p;
+
+		while ((p < end) && (*p != '"')) {
+			if ((*p == '\\') && (p + 1 < end))
+				++p;
+			++p;
+		}
+		if (p >= end)
+			return -1;
+
+		*field     = start;
+		*field_len = (size_t)(p - start);
+		*pos       = p + 1;
+		return 0;
+	}
+
+	*field = p;
+	while ((p < end) && (*p != ' ') && (*p != '\t'))
+		++p;
+	*field_len = (size_t)(p - *field);
+	*pos       = p;
+	return 0;
+} /* ingest_next_field */
+
+/*
+ * ingest_invalid:
+ * Report a malformed line, optionally naming the offending field.
+ */
+static void
+ingest_invalid(ingest_state_t *state, const char *reason,
+		const char *field, size_t field_len)
+{
+	if (field)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+					errmsg("invalid line " INT64_FORMAT " of batch: "
+						"%s \"%.*s\"", state->line, reason,
+						(int)field_len, field)
+				));
+	ereport(ERROR, (
+				errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				errmsg("invalid line " INT64_FORMAT " of batch: %s",
+					state->line, reason)
+			));
+} /* ingest_invalid */
+
+/*
+ * ingest_parse_putval:
+ * Parse the remainder of a PUTVAL line.
+ */
+static void
+ingest_parse_putval(ingest_state_t *state, const char *pos, const char *end)
+{
+	const char *ident;
+	size_t      ident_len;
+	const char *field;
+	size_t      field_len;
+	int         lists = 0;
+	int         status;
+
+	status = ingest_next_field(&pos, end, &ident, &ident_len);
+	if (status < 0)
+		ingest_invalid(state, "unterminated quotes", NULL, 0);
+	else if (status || (! ident_len))
+		ingest_invalid(state, "missing PUTVAL identifier", NULL, 0);
+
+	while (42) {
+		const char *vstart[INGEST_VALUES_MAX];
+		size_t      vlen[INGEST_VALUES_MAX];
+		float8      values[INGEST_VALUES_MAX];
+		int         values_num = 0;
+		TimestampTz tstamp;
+		const char *p;
+		int         i;
+
+		status = ingest_next_field(&pos, end, &field, &field_len);
+		if (status > 0)
+			break;
+		else if (status < 0)
+			ingest_invalid(state, "unterminated quotes", NULL, 0);
+
+		/* skip options */
+		if (memchr(field, '=', field_len))
+			continue;
+
+		/* split the value list */
+		p = field;
+		while (42) {
+			const char *sep = memchr(p, ':', field_len - (size_t)(p - field));
+
+			if (values_num >= INGEST_VALUES_MAX)
+				ingest_invalid(state, "too many values in value list",
+						field, field_len);
+
+			vstart[values_num] = p;
+			vlen[values_num] = sep ? (size_t)(sep - p)
+				: field_len - (size_t)(p - field);
+			++values_num;
+
+			if (! sep)
+				break;
+			p = sep + 1;
+		}
+
+		/* the first element is the time */
+		if (values_num < 2)
+			ingest_invalid(state, "invalid value list", field, field_len);
+		if (ingest_parse_time(state, vstart[0], vlen[0], &tstamp))
+			ingest_invalid(state, "invalid time", vstart[0], vlen[0]);
+
+		/* validate all values before recording any of them */
+		for (i = 1; i < values_num; ++i)
+			if (ingest_parse_number(vstart[i], vlen[i], &values[i]))
+				ingest_invalid(state, "invalid value", vstart[i], vlen[i]);
+
+		for (i = 1; i < values_num; ++i)
+			ingest_add(state, ident, ident_len,
+					(values_num > 2) ? i - 1 : -1, tstamp, values[i]);
+		++lists;
+	}
+
+	if (! lists)
+		ingest_invalid(state, "missing PUTVAL value list", NULL, 0);
+} /* ingest_parse_putval */
+
+/*
+ * ingest_parse_line:
+ * Parse a single line (Graphite or PUTVAL).
+ */
+static void
+ingest_parse_line(ingest_state_t *state, const char *pos, const char *end)
+{
+	const char *fields[3];
+	size_t      fields_len[3];
+	TimestampTz tstamp;
+	float8      value;
+	int         status;
+	int         i;
+
+	if (ingest_next_field(&pos, end, &fields[0], &fields_len[0]))
+		ingest_invalid(state, "unterminated quotes", NULL, 0);
+
+	if ((fields_len[0] == 6) && (! strncasecmp(fields[0], "PUTVAL", 6))) {
+		ingest_parse_putval(state, pos, end);
+		return;
+	}
+
+	/* Graphite: exactly three fields */
+	for (i = 1; i < 3; ++i) {
+		status = ingest_next_field(&pos, end, &fields[i], &fields_len[i]);
+		if (status < 0)
+			ingest_invalid(state, "unterminated quotes", NULL, 0);
+		else if (status)
+			ingest_invalid(state, "expected <path> <value> <timestamp>",
+					NULL, 0);
+	}
+	while ((pos < end) && ((*pos == ' ') || (*pos == '\t')))
+		++pos;
+	if (pos < end)
+		ingest_invalid(state, "expected <path> <value> <timestamp>",
+				NULL, 0);
+
+	if (ingest_parse_number(fields[1], fields_len[1], &value))
+		ingest_invalid(state, "invalid value", fields[1], fields_len[1]);
+	if (ingest_parse_time(state, fields[2], fields_len[2], &tstamp))
+		ingest_invalid(state, "invalid timestamp",
+				fields[2], fields_len[2]);
+
+	ingest_add(state, fields[0], fields_len[0], -1, tstamp, value);
+} /* ingest_parse_line */
+
+/*
+ * ingest_parse:
+ * Parse all lines of a batch. Empty lines and comments ('#') are ignored;
+ * an error is raised for any malformed line.
+ */
+static void
+ingest_parse(ingest_state_t *state, const char *data, size_t len)
+{
+	const char *pos = data;
+	const char *end = data + len;
+
+	while (pos < end) {
+		const char *eol = memchr(pos, '\n', (size_t)(end - pos));
+		const char *next;
+
+		if (! eol)
+			eol = end;
+		next = eol + 1;
+		++state->line;
+
+		if ((eol > pos) && (eol[-1] == '\r'))
+			--eol;
+		while ((pos < eol) && isspace((unsigned char)*pos))
+			++pos;
+
+		if ((pos < eol) && (*pos != '#'))
+			ingest_parse_line(state, pos, eol);
+
+		pos = next;
+	}
+} /* ingest_parse */
+
+/*
+ * ingest_key_text:
+ * Return the path name of the specified key. Individual values of PUTVAL
+ * value lists are named '<identifier>/<index>'.
+ */
+static text *
+ingest_key_text(const ingest_key_t *key)
+{
+	StringInfoData name;
+
+	initStringInfo(&name);
+	appendBinaryStringInfo(&name, key->path, key->path_len);
+	if (key->ds >= 0)
+		appendStringInfo(&name, "/%d", key->ds);
+	return cstring_to_text(name.data);
+} /* ingest_key_text */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_ingest);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_ingest(PG_FUNCTION_ARGS)
+{
+	bytea          *batch;
+	ingest_state_t  state;
+	HASHCTL         ctl;
+	HASH_SEQ_STATUS status;
+	ingest_metric_t *metric;
+	ingest_metric_t **metrics;
+	Datum          *paths;
+	int32           metrics_num = 0;
+	int64           values_applied = 0;
+	int64           values_unknown = 0;
+
+	MemoryContext   ingest_cxt;
+	MemoryContext   old_cxt;
+
+	Oid   argtypes[1] = { TEXTARRAYOID };
+	Datum args[1];
+	int   ret;
+	uint64 i;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("PostRR_ingest() expects one argument"),
+					errhint("Usage: PostRR_ingest(batch)")
+				));
+
+	/* text and bytea share the same representation */
+	batch = PG_GETARG_BYTEA_PP(0);
+
+	ingest_cxt = AllocSetContextCreate(CurrentMemoryContext,
+			"PostRR ingest context",
+			ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+	old_cxt = MemoryContextSwitchTo(ingest_cxt);
+
+	memset(&state, 0, sizeof(state));
+	state.now = GetCurrentTimestamp();
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize   = sizeof(ingest_key_t);
+	ctl.entrysize = sizeof(ingest_metric_t);
+	ctl.hash      = ingest_key_hash;
+	ctl.match     = ingest_key_match;
+	ctl.hcxt      = ingest_cxt;
+	state.metrics = hash_create("PostRR ingest metrics", 256, &ctl,
+			HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	ingest_parse(&state, VARDATA_ANY(batch), VARSIZE_ANY_EXHDR(batch));
+
+	if (! hash_get_num_entries(state.metrics)) {
+		MemoryContextSwitchTo(old_cxt);
+		MemoryContextDelete(ingest_cxt);
+		PG_RETURN_INT64(0);
+	}
+
+	/* look up the archives of all metrics at once */
+	metrics = (ingest_metric_t **)palloc(hash_get_num_entries(state.metrics)
+			* sizeof(*metrics));
+	paths = (Datum *)palloc(hash_get_num_entries(state.metrics)
+			* sizeof(*paths));
+
+	hash_seq_init(&status, state.metrics);
+	while ((metric = (ingest_metric_t *)hash_seq_search(&status)) != NULL) {
+		metric->idx = metrics_num;
+		metrics[metrics_num] = metric;
+		paths[metrics_num] = PointerGetDatum(ingest_key_text(&metric->key));
+		++metrics_num;
+	}
+
+	args[0] = PointerGetDatum(construct_array(paths, metrics_num, TEXTOID,
+				-1, false, 'i'));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to connect to the SPI manager")
+				));
+
+	ret = SPI_execute_with_args(METRICS_QUERY, 1, argtypes, args,
+			/* nulls = */ NULL, /* read_only = */ true, /* count = */ 0);
+	if (ret != SPI_OK_SELECT)
+		ereport(ERROR, (
+					errmsg("failed to determine archives: %s",
+						SPI_result_code_string(ret))
+				));
+
+	{
+		SPITupleTable *tuptable = SPI_tuptable;
+		uint64         rows_num = (uint64)SPI_processed;
+		bool          *known;
+
+		known = (bool *)palloc0(metrics_num * sizeof(*known));
+
+		for (i = 0; i < rows_num; ++i) {
+			HeapTuple tuple = tuptable->vals[i];
+			TupleDesc tupdesc = tuptable->tupdesc;
+			bool      isnull = false;
+			int32     idx;
+
+			rrtrigger_archive_t archive;
+			int32     typmod;
+
+			idx = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull))
+				- 1;
+			if ((idx < 0) || (idx >= metrics_num))
+				continue;
+			metric = metrics[idx];
+
+			if (! known[idx])
+				values_applied += (int64)metric->values_num;
+			known[idx] = true;
+
+			if (metric->done)
+				continue;
+
+			if (DatumGetBool(SPI_getbinval(tuple, tupdesc, 10, &isnull))) {
+				/* this updates all archives of the rraname */
+				rrtrigger_update_single(SPI_getvalue(tuple, tupdesc, 2),
+						metric->tstamps, metric->values, metric->values_num);
+				metric->done = true;
+				continue;
+			}
+
+			memset(&archive, 0, sizeof(archive));
+			archive.tbl   = SPI_getvalue(tuple, tupdesc, 3);
+			archive.tscol = SPI_getvalue(tuple, tupdesc, 4);
+			archive.vcol  = SPI_getvalue(tuple, tupdesc, 5);
+			archive.len   = DatumGetInt64(SPI_getbinval(tuple, tupdesc,
+						6, &isnull));
+			archive.num   = DatumGetInt32(SPI_getbinval(tuple, tupdesc,
+						7, &isnull));
+			archive.is_cdata = DatumGetBool(SPI_getbinval(tuple, tupdesc,
+						8, &isnull));
+
+			typmod = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 9, &isnull));
+			archive.cf = (typmod > 0) ? typmod : 0;
+
+			archive.tstypmod = DatumGetInt32(SPI_getbinval(tuple, tupdesc,
+						11, &isnull));
+
+			rrtrigger_update_archive(&archive, metric->tstamps,
+					metric->values, metric->values_num);
+		}
+
+		for (i = 0; i < (uint64)metrics_num; ++i)
+			if (! known[i])
+				values_unknown += (int64)metrics[i]->values_num;
+	}
+
+	SPI_finish();
+
+	if (values_unknown)
+		ereport(WARNING, (
+					errmsg("ignored " INT64_FORMAT " value(s) of unknown "
+						"metrics", values_unknown),
+					errhint("Map metric paths to rranames using "
+						"postrr.rrmetrics.")
+				));
+
+	MemoryContextSwitchTo(old_cxt);
+	MemoryContextDelete(ingest_cxt);
+	PG_RETURN_INT64(values_applied);
+} /* postrr_ingest */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,612 @@
+/*
+ * PostRR - src/rrstat.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Shared memory statistics about PostRR internals: per archive counters
+ * (identified by the table and the timeslice and value columns, like the
+ * latest value cache)
+ * maintained by PostRR_update() (number of samples, created and overwritten
+ * slices, retries, rejected samples, and a latency histogram) as well as
+ * global counters about the lookup of RRTimeslice specs. The statistics are
+ * exposed by the postrr.stat_archives and postrr.stat_specs views.
+ *
+ * The statistics require PostRR to be loaded using shared_preload_libraries
+ * and are available for PostgreSQL 9.6 or later only.
+ */
+
+#include "postrr.h"
+#include "probes.h"
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+
+/* Postgres utilities */
+#include <access/htup_details.h>
+#include <access/xact.h>
+#include <catalog/pg_type.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <storage/spin.h>
+#include <utils/array.h>
+#include <utils/guc.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+#include <utils/tuplestore.h>
+
+#define RRSTAT_LATENCY_BUCKETS 7
+
+#if PG_VERSION_NUM >= 90600
+
+/* upper bounds (in microseconds) of the latency histogram buckets; the last
+ * bucket collects everything else */
+static const int64 latency_bounds[RRSTAT_LATENCY_BUCKETS - 1] = {
+	10, 100, 1000, 10000, 100000, 1000000
+};
+
+/*
+ * data types
+ */
+
+typedef struct {
+	Oid        relid;
+	AttrNumber tsattnum;
+	AttrNumber vattnum;
+} rrstat_key_t;
+
+typedef struct {
+	rrstat_key_t key;
+
+	slock_t mutex;
+
+	int64  samples;
+	int64  created;
+	int64  overwritten;
+	int64  retries;
+	int64  too_old;
+	float8 total_time;
+	int64  latency[RRSTAT_LATENCY_BUCKETS];
+} rrstat_entry_t;
+
+typedef struct {
+	LWLock *lock;
+	pg_atomic_uint64 specs[RRSTAT_SPEC_COUNTERS];
+} rrstat_shared_t;
+
+/*
+ * configuration
+ */
+
+static int stat_max_archives = 1000;
+
+/*
+ * shared state
+ */
+
+static rrstat_shared_t *rrstat_shared = NULL;
+static HTAB            *rrstat_hash   = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+/*
+ * internal helper functions
+ */
+
+static Size
+rrstat_shmem_size(void)
+{
+	return add_size(MAXALIGN(sizeof(rrstat_shared_t)),
+			hash_estimate_size(stat_max_archives, sizeof(rrstat_entry_t)));
+} /* rrstat_shmem_size */
+
+static void
+rrstat_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(rrstat_shmem_size());
+	RequestNamedLWLockTranche("postrr_stat", 1);
+} /* rrstat_shmem_request */
+
+static void
+rrstat_shmem_startup(void)
+{
+	HASHCTL ctl;
+	bool    found;
+	int     i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	rrstat_shared = ShmemInitStruct("postrr_stat",
+			sizeof(*rrstat_shared), &found);
+	if (! found) {
+		rrstat_shared->lock = &(GetNamedLWLockTranche("postrr_stat"))->lock;
+		for (i = 0; i < RRSTAT_SPEC_COUNTERS; ++i)
+			pg_atomic_init_u64(&rrstat_shared->specs[i], 0);
+	}
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize   = sizeof(rrstat_key_t);
+	ctl.entrysize = sizeof(rrstat_entry_t);
+
+	rrstat_hash = ShmemInitHash("postrr_stat hash",
+			stat_max_archives, stat_max_archives, &ctl,
+			HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+} /* rrstat_shmem_startup */
+
+/*
+ * rrstat_get_entry:
+ * Look up (or create) the entry of the specified archive. Returns NULL if
+ * the archive is unknown and the hash table is full. The lock is held (in
+ * shared or exclusive mode) on return either way, keeping
+ * PostRR_stat_reset() from removing the entry while it is being updated; the
+ * caller has to release it.
+ */
+static rrstat_entry_t *
+rrstat_get_entry(const rrstat_key_t *key)
+{
+	rrstat_entry_t *entry;
+	bool found;
+
+	LWLockAcquire(rrstat_shared->lock, LW_SHARED);
+	entry = (rrstat_entry_t *)hash_search(rrstat_hash, key,
+			HASH_FIND, NULL);
+	if (entry)
+		return entry;
+	LWLockRelease(rrstat_shared->lock);
+
+	/* someone else might have created the entry in the meantime */
+	LWLockAcquire(rrstat_shared->lock, LW_EXCLUSIVE);
+	entry = (rrstat_entry_t *)hash_search(rrstat_hash, key,
+			HASH_FIND, &found);
+	if ((! entry)
+			&& (hash_get_num_entries(rrstat_hash) < stat_max_archives)) {
+		entry = (rrstat_entry_t *)hash_search(rrstat_hash, key,
+				HASH_ENTER_NULL, &found);
+		if (entry) {
+			memset((char *)entry + sizeof(entry->key), 0,
+					sizeof(*entry) - sizeof(entry->key));
+			SpinLockInit(&entry->mutex);
+		}
+	}
+	return entry;
+} /* rrstat_get_entry */
+
+static char *
+rrstat_get_attname(Oid relid, AttrNumber attnum)
+{
+#if PG_VERSION_NUM >= 110000
+	return get_attname(relid, attnum, /* missing_ok = */ true);
+#else /* PG_VERSION_NUM < 110000 */
+	return get_attname(relid, attnum);
+#endif /* PG_VERSION_NUM */
+} /* rrstat_get_attname */
+
+#endif /* PG_VERSION_NUM >= 90600 */
+
+#ifdef POSTRR_ENABLE_DTRACE
+
+/*
+ * Number of slices updated by the current transaction (for the
+ * update__commit probe, independent of the latest value cache) and the
+ * numbers at the start of all open subtransactions (allocated in
+ * TopTransactionContext).
+ */
+static int   updates_num   = 0;
+static List *updates_saved = NIL;
+
+static void
+rrstat_xact_callback(XactEvent event, void *arg)
+{
+	switch (event) {
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+			if (updates_num)
+				TRACE_POSTRR_UPDATE_COMMIT(updates_num);
+			/* fall through */
+		case XACT_EVENT_PREPARE:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* the memory is released along with the transaction */
+			updates_num   = 0;
+			updates_saved = NIL;
+			break;
+		default:
+			break;
+	}
+} /* rrstat_xact_callback */
+
+static void
+rrstat_subxact_callback(SubXactEvent event, SubTransactionId subid,
+		SubTransactionId parent_subid, void *arg)
+{
+	MemoryContext old_cxt;
+
+	switch (event) {
+		case SUBXACT_EVENT_START_SUB:
+			old_cxt = MemoryContextSwitchTo(TopTransactionContext);
+			updates_saved = lcons_int(updates_num, updates_saved);
+			MemoryContextSwitchTo(old_cxt);
+			break;
+		case SUBXACT_EVENT_ABORT_SUB:
+			/* forget about all updates of the aborted subtransaction */
+			if (updates_saved)
+				updates_num = linitial_int(updates_saved);
+			/* fall through */
+		case SUBXACT_EVENT_COMMIT_SUB:
+			updates_saved = list_delete_first(updates_saved);
+			break;
+		default:
+			break;
+	}
+} /* rrstat_subxact_callback */
+
+#endif /* POSTRR_ENABLE_DTRACE */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_stat_report);
+PG_FUNCTION_INFO_V1(postrr_stat_archives);
+PG_FUNCTION_INFO_V1(postrr_stat_specs);
+PG_FUNCTION_INFO_V1(postrr_stat_reset);
+PG_FUNCTION_INFO_V1(postrr_stat_forget);
+
+/*
+ * public API
+ */
+
+Datum
+postrr_stat_report(PG_FUNCTION_ARGS)
+{
+	Oid   relid;
+	int32 retries;
+	int64 elapsed;
+
+#if PG_VERSION_NUM >= 90600
+	rrstat_entry_t *entry;
+	rrstat_key_t    key;
+	int i;
+#endif
+
+	if (PG_NARGS() != 8)
+		ereport(ERROR, (
+					errmsg("PostRR_stat_report() expects eight arguments"),
+					errhint("Usage: PostRR_stat_report(table, tscol, vcol, "
+						"created, overwritten, retries, rejected, "
+						"start time)")
+				));
+
+	relid   = PG_GETARG_OID(0);
+	retries = PG_GETARG_INT32(5);
+	elapsed = (int64)(GetCurrentTimestamp() - PG_GETARG_TIMESTAMPTZ(7));
+
+	if (retries)
+		TRACE_POSTRR_UPDATE_RETRY(relid, retries);
+	if (PG_GETARG_BOOL(3))
+		TRACE_POSTRR_SLICE_ROLLOVER(relid, PG_GETARG_BOOL(4));
+	TRACE_POSTRR_UPDATE_DONE(relid, retries, PG_GETARG_BOOL(6), elapsed);
+#ifdef POSTRR_ENABLE_DTRACE
+	if (! PG_GETARG_BOOL(6))
+		++updates_num;
+#endif /* POSTRR_ENABLE_DTRACE */
+
+#if PG_VERSION_NUM >= 90600
+	/* statistics are not available */
+	if (! rrstat_hash)
+		PG_RETURN_VOID();
+
+	memset(&key, 0, sizeof(key));
+	key.relid    = relid;
+	key.tsattnum = get_attnum(relid, NameStr(*PG_GETARG_NAME(1)));
+	key.vattnum  = get_attnum(relid, NameStr(*PG_GETARG_NAME(2)));
+
+	for (i = 0; i < RRSTAT_LATENCY_BUCKETS - 1; ++i)
+		if (elapsed < latency_bounds[i])
+			break;
+
+	if (! (entry = rrstat_get_entry(&key))) {
+		LWLockRelease(rrstat_shared->lock);
+		PG_RETURN_VOID();
+	}
+
+	SpinLockAcquire(&entry->mutex);
+	if (PG_GETARG_BOOL(6))
+		++entry->too_old;
+	else
+		++entry->samples;
+	if (PG_GETARG_BOOL(3))
+		++entry->created;
+	if (PG_GETARG_BOOL(4))
+		++entry->overwritten;
+	entry->retries    += retries;
+	entry->total_time += (float8)elapsed / 1000.0;
+	++entry->latency[i];
+	SpinLockRelease(&entry->mutex);
+	LWLockRelease(rrstat_shared->lock);
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	PG_RETURN_VOID();
+} /* postrr_stat_report */
+
+Datum
+postrr_stat_archives(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo   *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext    oldcontext;
+	TupleDesc        tupdesc;
+	Tuplestorestate *tupstore;
+
+	if (PG_NARGS() != 0)
+		ereport(ERROR, (
+					errmsg("PostRR_stat_archives() "
+						"does not accept any arguments")
+				));
+
+	if ((! rsinfo) || (! IsA(rsinfo, ReturnSetInfo))
+			|| (! (rsinfo->allowedModes & SFRM_Materialize)))
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("set-valued function called in context "
+						"that cannot accept a set")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	oldcontext = MemoryContextSwitchTo(
+			rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc  = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(/* random access = */ true,
+			/* inter xact = */ false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+#if PG_VERSION_NUM >= 90600
+	if (rrstat_hash) {
+		HASH_SEQ_STATUS status;
+		rrstat_entry_t *entry;
+
+		LWLockAcquire(rrstat_shared->lock, LW_SHARED);
+		hash_seq_init(&status, rrstat_hash);
+		while ((entry = (rrstat_entry_t *)hash_seq_search(&status))) {
+			rrstat_entry_t e;
+
+			Datum values[10];
+			bool  nulls[10] = { false, false, false, false, false,
+				false, false, false, false, false };
+			Datum latency[RRSTAT_LATENCY_BUCKETS];
+			char *attname;
+			int   i;
+
+			SpinLockAcquire(&entry->mutex);
+			memcpy(&e, entry, sizeof(e));
+			SpinLockRelease(&entry->mutex);
+
+			for (i = 0; i < RRSTAT_LATENCY_BUCKETS; ++i)
+				latency[i] = Int64GetDatum(e.latency[i]);
+
+			values[0] = ObjectIdGetDatum(e.key.relid);
+			/* the columns may have been dropped in the meantime */
+			if ((attname = rrstat_get_attname(e.key.relid, e.key.tsattnum)))
+				values[1] = DirectFunctionCall1(namein,
+						CStringGetDatum(attname));
+			else
+				nulls[1] = true;
+			if ((attname = rrstat_get_attname(e.key.relid, e.key.vattnum)))
+				values[2] = DirectFunctionCall1(namein,
+						CStringGetDatum(attname));
+			else
+				nulls[2] = true;
+			values[3] = Int64GetDatum(e.samples);
+			values[4] = Int64GetDatum(e.created);
+			values[5] = Int64GetDatum(e.overwritten);
+			values[6] = Int64GetDatum(e.retries);
+			values[7] = Int64GetDatum(e.too_old);
+			values[8] = Float8GetDatum(e.total_time);
+			values[9] = PointerGetDatum(construct_array(latency,
+						RRSTAT_LATENCY_BUCKETS, INT8OID, sizeof(int64),
+						FLOAT8PASSBYVAL, 'd'));
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+		LWLockRelease(rrstat_shared->lock);
+	}
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	tuplestore_donestoring(tupstore);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+	return (Datum)0;
+} /* postrr_stat_archives */
+
+Datum
+postrr_stat_specs(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupdesc;
+	HeapTuple tuple;
+
+	Datum values[RRSTAT_SPEC_COUNTERS];
+	bool  nulls[RRSTAT_SPEC_COUNTERS];
+	int   i;
+
+	if (PG_NARGS() != 0)
+		ereport(ERROR, (
+					errmsg("PostRR_stat_specs() "
+						"does not accept any arguments")
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in "
+						"context that cannot accept type record")
+				));
+
+	for (i = 0; i < RRSTAT_SPEC_COUNTERS; ++i) {
+		values[i] = Int64GetDatum(0);
+		nulls[i]  = false;
+	}
+
+#if PG_VERSION_NUM >= 90600
+	if (rrstat_shared)
+		for (i = 0; i < RRSTAT_SPEC_COUNTERS; ++i)
+			values[i] = Int64GetDatum((int64)pg_atomic_read_u64(
+						&rrstat_shared->specs[i]));
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	tuple = heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+} /* postrr_stat_specs */
+
+Datum
+postrr_stat_reset(PG_FUNCTION_ARGS)
+{
+	if (PG_NARGS() != 0)
+		ereport(ERROR, (
+					errmsg("PostRR_stat_reset() "
+						"does not accept any arguments")
+				));
+
+#if PG_VERSION_NUM >= 90600
+	if (rrstat_hash) {
+		HASH_SEQ_STATUS status;
+		rrstat_entry_t *entry;
+		int i;
+
+		LWLockAcquire(rrstat_shared->lock, LW_EXCLUSIVE);
+		hash_seq_init(&status, rrstat_hash);
+		while ((entry = (rrstat_entry_t *)hash_seq_search(&status)))
+			hash_search(rrstat_hash, &entry->key, HASH_REMOVE, NULL);
+		LWLockRelease(rrstat_shared->lock);
+
+		for (i = 0; i < RRSTAT_SPEC_COUNTERS; ++i)
+			pg_atomic_write_u64(&rrstat_shared->specs[i], 0);
+	}
+#endif /* PG_VERSION_NUM >= 90600 */
+
+	PG_RETURN_VOID();
+} /* postrr_stat_reset */
+
+Datum
+postrr_stat_forget(PG_FUNCTION_ARGS)
+{
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("PostRR_stat_forget() expects one argument"),
+					errhint("Usage: PostRR_stat_forget(table)")
+				));
+
+	rrstat_forget_rel(PG_GETARG_OID(0));
+	PG_RETURN_VOID();
+} /* postrr_stat_forget */
+
+void
+rrstat_forget_rel(Oid relid)
+{
+#if PG_VERSION_NUM >= 90600
+	HASH_SEQ_STATUS status;
+	rrstat_entry_t *entry;
+
+	if (! rrstat_hash)
+		return;
+
+	LWLockAcquire(rrstat_shared->lock, LW_EXCLUSIVE);
+	hash_seq_init(&status, rrstat_hash);
+	while ((entry = (rrstat_entry_t *)hash_seq_search(&status)))
+		if (entry->key.relid == relid)
+			hash_search(rrstat_hash, &entry->key, HASH_REMOVE, NULL);
+	LWLockRelease(rrstat_shared->lock);
+#endif /* PG_VERSION_NUM >= 90600 */
+} /* rrstat_forget_rel */
+
+void
+rrstat_count_spec(int counter)
+{
+#if PG_VERSION_NUM >= 90600
+	if (rrstat_shared && (0 <= counter) && (counter < RRSTAT_SPEC_COUNTERS))
+		pg_atomic_fetch_add_u64(&rrstat_shared->specs[counter], 1);
+#endif /* PG_VERSION_NUM >= 90600 */
+} /* rrstat_count_spec */
+
+void
+rrstat_init(void)
+{
+#ifdef POSTRR_ENABLE_DTRACE
+	RegisterXactCallback(rrstat_xact_callback, NULL);
+	RegisterSubXactCallback(rrstat_subxact_callback, NULL);
+#endif /* POSTRR_ENABLE_DTRACE */
+
+#if PG_VERSION_NUM >= 90600
+	DefineCustomIntVariable("postrr.stat_max_archives",
+			"Maximum number of archives tracked in the statistics.",
+			"Statistics are disabled if this is set to zero.",
+			&stat_max_archives, /* boot_value = */ 1000,
+			/* min = */ 0, /* max = */ INT_MAX / 2, PGC_POSTMASTER,
+			/* flags = */ 0, NULL, NULL, NULL);
+
+	if ((! process_shared_preload_libraries_in_progress)
+			|| (! stat_max_archives))
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook      = rrstat_shmem_request;
+#else
+	rrstat_shmem_request();
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook      = rrstat_shmem_startup;
+#endif /* PG_VERSION_NUM >= 90600 */
+} /* rrstat_init */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
+
@@ -31,18 +31,28 @@
  */
 
 #include "postrr.h"
+#include "probes.h"
+#include "rrcore.h"
 #include "utils/pg_spi.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <postgres.h>
 #include <fmgr.h>
+#include <funcapi.h>
 
 /* Postgres utilities */
 #include <access/hash.h>
 #include <executor/spi.h>
+#include <libpq/pqformat.h>
 #include <utils/array.h>
 #include <utils/datetime.h>
+#include <utils/hsearch.h>
 #include <utils/timestamp.h>
 #include <miscadmin.h> /* DateStyle */
 
@@ -64,26 +74,158 @@ struct rrtimeslice {
 	uint32 seq;
 };
 
+/*
+ * typmod spec cache
+ *
+ * Specs are never changed once they have been stored in
+ * postrr.rrtimeslices, so they may be cached for the lifetime of the
+ * backend. This avoids an SPI round-trip for each and every value being
+ * processed.
+ */
+
+typedef struct {
+	int32 typmod; /* hash key */
+	int64 len;    /* microseconds */
+	int32 num;
+} rrtimeslice_spec_t;
+
+static HTAB *spec_cache = NULL;
+
 /*
  * internal helper functions
  */
 
+static rrtimeslice_spec_t *
+rrtimeslice_spec_cache_lookup(int32 typmod, bool create)
+{
+	bool found = false;
+
+	if (! spec_cache) {
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize   = sizeof(int32);
+		ctl.entrysize = sizeof(rrtimeslice_spec_t);
+		ctl.hash      = tag_hash;
+		ctl.hcxt      = TopMemoryContext;
+
+		spec_cache = hash_create("PostRR RRTimeslice spec cache",
+				/* nelem = */ 32, &ctl,
+				HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	}
+
+	return (rrtimeslice_spec_t *)hash_search(spec_cache, &typmod,
+			create ? HASH_ENTER : HASH_FIND, &found);
+} /* rrtimeslice_spec_cache_lookup */
+
+static void
+rrtimeslice_spec_cache_store(int32 typmod, int64 len, int32 num)
+{
+	rrtimeslice_spec_t *spec;
+
+	spec = rrtimeslice_spec_cache_lookup(typmod, /* create = */ 1);
+	spec->len = len;
+	spec->num = num;
+} /* rrtimeslice_spec_cache_store */
+
+/*
+ * rrtimeslice_format_len:
+ * Format a slice length (in microseconds) as accepted by the typmod input
+ * function: whole seconds are formatted as a plain number, anything else
+ * as a quoted string including the unit.
+ */
+static void
+rrtimeslice_format_len(int64 len, char *buf, size_t buf_len)
+{
+	if (len % USECS_PER_SEC == 0)
+		snprintf(buf, buf_len, INT64_FORMAT, len / USECS_PER_SEC);
+	else if (len % 1000 == 0)
+		snprintf(buf, buf_len, "'" INT64_FORMAT "ms'", len / 1000);
+	else
+		snprintf(buf, buf_len, "'" INT64_FORMAT "us'", len);
+	buf[buf_len - 1] = '\0';
+} /* rrtimeslice_format_len */
+
+/*
+ * rrtimeslice_parse_len:
+ * Parse a slice length consisting of a (possibly fractional) number and an
+ * optional unit ('s' (default), 'ms', or 'us').
+ *
+ * Returns:
+ *  - the length in microseconds
+ *  - a value less than or equal to zero on error
+ */
+static int64
+rrtimeslice_parse_len(const char *str)
+{
+	char  *end = NULL;
+	double value;
+	double factor = (double)USECS_PER_SEC;
+
+	errno = 0;
+	value = strtod(str, &end);
+	if (errno || (end == str))
+		return -1;
+
+	while (isspace((unsigned char)*end))
+		++end;
+
+	if (! strcmp(end, "ms"))
+		factor = 1000.0;
+	else if (! strcmp(end, "us"))
+		factor = 1.0;
+	else if (strcmp(end, "s") && (*end != '\0'))
+		return -1;
+
+	value *= factor;
+	if ((! isfinite(value)) || (value < 1.0)
+			|| (value > (double)INT_MAX * (double)USECS_PER_SEC))
+		return -1;
+	return (int64)rint(value);
+} /* rrtimeslice_parse_len */
+
+/*
+ * rrtimeslice_lookup_spec:
+ * Look up the typmod of the specified spec. Unknown specs are registered
+ * in postrr.rrtimeslices if 'create' is true.
+ *
+ * Returns:
+ *  - the typmod
+ *  - zero if the spec is unknown and 'create' is false
+ */
 static int32
-rrtimeslice_set_spec(int32 len, int32 num)
+rrtimeslice_lookup_spec(int64 len, int32 num, bool create)
 {
 	int spi_rc;
 
 	char  query[256];
 	int32 typmod = 0;
 
+	/* the length is stored in the largest unit dividing it evenly */
+	int64 unit;
+
 	if ((len <= 0) || (num <= 0))
 		ereport(ERROR, (
 					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					errmsg("rrtimeslice(%i, %i) "
+					errmsg("rrtimeslice(" INT64_FORMAT "us, %i) "
 						"length/num may not be less than zero",
 						len, num)
 				));
 
+	if (len % USECS_PER_SEC == 0)
+		unit = USECS_PER_SEC;
+	else if (len % 1000 == 0)
+		unit = 1000;
+	else
+		unit = 1;
+
+	if (len / unit > INT_MAX)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("rrtimeslice(" INT64_FORMAT "us, %i) "
+						"length out of range", len, num)
+				));
+
 	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
 		ereport(ERROR, (
 					errmsg("failed to store rrtimeslice spec: "
@@ -93,17 +235,24 @@ rrtimeslice_set_spec(int32 len, int32 num)
 
 	snprintf(query, sizeof(query),
 			"SELECT tsid FROM postrr.rrtimeslices "
-				"WHERE tslen = %d AND tsnum = %d "
-				"LIMIT 1", len, num);
+				"WHERE tslen = %d AND tsunit = %d AND tsnum = %d "
+				"LIMIT 1", (int32)(len / unit), (int32)unit, num);
 	query[sizeof(query) - 1] = '\0';
 
+	rrstat_count_spec(create
+			? RRSTAT_SPEC_SPI_STORES : RRSTAT_SPEC_SPI_LOOKUPS);
 	spi_rc = pg_spi_get_int(query, 1, &typmod);
 	if (spi_rc == PG_SPI_OK) {
 		SPI_finish();
+		rrtimeslice_spec_cache_store(typmod, len, num);
 		return typmod;
 	}
 	else if (spi_rc != PG_SPI_ERROR_NO_VALUES)
 		pg_spi_ereport(ERROR, "store rrtimeslice spec", spi_rc);
+	else if (! create) {
+		SPI_finish();
+		return 0;
+	}
 
 	snprintf(query, sizeof(query),
 			"SELECT nextval('postrr.tsid'::regclass)");
@@ -114,8 +263,9 @@ rrtimeslice_set_spec(int32 len, int32 num)
 		pg_spi_ereport(ERROR, "retrieve nextval(postrr.tsid)", spi_rc);
 
 	snprintf(query, sizeof(query),
-			"INSERT INTO postrr.rrtimeslices(tsid, tslen, tsnum) "
-			"VALUES (%d, %d, %d)", typmod, len, num);
+			"INSERT INTO postrr.rrtimeslices(tsid, tslen, tsunit, tsnum) "
+			"VALUES (%d, %d, %d, %d)", typmod, (int32)(len / unit),
+			(int32)unit, num);
 	query[sizeof(query) - 1] = '\0';
 
 	spi_rc = SPI_exec(query, /* max num rows = */ 1);
@@ -127,19 +277,41 @@ rrtimeslice_set_spec(int32 len, int32 num)
 				));
 
 	SPI_finish();
+	rrtimeslice_spec_cache_store(typmod, len, num);
 	return typmod;
+} /* rrtimeslice_lookup_spec */
+
+int32
+rrtimeslice_set_spec(int64 len, int32 num)
+{
+	return rrtimeslice_lookup_spec(len, num, /* create = */ 1);
 } /* rrtimeslice_set_spec */
 
-static int
-rrtimeslice_get_spec(int32 typmod, int32 *len, int32 *num)
+int
+rrtimeslice_get_spec(int32 typmod, int64 *len, int32 *num)
 {
+	rrtimeslice_spec_t *spec;
 	int spi_rc;
 
-	char query[256];
+	char  query[256];
+	int32 tslen = 0;
+	int32 tsunit = 0;
 
 	if (typmod <= 0)
 		return -1;
 
+	rrstat_count_spec(RRSTAT_SPEC_LOOKUPS);
+	spec = rrtimeslice_spec_cache_lookup(typmod, /* create = */ 0);
+	if (spec) {
+		TRACE_POSTRR_SPEC_LOOKUP_HIT(typmod);
+		rrstat_count_spec(RRSTAT_SPEC_CACHE_HITS);
+		*len = spec->len;
+		*num = spec->num;
+		return 0;
+	}
+
+	TRACE_POSTRR_SPEC_LOOKUP_MISS(typmod);
+	rrstat_count_spec(RRSTAT_SPEC_SPI_LOOKUPS);
 	if ((spi_rc = SPI_connect()) != SPI_OK_CONNECT)
 		ereport(ERROR, (
 					errmsg("failed to determine rrtimeslice spec: "
@@ -148,26 +320,24 @@ rrtimeslice_get_spec(int32 typmod, int32 *len, int32 *num)
 				));
 
 	snprintf(query, sizeof(query),
-			"SELECT tslen, tsnum FROM postrr.rrtimeslices "
+			"SELECT tslen, tsunit, tsnum FROM postrr.rrtimeslices "
 				"WHERE tsid = %d", typmod);
 	query[sizeof(query) - 1] = '\0';
 
-	spi_rc = pg_spi_get_int(query, 2, len, num);
+	spi_rc = pg_spi_get_int(query, 3, &tslen, &tsunit, num);
 	if (spi_rc != PG_SPI_OK)
 		pg_spi_ereport(ERROR, "determine rrtimeslice spec", spi_rc);
 
 	SPI_finish();
+	*len = (int64)tslen * (int64)tsunit;
+	rrtimeslice_spec_cache_store(typmod, *len, *num);
 	return 0;
 } /* rrtimeslice_get_spec */
 
 static int
 rrtimeslice_apply_typmod(rrtimeslice_t *tslice, int32 typmod)
 {
-	int64 tstamp;
-	int64 length;
-	int64 seq;
-
-	int32 len = 0;
+	int64 len = 0;
 	int32 num = 0;
 
 	if (rrtimeslice_get_spec(typmod, &len, &num))
@@ -176,41 +346,81 @@ rrtimeslice_apply_typmod(rrtimeslice_t *tslice, int32 typmod)
 	if ((len <= 0) || (num <= 0))
 		ereport(ERROR, (
 					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					errmsg("rrtimeslice(%i, %i) "
+					errmsg("rrtimeslice(" INT64_FORMAT "us, %i) "
 						"length/num may not be less than zero",
 						len, num)
 				));
 
-	tstamp = TSTAMP_TO_INT64(tslice->tstamp);
-
-	length = len * USECS_PER_SEC;
-	if (tstamp % length != 0)
-		tstamp = tstamp - (tstamp % length) + length;
-	seq    = tstamp % (length * num) / length;
-	seq    = seq % num;
-
-	tslice->tstamp = INT64_TO_TSTAMP(tstamp);
-	tslice->tsid   = typmod;
-	tslice->seq    = (uint32)seq;
+	rrtimeslice_locate(tslice->tstamp, len, num,
+			&tslice->tstamp, &tslice->seq);
+	tslice->tsid = typmod;
 	return 0;
 } /* rrtimeslice_apply_typmod */
 
+static rrtimeslice_t *
+rrtimeslice_copy(rrtimeslice_t *tslice)
+{
+	rrtimeslice_t *copy;
+
+	copy = (rrtimeslice_t *)palloc(sizeof(*copy));
+	memcpy(copy, tslice, sizeof(*copy));
+	return copy;
+} /* rrtimeslice_copy */
+
+/*
+ * rrtimeslice_resample:
+ * Convert a timeslice to a different typmod. The new slice is the one
+ * covering the end of the original slice. That is, when converting to a
+ * coarser timeslice, the new slice covers the original slice entirely. The
+ * lengths of the slices have to divide evenly.
+ */
+static void
+rrtimeslice_resample(rrtimeslice_t *tslice, int32 typmod)
+{
+	int64 len = 0, t_len = 0;
+	int32 num = 0, t_num = 0;
+	char  len_str[64], t_len_str[64];
+
+	if (rrtimeslice_get_spec(tslice->tsid, &len, &num))
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("unknown rrtimeslice typmod %d", tslice->tsid)
+				));
+	if (rrtimeslice_get_spec(typmod, &t_len, &t_num))
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("unknown rrtimeslice typmod %d", typmod)
+				));
+
+	rrtimeslice_format_len(len, len_str, sizeof(len_str));
+	rrtimeslice_format_len(t_len, t_len_str, sizeof(t_len_str));
+
+	if ((len <= 0) || (t_len <= 0) || ((t_len % len) && (len % t_len)))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("cannot convert rrtimeslice(%s, %d) "
+						"to rrtimeslice(%s, %d)", len_str, num,
+						t_len_str, t_num),
+					errdetail("The lengths of the timeslices have to "
+						"divide evenly.")
+				));
+
+	rrtimeslice_apply_typmod(tslice, typmod);
+} /* rrtimeslice_resample */
+
 /*
  * rrtimeslice_cmp_unify:
- * Unify two RRTimeslices in order to prepare them for comparison. That is, if
- * either one of the arguments does not have any typmod applied, then apply
- * the typmod of the other argument. Throws an error if the typmods don't
- * match.
- *
- * Returns:
- *  - 0 if the arguments could be unified
- *  - 1 if only the first argument is NULL
- *  - 2 if both arguments are NULL
- *  - 3 if only the second argument is NULL
+ * Copy two timeslices to 'u1' and 'u2', converting them to the same typmod
+ * if necessary (the coarser one, if both have a typmod). Throws an error if
+ * the typmods have the same length but a different number of slices.
  */
 static int
-rrtimeslice_cmp_unify(rrtimeslice_t *ts1, rrtimeslice_t *ts2)
+rrtimeslice_cmp_unify(rrtimeslice_t *ts1, rrtimeslice_t *ts2,
+		rrtimeslice_t *u1, rrtimeslice_t *u2)
 {
+	int64 len1 = 0, len2 = 0;
+	int32 num1 = 0, num2 = 0;
+
 	if ((! ts1) && (! ts2))
 		return 0;
 	else if (! ts1)
@@ -218,17 +428,33 @@ rrtimeslice_cmp_unify(rrtimeslice_t *ts1, rrtimeslice_t *ts2)
 	else if (! ts2)
 		return 1;
 
-	if (ts1->tsid && (! ts2->tsid))
-		rrtimeslice_apply_typmod(ts2, ts1->tsid);
-	else if ((! ts1->tsid) && ts2->tsid)
-		rrtimeslice_apply_typmod(ts1, ts2->tsid);
+	*u1 = *ts1;
+	*u2 = *ts2;
+
+	if (u1->tsid && (! u2->tsid))
+		rrtimeslice_apply_typmod(u2, u1->tsid);
+	else if ((! u1->tsid) && u2->tsid)
+		rrtimeslice_apply_typmod(u1, u2->tsid);
+
+	if (u1->tsid == u2->tsid)
+		return 0;
+
+	rrtimeslice_get_spec(u1->tsid, &len1, &num1);
+	rrtimeslice_get_spec(u2->tsid, &len2, &num2);
 
-	if (ts1->tsid != ts2->tsid) /* XXX: compare len/num */
+	/* the sequence numbers of the same slice differ in rings of a
+	 * different size; there's no coarser ring to convert to */
+	if ((len1 == len2) && (num1 != num2))
 		ereport(ERROR, (
 					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 					errmsg("invalid comparison: cannot compare "
-						"rrtimeslices with different typmods (yet)")
+						"rrtimeslices with a different number of slices")
 				));
+
+	if (len1 >= len2)
+		rrtimeslice_resample(u2, u1->tsid);
+	else
+		rrtimeslice_resample(u1, u2->tsid);
 	return 0;
 } /* rrtimeslice_cmp_unify */
 
@@ -240,6 +466,8 @@ PG_FUNCTION_INFO_V1(rrtimeslice_validate);
 
 PG_FUNCTION_INFO_V1(rrtimeslice_in);
 PG_FUNCTION_INFO_V1(rrtimeslice_out);
+PG_FUNCTION_INFO_V1(rrtimeslice_recv);
+PG_FUNCTION_INFO_V1(rrtimeslice_send);
 PG_FUNCTION_INFO_V1(rrtimeslice_typmodin);
 PG_FUNCTION_INFO_V1(rrtimeslice_typmodout);
 
@@ -258,6 +486,8 @@ PG_FUNCTION_INFO_V1(rrtimeslice_seq_ge);
 PG_FUNCTION_INFO_V1(rrtimeslice_seq_cmp);
 PG_FUNCTION_INFO_V1(rrtimeslice_seq_hash);
 
+PG_FUNCTION_INFO_V1(rrtimeslice_slot);
+
 /*
  * public API
  */
@@ -381,7 +611,7 @@ rrtimeslice_out(PG_FUNCTION_ARGS)
 	char  buf_u[MAXDATELEN + 1];
 	char *result;
 
-	int32 len = 0;
+	int64 len = 0;
 	int32 num = 0;
 
 	if (PG_NARGS() != 1)
@@ -402,7 +632,7 @@ rrtimeslice_out(PG_FUNCTION_ARGS)
 	EncodeDateTime(&tm, fsec, 1, tz, tz_str, DateStyle, buf_u);
 
 	if (! rrtimeslice_get_spec(tslice->tsid, &len, &num)) {
-		TimestampTz lower = tslice->tstamp - (len * USECS_PER_SEC);
+		TimestampTz lower = tslice->tstamp - INT64_TO_TSTAMP(len);
 
 		if (timestamp2tm(lower, &tz, &tm, &fsec, &tz_str, NULL))
 			ereport(ERROR, (
@@ -424,15 +654,115 @@ rrtimeslice_out(PG_FUNCTION_ARGS)
 	PG_RETURN_CSTRING(result);
 } /* rrtimeslice_out */
 
+/*
+ * The binary representation does not include the typmod since that is an
+ * implementation detail of the database it was created in. Instead, it
+ * includes the length and number of slices which are then mapped to the
+ * local typmod on input. Input never registers new specs (it has to work in
+ * read-only transactions as well), so the spec has to be known locally,
+ * e.g., from the definition of the target column.
+ */
+
+Datum
+rrtimeslice_recv(PG_FUNCTION_ARGS)
+{
+	rrtimeslice_t *tslice;
+	StringInfo buf;
+	int32 typmod;
+
+	int64 len;
+	int32 num;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("rrtimeslice_recv() expects three arguments"),
+					errhint("Usage: rrtimeslice_recv(internal, oid, typmod)")
+				));
+
+	buf    = (StringInfo)PG_GETARG_POINTER(0);
+	typmod = PG_GETARG_INT32(2);
+
+	tslice = (rrtimeslice_t *)palloc0(sizeof(*tslice));
+	tslice->tstamp = (TimestampTz)pq_getmsgint64(buf);
+	len = pq_getmsgint64(buf);
+	num = (int32)pq_getmsgint(buf, sizeof(int32));
+
+	if (TIMESTAMP_NOT_FINITE(tslice->tstamp))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					errmsg("invalid (non-finite) timestamp "
+						"in external rrtimeslice value")
+				));
+
+	if (len || num) {
+		int32 tsid = rrtimeslice_lookup_spec(len, num, /* create = */ 0);
+
+		if (! tsid)
+			ereport(ERROR, (
+						errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						errmsg("unknown rrtimeslice spec (" INT64_FORMAT
+							"us, %i) in external rrtimeslice value",
+							len, num),
+						errhint("Specs are registered by using them in a "
+							"type modifier, e.g., rrtimeslice('"
+							INT64_FORMAT "us', %i).", len, num)
+					));
+		rrtimeslice_apply_typmod(tslice, tsid);
+	}
+
+	if ((typmod > 0) && (tslice->tsid != typmod)) {
+		if (tslice->tsid)
+			rrtimeslice_resample(tslice, typmod);
+		else
+			rrtimeslice_apply_typmod(tslice, typmod);
+	}
+
+	PG_RETURN_RRTIMESLICE_P(tslice);
+} /* rrtimeslice_recv */
+
+Datum
+rrtimeslice_send(PG_FUNCTION_ARGS)
+{
+	rrtimeslice_t *tslice;
+	StringInfoData buf;
+
+	int64 len = 0;
+	int32 num = 0;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("rrtimeslice_send() expects one argument"),
+					errhint("Usage: rrtimeslice_send(rrtimeslice)")
+				));
+
+	tslice = PG_GETARG_RRTIMESLICE_P(0);
+
+	if (tslice->tsid && rrtimeslice_get_spec(tslice->tsid, &len, &num))
+		ereport(ERROR, (
+					errcode(ERRCODE_DATA_CORRUPTED),
+					errmsg("unknown rrtimeslice typmod %d", tslice->tsid)
+				));
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, (int64)tslice->tstamp);
+	pq_sendint64(&buf, len);
+	pq_sendint(&buf, num, sizeof(int32));
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+} /* rrtimeslice_send */
+
 Datum
 rrtimeslice_typmodin(PG_FUNCTION_ARGS)
 {
 	ArrayType *tm_array;
 
-	int32 *spec;
+	Datum *spec;
 	int    spec_elems = 0;
 	int32  typmod;
 
+	int64  len;
+	long   num;
+	char  *end = NULL;
+
 	if (PG_NARGS() != 1)
 		ereport(ERROR, (
 					errmsg("rrtimeslice_typmodin() expects one argument"),
@@ -441,7 +771,9 @@ rrtimeslice_typmodin(PG_FUNCTION_ARGS)
 
 	tm_array = PG_GETARG_ARRAYTYPE_P(0);
 
-	spec = ArrayGetIntegerTypmods(tm_array, &spec_elems);
+	/* the length may include a unit, so parse the strings on our own */
+	deconstruct_array(tm_array, CSTRINGOID, -2, false, 'c',
+			&spec, NULL, &spec_elems);
 	if (spec_elems != 2)
 		ereport(ERROR, (
 					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
@@ -449,7 +781,26 @@ rrtimeslice_typmodin(PG_FUNCTION_ARGS)
 					errhint("Usage: rrtimeslice(<slice_len>, <num>)")
 				));
 
-	typmod = rrtimeslice_set_spec(spec[0], spec[1]);
+	len = rrtimeslice_parse_len(DatumGetCString(spec[0]));
+	if (len <= 0)
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid rrtimeslice length: %s",
+						DatumGetCString(spec[0])),
+					errhint("Specify the length in seconds, optionally "
+						"using the units 'ms' or 'us' (e.g., '100ms').")
+				));
+
+	errno = 0;
+	num = strtol(DatumGetCString(spec[1]), &end, 10);
+	if (errno || (*end != '\0') || (num <= 0) || (num > INT_MAX))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("invalid number of rrtimeslices: %s",
+						DatumGetCString(spec[1]))
+				));
+
+	typmod = rrtimeslice_set_spec(len, (int32)num);
 	PG_RETURN_INT32(typmod);
 } /* rrtimeslice_typmodin */
 
@@ -458,9 +809,10 @@ rrtimeslice_typmodout(PG_FUNCTION_ARGS)
 {
 	int32 typmod;
 	char  tm_str[1024];
+	char  len_str[64];
 	char *result;
 
-	int32 len = 0;
+	int64 len = 0;
 	int32 num = 0;
 
 	if (PG_NARGS() != 1)
@@ -474,8 +826,10 @@ rrtimeslice_typmodout(PG_FUNCTION_ARGS)
 		tm_str[0] = '\0';
 	else if ((len <= 0) || (num <= 0))
 		snprintf(tm_str, sizeof(tm_str), "(#ERR, #ERR)");
-	else
-		snprintf(tm_str, sizeof(tm_str), "(%d, %d)", len, num);
+	else {
+		rrtimeslice_format_len(len, len_str, sizeof(len_str));
+		snprintf(tm_str, sizeof(tm_str), "(%s, %d)", len_str, num);
+	}
 
 	result = pstrdup(tm_str);
 	PG_RETURN_CSTRING(result);
@@ -498,16 +852,16 @@ rrtimeslice_to_rrtimeslice(PG_FUNCTION_ARGS)
 	tslice = PG_GETARG_RRTIMESLICE_P(0);
 	typmod = PG_GETARG_INT32(1);
 
-	if (typmod > 0) {
-		if ((! tslice->tsid) && (! tslice->seq))
-			rrtimeslice_apply_typmod(tslice, typmod);
-		else
-			ereport(ERROR, (
-						errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-						errmsg("invalid cast: cannot cast rrtimeslices "
-							"with different typmod (yet)")
-					));
-	}
+	if ((typmod <= 0) || (tslice->tsid == typmod))
+		PG_RETURN_RRTIMESLICE_P(tslice);
+
+	/* don't modify the argument in place */
+	tslice = rrtimeslice_copy(tslice);
+
+	if ((! tslice->tsid) && (! tslice->seq))
+		rrtimeslice_apply_typmod(tslice, typmod);
+	else
+		rrtimeslice_resample(tslice, typmod);
 
 	PG_RETURN_RRTIMESLICE_P(tslice);
 } /* rrtimeslice_to_rrtimeslice */
@@ -557,25 +911,33 @@ rrtimeslice_to_timestamptz(PG_FUNCTION_ARGS)
 	PG_RETURN_TIMESTAMPTZ(tslice->tstamp);
 } /* rrtimeslice_to_timestamptz */
 
+Datum
+rrtimeslice_seq(PG_FUNCTION_ARGS)
+{
+	rrtimeslice_t *tslice;
+
+	if (PG_NARGS() != 1)
+		ereport(ERROR, (
+					errmsg("rrtimeslice_seq() expects one argument"),
+					errhint("Usage: rrtimeslice_seq(rrtimeslice)")
+				));
+
+	tslice = PG_GETARG_RRTIMESLICE_P(0);
+	PG_RETURN_INT32((int32)tslice->seq);
+} /* rrtimeslice_seq */
+
 int
 rrtimeslice_cmp_internal(rrtimeslice_t *ts1, rrtimeslice_t *ts2)
 {
+	rrtimeslice_t u1, u2;
 	int status;
 
-	status = rrtimeslice_cmp_unify(ts1, ts2);
+	status = rrtimeslice_cmp_unify(ts1, ts2, &u1, &u2);
 	if (status) /* [1, 3] -> [-1, 1] */
 		return status - 2;
 
-	if (ts1->tstamp == ts2->tstamp)
-		return 0;
-	else if ((ts1->seq == ts2->seq) && (ts1->tstamp < ts2->tstamp))
-		return -1;
-	else if (ts1->tstamp < ts2->tstamp)
-		return -2;
-	else if ((ts1->seq == ts2->seq) && (ts1->tstamp > ts2->tstamp))
-		return 1;
-	else
-		return 2;
+	return rrcore_cmp(TSTAMP_TO_INT64(u1.tstamp), u1.seq,
+			TSTAMP_TO_INT64(u2.tstamp), u2.seq);
 } /* rrtimeslice_cmp_internal */
 
 Datum
@@ -590,18 +952,14 @@ rrtimeslice_cmp(PG_FUNCTION_ARGS)
 int
 rrtimeslice_seq_cmp_internal(rrtimeslice_t *ts1, rrtimeslice_t *ts2)
 {
+	rrtimeslice_t u1, u2;
 	int status;
 
-	status = rrtimeslice_cmp_unify(ts1, ts2);
+	status = rrtimeslice_cmp_unify(ts1, ts2, &u1, &u2);
 	if (status) /* [1, 3] -> [-1, 1] */
 		return status - 2;
 
-	if (ts1->seq < ts2->seq)
-		return -1;
-	else if (ts1->seq == ts2->seq)
-		return 0;
-	else
-		return 1;
+	return rrcore_seq_cmp(u1.seq, u2.seq);
 } /* rrtimeslice_seq_cmp_internal */
 
 Datum
@@ -674,5 +1032,107 @@ rrtimeslice_seq_hash(PG_FUNCTION_ARGS)
 	return hash_uint32(ts->seq);
 } /* rrtimeslice_seq_hash */
 
+Datum
+rrtimeslice_slot(PG_FUNCTION_ARGS)
+{
+	TupleDesc   tupdesc;
+	Datum       values[2];
+	bool        nulls[2] = { false, false };
+	TimestampTz tstamp;
+	uint32      seq;
+	float8      len_secs;
+	int64       len;
+	int32       num;
+
+	if (PG_NARGS() != 3)
+		ereport(ERROR, (
+					errmsg("rrtimeslice_slot() expects three arguments"),
+					errhint("Usage: rrtimeslice_slot(timestamptz, "
+						"length, number)")
+				));
+
+	/* the length is specified in (possibly fractional) seconds */
+	len_secs = PG_GETARG_FLOAT8(1);
+	num = PG_GETARG_INT32(2);
+
+	len = (isnan(len_secs) || (len_secs <= 0.0)
+			|| (len_secs > (float8)INT_MAX))
+		? 0 : (int64)rint(len_secs * (float8)USECS_PER_SEC);
+
+	if ((len <= 0) || (num <= 0))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("rrtimeslice(%g, %i) "
+						"length/num may not be less than zero",
+						len_secs, num)
+				));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (
+					errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("function returning record called in context "
+						"that cannot accept type record")
+				));
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	rrtimeslice_locate(PG_GETARG_TIMESTAMPTZ(0), len, num, &tstamp, &seq);
+
+	values[0] = TimestampTzGetDatum(tstamp);
+	values[1] = Int32GetDatum((int32)seq);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc,
+					values, nulls)));
+} /* rrtimeslice_slot */
+
+void
+rrtimeslice_locate(TimestampTz tstamp, int64 len, int32 num,
+		TimestampTz *end, uint32 *seq)
+{
+	int64_t t = 0;
+
+	rrcore_locate(TSTAMP_TO_INT64(tstamp), len, num, &t, seq);
+	*end = INT64_TO_TSTAMP(t);
+} /* rrtimeslice_locate */
+
+rrtimeslice_t *
+rrtimeslice_create(TimestampTz tstamp, int32 typmod)
+{
+	rrtimeslice_t *tslice;
+
+	tslice = (rrtimeslice_t *)palloc0(sizeof(*tslice));
+	tslice->tstamp = tstamp;
+
+	if (typmod > 0)
+		rrtimeslice_apply_typmod(tslice, typmod);
+	return tslice;
+} /* rrtimeslice_create */
+
+void
+rrtimeslice_next(rrtimeslice_t *tslice)
+{
+	int64 len = 0;
+	int32 num = 0;
+
+	if (rrtimeslice_get_spec(tslice->tsid, &len, &num))
+		ereport(ERROR, (
+					errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("cannot advance rrtimeslice without typmod")
+				));
+
+	tslice->tstamp = INT64_TO_TSTAMP(TSTAMP_TO_INT64(tslice->tstamp) + len);
+	tslice->seq    = (tslice->seq + 1) % (uint32)num;
+} /* rrtimeslice_next */
+
+TimestampTz
+rrtimeslice_get_tstamp(rrtimeslice_t *tslice)
+{
+	return tslice->tstamp;
+} /* rrtimeslice_get_tstamp */
+
+uint32
+rrtimeslice_get_seq(rrtimeslice_t *tslice)
+{
+	return tslice->seq;
+} /* rrtimeslice_get_seq */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
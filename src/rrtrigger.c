@@ -0,0 +1,503 @@
+/*
+ * PostRR - src/rrtrigger.c
+ * Copyright (C) 2012 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A trigger function feeding round-robin archives from plain tables. It is
+ * meant to be used as a statement-level trigger with a transition table
+ * (PostgreSQL 10 or later):
+ *
+ *   CREATE TRIGGER <name> AFTER INSERT ON <table>
+ *       REFERENCING NEW TABLE AS new_rows
+ *       FOR EACH STATEMENT
+ *       EXECUTE PROCEDURE PostRR_trigger(<rraname>, <tscol>, <vcol>);
+ *
+ * All new rows are consolidated per slice of each archive first, such that
+ * each affected slice is merged exactly once. Data sources with a type other
+ * than GAUGE and forecasted metrics are updated sample by sample using
+ * PostRR_update() instead, which takes care of converting the values and
+ * updating the forecast.
+ */
+
+#include "postrr.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+
+/* Postgres utilities */
+#include <catalog/namespace.h>
+#include <catalog/pg_type.h>
+#include <commands/trigger.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <utils/builtins.h>
+#include <utils/hsearch.h>
+
+#define ARCHIVES_QUERY \
+	"SELECT a.tbl, a.tscol, a.vcol, (a.tslen * 1000000)::bigint, a.tsnum, " \
+		"att.atttypid = 'cdata'::regtype, att.atttypmod, " \
+		"CASE WHEN c.relkind = 'p' THEN tsatt.atttypmod ELSE -1 END " \
+	"FROM PostRR_archives($1) AS a " \
+		"JOIN postrr.rrarchives AS r " \
+			"ON r.tbl = a.tbl AND r.tscol = a.tscol AND r.vcol = a.vcol " \
+		"JOIN pg_catalog.pg_attribute AS att " \
+			"ON att.attrelid = a.tbl::text::regclass " \
+				"AND att.attname = a.vcol " \
+		"JOIN pg_catalog.pg_attribute AS tsatt " \
+			"ON tsatt.attrelid = att.attrelid AND tsatt.attname = a.tscol " \
+		"JOIN pg_catalog.pg_class AS c ON c.oid = att.attrelid " \
+	"WHERE r.rraname = $1 AND r.idcol IS NULL AND NOT r.cascade"
+
+/* values of data sources with a type other than GAUGE and of forecasted
+ * metrics depend on each individual sample */
+#define SINGLE_QUERY \
+	"SELECT EXISTS (SELECT 1 FROM postrr.rrsources AS s " \
+			"WHERE s.rraname = $1 AND upper(s.dstype) <> 'GAUGE') " \
+		"OR EXISTS (SELECT 1 FROM postrr.rrforecasts AS f " \
+			"WHERE f.rraname = $1)"
+
+/*
+ * data types
+ */
+
+typedef struct {
+	TimestampTz tstamp;
+	float8      value;
+} batch_sample_t;
+
+typedef struct {
+	/* hash key: end of the slice */
+	TimestampTz slice;
+
+	float8 value;
+	int32  undef_num;
+	int32  val_num;
+} batch_slice_t;
+
+/*
+ * internal helper functions
+ */
+
+static int
+batch_slice_cmp(const void *a, const void *b)
+{
+	TimestampTz t1 = ((const batch_slice_t *)a)->slice;
+	TimestampTz t2 = ((const batch_slice_t *)b)->slice;
+
+	if (t1 < t2)
+		return -1;
+	else if (t1 > t2)
+		return 1;
+	return 0;
+} /* batch_slice_cmp */
+
+static int
+batch_sample_cmp(const void *a, const void *b)
+{
+	TimestampTz t1 = ((const batch_sample_t *)a)->tstamp;
+	TimestampTz t2 = ((const batch_sample_t *)b)->tstamp;
+
+	if (t1 < t2)
+		return -1;
+	else if (t1 > t2)
+		return 1;
+	return 0;
+} /* batch_sample_cmp */
+
+/*
+ * batch_update_archive:
+ * Consolidate all values per slice of the specified archive and merge each
+ * slice into the archive. The caller has to be connected to the SPI manager.
+ */
+static void
+batch_update_archive(rrtrigger_archive_t *archive,
+		TimestampTz *tstamps, float8 *values, uint64 values_num)
+{
+	HASHCTL         ctl;
+	HTAB           *slices;
+	HASH_SEQ_STATUS status;
+	batch_slice_t  *slice;
+	batch_slice_t  *sorted;
+	long            slices_num = 0;
+	uint64          i;
+
+	Oid   argtypes[6] = { TEXTOID, TEXTOID, TEXTOID, TIMESTAMPTZOID,
+		InvalidOid, INT4OID };
+	Datum args[6];
+	char  nulls[6] = { ' ', ' ', ' ', ' ', ' ', ' ' };
+
+	/* the consolidated values are passed on as they are */
+	argtypes[4] = TypenameGetTypid("cdata");
+	if (! OidIsValid(argtypes[4]))
+		ereport(ERROR, (
+					errcode(ERRCODE_UNDEFINED_OBJECT),
+					errmsg("type cdata does not exist"),
+					errhint("Make sure the PostRR extension's schema is "
+						"part of the search path.")
+				));
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize   = sizeof(TimestampTz);
+	ctl.entrysize = sizeof(batch_slice_t);
+	ctl.hash      = tag_hash;
+	ctl.hcxt      = CurrentMemoryContext;
+	slices = hash_create("PostRR batch slices", 256, &ctl,
+			HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	for (i = 0; i < values_num; ++i) {
+		TimestampTz end;
+		uint32      seq;
+		bool        found = false;
+		bool        undef = isnan(values[i]);
+
+		rrtimeslice_locate(tstamps[i], archive->len, archive->num,
+				&end, &seq);
+
+		slice = (batch_slice_t *)hash_search(slices, &end,
+				HASH_ENTER, &found);
+		if (! found) {
+			slice->value     = NAN;
+			slice->undef_num = 0;
+			slice->val_num   = 0;
+		}
+
+		slice->value = cdata_consolidate(archive->cf, slice->value,
+				slice->val_num - slice->undef_num,
+				values[i], undef ? 0 : 1);
+		slice->val_num   += 1;
+		slice->undef_num += undef ? 1 : 0;
+	}
+
+	/* apply the slices in chronological order; older slices would be
+	 * rejected after a newer slice took over the same position */
+	sorted = (batch_slice_t *)palloc(Max(hash_get_num_entries(slices), 1)
+			* sizeof(*sorted));
+	hash_seq_init(&status, slices);
+	while ((slice = (batch_slice_t *)hash_seq_search(&status)) != NULL)
+		sorted[slices_num++] = *slice;
+	qsort(sorted, slices_num, sizeof(*sorted), batch_slice_cmp);
+
+	args[0] = CStringGetTextDatum(archive->tbl);
+	args[1] = CStringGetTextDatum(archive->tscol);
+	args[2] = CStringGetTextDatum(archive->vcol);
+	args[5] = Int32GetDatum(archive->tstypmod);
+	if (archive->tstypmod < 0)
+		nulls[5] = 'n';
+
+	for (i = 0; i < (uint64)slices_num; ++i) {
+		cdata_t *data;
+		int      ret;
+
+		data = cdata_create(sorted[i].value, sorted[i].undef_num,
+				sorted[i].val_num, archive->cf);
+
+		args[3] = TimestampTzGetDatum(sorted[i].slice);
+		args[4] = PointerGetDatum(data);
+
+		ret = SPI_execute_with_args("SELECT PostRR_update_value("
+					"$1::name, NULL::name, NULL::bigint, $2::name, $3::name, "
+					"$4, NULL::text, $6, $5)",
+				6, argtypes, args, nulls,
+				/* read_only = */ false, /* count = */ 0);
+		if (ret != SPI_OK_SELECT)
+			ereport(ERROR, (
+						errmsg("failed to update %s.%s: %s", archive->tbl,
+							archive->vcol, SPI_result_code_string(ret))
+					));
+	}
+
+	pfree(sorted);
+	hash_destroy(slices);
+} /* batch_update_archive */
+
+/*
+ * row_update_archive:
+ * Update the specified archive row by row (used for archives not storing
+ * CData values). The caller has to be connected to the SPI manager.
+ */
+static void
+row_update_archive(rrtrigger_archive_t *archive,
+		TimestampTz *tstamps, float8 *values, uint64 values_num)
+{
+	Oid   argtypes[6] = { TEXTOID, TEXTOID, TEXTOID,
+		TIMESTAMPTZOID, FLOAT8OID, INT4OID };
+	Datum args[6];
+	char  nulls[6] = { ' ', ' ', ' ', ' ', ' ', ' ' };
+	uint64 i;
+
+	args[0] = CStringGetTextDatum(archive->tbl);
+	args[1] = CStringGetTextDatum(archive->tscol);
+	args[2] = CStringGetTextDatum(archive->vcol);
+	args[5] = Int32GetDatum(archive->tstypmod);
+	if (archive->tstypmod < 0)
+		nulls[5] = 'n';
+
+	for (i = 0; i < values_num; ++i) {
+		int ret;
+
+		args[3] = TimestampTzGetDatum(tstamps[i]);
+		args[4] = Float8GetDatum(values[i]);
+
+		ret = SPI_execute_with_args("SELECT PostRR_update_value("
+					"$1::name, NULL::name, NULL::bigint, $2::name, $3::name, "
+					"$4, $5::text, $6, NULL::cdata)",
+				6, argtypes, args, nulls,
+				/* read_only = */ false, /* count = */ 0);
+		if (ret != SPI_OK_SELECT)
+			ereport(ERROR, (
+						errmsg("failed to update %s.%s: %s", archive->tbl,
+							archive->vcol, SPI_result_code_string(ret))
+					));
+	}
+} /* row_update_archive */
+
+/*
+ * prototypes for PostgreSQL functions
+ */
+
+PG_FUNCTION_INFO_V1(postrr_trigger);
+
+/*
+ * public API
+ */
+
+void
+rrtrigger_update_single(const char *rraname,
+		TimestampTz *tstamps, float8 *values, uint64 values_num)
+{
+	Oid    argtypes[3] = { TEXTOID, TIMESTAMPTZOID, FLOAT8OID };
+	Datum  args[3];
+	batch_sample_t *samples;
+	uint64 i;
+
+	samples = (batch_sample_t *)palloc(Max(values_num, 1)
+			* sizeof(*samples));
+	for (i = 0; i < values_num; ++i) {
+		samples[i].tstamp = tstamps[i];
+		samples[i].value  = values[i];
+	}
+	qsort(samples, values_num, sizeof(*samples), batch_sample_cmp);
+
+	args[0] = CStringGetTextDatum(rraname);
+	for (i = 0; i < values_num; ++i) {
+		int ret;
+
+		args[1] = TimestampTzGetDatum(samples[i].tstamp);
+		args[2] = Float8GetDatum(samples[i].value);
+
+		ret = SPI_execute_with_args("SELECT PostRR_update($1, $2, $3)",
+				3, argtypes, args, /* nulls = */ NULL,
+				/* read_only = */ false, /* count = */ 0);
+		if (ret != SPI_OK_SELECT)
+			ereport(ERROR, (
+						errmsg("failed to update %s: %s", rraname,
+							SPI_result_code_string(ret))
+					));
+	}
+	pfree(samples);
+} /* rrtrigger_update_single */
+
+void
+rrtrigger_update_archive(rrtrigger_archive_t *archive,
+		TimestampTz *tstamps, float8 *values, uint64 values_num)
+{
+	if (archive->is_cdata)
+		batch_update_archive(archive, tstamps, values, values_num);
+	else
+		row_update_archive(archive, tstamps, values, values_num);
+} /* rrtrigger_update_archive */
+
+Datum
+postrr_trigger(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	TriggerData *trigdata;
+	char       **tgargs;
+
+	rrtrigger_archive_t *archives;
+	uint64           archives_num;
+
+	TimestampTz *tstamps;
+	float8      *values;
+	uint64       values_num = 0;
+
+	StringInfoData query;
+	Oid   argtypes[1] = { TEXTOID };
+	Datum args[1];
+	bool  single, single_null = false;
+	int   ret;
+	uint64 i;
+
+	if (! CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR, (
+					errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					errmsg("PostRR_trigger() not called by trigger manager")
+				));
+
+	trigdata = (TriggerData *)fcinfo->context;
+
+	if ((! TRIGGER_FIRED_AFTER(trigdata->tg_event))
+			|| (! TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event))
+			|| (! TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+			|| (! trigdata->tg_newtable))
+		ereport(ERROR, (
+					errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					errmsg("PostRR_trigger() must be fired AFTER INSERT "
+						"FOR EACH STATEMENT"),
+					errhint("Specify REFERENCING NEW TABLE AS <name> "
+						"when creating the trigger")
+				));
+
+	if (trigdata->tg_trigger->tgnargs != 3)
+		ereport(ERROR, (
+					errmsg("PostRR_trigger() expects three arguments"),
+					errhint("Usage: PostRR_trigger(rraname, tscol, vcol)")
+				));
+	tgargs = trigdata->tg_trigger->tgargs;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		ereport(ERROR, (
+					errmsg("failed to connect to the SPI manager")
+				));
+
+	ret = SPI_register_trigger_data(trigdata);
+	if (ret != SPI_OK_TD_REGISTER)
+		ereport(ERROR, (
+					errmsg("failed to register transition table: %s",
+						SPI_result_code_string(ret))
+				));
+
+	/* read all new rows */
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT CAST(%s AS timestamptz), "
+				"CAST(%s AS double precision) FROM %s",
+			quote_identifier(tgargs[1]), quote_identifier(tgargs[2]),
+			quote_identifier(trigdata->tg_trigger->tgnewtable));
+
+	ret = SPI_execute(query.data, /* read_only = */ true, /* count = */ 0);
+	if (ret != SPI_OK_SELECT)
+		ereport(ERROR, (
+					errmsg("failed to read new rows: %s",
+						SPI_result_code_string(ret))
+				));
+
+	tstamps = (TimestampTz *)palloc(Max(SPI_processed, 1)
+			* sizeof(*tstamps));
+	values  = (float8 *)palloc(Max(SPI_processed, 1) * sizeof(*values));
+
+	for (i = 0; i < (uint64)SPI_processed; ++i) {
+		HeapTuple tuple = SPI_tuptable->vals[i];
+		bool      isnull = false;
+		Datum     d;
+
+		d = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 1, &isnull);
+		if (isnull)
+			continue;
+		tstamps[values_num] = DatumGetTimestampTz(d);
+
+		d = SPI_getbinval(tuple, SPI_tuptable->tupdesc, 2, &isnull);
+		values[values_num] = isnull ? NAN : DatumGetFloat8(d);
+		++values_num;
+	}
+
+	if (! values_num) {
+		SPI_finish();
+		return PointerGetDatum(NULL);
+	}
+
+	args[0] = CStringGetTextDatum(tgargs[0]);
+	ret = SPI_execute_with_args(SINGLE_QUERY, 1, argtypes, args,
+			/* nulls = */ NULL, /* read_only = */ true, /* count = */ 1);
+	if ((ret != SPI_OK_SELECT) || (SPI_processed != 1))
+		ereport(ERROR, (
+					errmsg("failed to determine data source of %s: %s",
+						tgargs[0], SPI_result_code_string(ret))
+				));
+
+	single = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+				SPI_tuptable->tupdesc, 1, &single_null));
+	if (single) {
+		/* this updates all archives of the rraname */
+		rrtrigger_update_single(tgargs[0], tstamps, values, values_num);
+		SPI_finish();
+		return PointerGetDatum(NULL);
+	}
+
+	/* determine all archives to be updated */
+	ret = SPI_execute_with_args(ARCHIVES_QUERY, 1, argtypes, args,
+			/* nulls = */ NULL, /* read_only = */ true, /* count = */ 0);
+	if (ret != SPI_OK_SELECT)
+		ereport(ERROR, (
+					errmsg("failed to determine archives of %s: %s",
+						tgargs[0], SPI_result_code_string(ret))
+				));
+
+	archives_num = (uint64)SPI_processed;
+	archives = (rrtrigger_archive_t *)palloc0(Max(archives_num, 1)
+			* sizeof(*archives));
+
+	for (i = 0; i < archives_num; ++i) {
+		HeapTuple tuple = SPI_tuptable->vals[i];
+		TupleDesc tupdesc = SPI_tuptable->tupdesc;
+		bool      isnull = false;
+		int32     typmod;
+
+		archives[i].tbl   = SPI_getvalue(tuple, tupdesc, 1);
+		archives[i].tscol = SPI_getvalue(tuple, tupdesc, 2);
+		archives[i].vcol  = SPI_getvalue(tuple, tupdesc, 3);
+		archives[i].len   = DatumGetInt64(SPI_getbinval(tuple, tupdesc,
+					4, &isnull));
+		archives[i].num   = DatumGetInt32(SPI_getbinval(tuple, tupdesc,
+					5, &isnull));
+		archives[i].is_cdata = DatumGetBool(SPI_getbinval(tuple, tupdesc,
+					6, &isnull));
+
+		typmod = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 7, &isnull));
+		archives[i].cf = (typmod > 0) ? typmod : 0;
+
+		archives[i].tstypmod = DatumGetInt32(SPI_getbinval(tuple, tupdesc,
+					8, &isnull));
+	}
+
+	for (i = 0; i < archives_num; ++i)
+		rrtrigger_update_archive(&archives[i], tstamps, values, values_num);
+
+	SPI_finish();
+	return PointerGetDatum(NULL);
+#else /* PG_VERSION_NUM < 100000 */
+	ereport(ERROR, (
+				errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				errmsg("PostRR_trigger() requires PostgreSQL 10 or later")
+			));
+	return PointerGetDatum(NULL);
+#endif /* PG_VERSION_NUM */
+} /* postrr_trigger */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
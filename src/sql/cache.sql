@@ -0,0 +1,31 @@
+-- latest value cache
+--
+-- Archives sharing a table must not share their cache entries, and deleted
+-- or truncated slices must not be served from the cache.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+CREATE TABLE cache_multi (ts1 rrtimeslice(60, 10), v1 cdata,
+	ts2 rrtimeslice(300, 10), v2 cdata);
+INSERT INTO postrr.rrarchives (rraname, tbl, tscol, vcol)
+	VALUES ('cache1', 'cache_multi', 'ts1', 'v1'),
+		('cache2', 'cache_multi', 'ts2', 'v2');
+SELECT PostRR_cache_watch('cache_multi', 'ts1', 'v1', NULL);
+SELECT PostRR_cache_watch('cache_multi', 'ts2', 'v2', NULL);
+
+SELECT PostRR_update('cache_multi', 'ts1', 'v1',
+	'2020-01-01 00:00:30+00', 1)::text AS value;
+SELECT PostRR_update('cache_multi', 'ts2', 'v2',
+	'2020-01-01 00:00:30+00', 2)::text AS value;
+
+-- each archive returns its own value
+SELECT value::text FROM PostRR_latest('cache_multi', 'ts1', 'v1');
+SELECT value::text FROM PostRR_latest('cache_multi', 'ts2', 'v2');
+
+DELETE FROM cache_multi WHERE ts1 IS NOT NULL;
+SELECT value::text FROM PostRR_latest('cache_multi', 'ts1', 'v1');
+SELECT value::text FROM PostRR_latest('cache_multi', 'ts2', 'v2');
+
+TRUNCATE cache_multi;
+SELECT value::text FROM PostRR_latest('cache_multi', 'ts2', 'v2');
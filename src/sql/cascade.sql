@@ -0,0 +1,37 @@
+-- PostRR_cascade()
+--
+-- After an outage longer than a ring of the cascaded archive, a single pass
+-- must not consolidate slices of several cycles of the ring into one slice.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('cascade', 'cascade_fine', 60, 180);
+	PERFORM PostRR_create_archive('cascade', 'cascade_coarse', 600, 4);
+END;
+$$;
+UPDATE postrr.rrarchives SET cascade = true WHERE tbl = 'cascade_coarse';
+
+-- run in a single transaction, such that now() does not change
+BEGIN;
+SELECT count(*) AS updates
+	FROM generate_series(150, 1, -1) AS n,
+		PostRR_update('cascade', now() - n * interval '1 minute', 1);
+UPDATE postrr.rrarchives SET cascaded_until = now() - interval '2 hours'
+	WHERE tbl = 'cascade_coarse';
+SELECT PostRR_cascade('cascade', 'cascade_coarse', 'ts', 'value', 100)
+	AS slices;
+COMMIT;
+
+-- each slice holds the ten values of the most recent cycle only
+SELECT count(*) AS slices, bool_and(value::text = '1 (AVG U:0/10)') AS ok
+	FROM cascade_coarse;
+SELECT cascaded_until = (SELECT max(Tstamptz(ts)) FROM cascade_coarse)
+		AS ok
+	FROM postrr.rrarchives WHERE tbl = 'cascade_coarse';
+
+-- nothing left to do
+SELECT PostRR_cascade('cascade', 'cascade_coarse', 'ts', 'value', 100)
+	AS slices;
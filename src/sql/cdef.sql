@@ -0,0 +1,45 @@
+-- PostRR_cdef()
+--
+-- Compile errors and the semantics of undefined values (as in RRDtool).
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('cdef_rx', 'cdef_rx', 60, 10);
+	PERFORM PostRR_create_archive('cdef_tx', 'cdef_tx', 60, 10);
+	PERFORM PostRR_update('cdef_rx', '2020-01-01 00:00:30+00', 1);
+	PERFORM PostRR_update('cdef_rx', '2020-01-01 00:02:30+00', 3);
+	PERFORM PostRR_update('cdef_tx', '2020-01-01 00:00:30+00', 10);
+	PERFORM PostRR_update('cdef_tx', '2020-01-01 00:01:30+00', 20);
+END;
+$$;
+
+CREATE FUNCTION cdef_test(text,
+		OUT secs bigint, OUT value double precision)
+	RETURNS SETOF record
+	LANGUAGE sql
+	AS $$
+	SELECT extract(epoch FROM tstamp)::bigint - 1577836800, value
+		FROM PostRR_cdef($1, '{cdef_rx,cdef_tx}',
+			'2020-01-01 00:01:00+00', '2020-01-01 00:03:00+00', 3)
+		ORDER BY 1;
+$$;
+
+-- undefined values propagate
+SELECT * FROM cdef_test('cdef_rx,cdef_tx,+');
+SELECT * FROM cdef_test('$1,2,GT,100,0,IF');
+
+-- ... except through UN, ISINF, ADDNAN and MAXNAN
+SELECT * FROM cdef_test('$1,UN');
+SELECT * FROM cdef_test('cdef_rx,INF,*,ISINF');
+SELECT * FROM cdef_test('cdef_rx,cdef_tx,ADDNAN');
+SELECT * FROM cdef_test('UNKN,cdef_rx,MAXNAN');
+
+-- compile errors
+SELECT * FROM cdef_test('cdef_rx,+');
+SELECT * FROM cdef_test('cdef_rx,FOO');
+SELECT * FROM cdef_test('$3,1,+');
+SELECT * FROM cdef_test('cdef_rx,cdef_tx');
+SELECT * FROM cdef_test('cdef_rx,,1,+');
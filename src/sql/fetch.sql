@@ -0,0 +1,32 @@
+-- PostRR_fetch()
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('fetch', 'fetch_data', 60, 10);
+	PERFORM PostRR_update('fetch', '2020-01-01 00:00:30+00', 1);
+	PERFORM PostRR_update('fetch', '2020-01-01 00:02:30+00', 3);
+END;
+$$;
+
+-- the slice in between is missing
+SELECT value::float8 AS value
+	FROM PostRR_fetch('fetch_data', 'ts', 'value',
+		'2020-01-01 00:00:30+00', '2020-01-01 00:02:30+00', 'none');
+SELECT value::float8 AS value
+	FROM PostRR_fetch('fetch_data', 'ts', 'value',
+		'2020-01-01 00:00:30+00', '2020-01-01 00:02:30+00', 'last');
+SELECT value::float8 AS value
+	FROM PostRR_fetch('fetch_data', 'ts', 'value',
+		'2020-01-01 00:00:30+00', '2020-01-01 00:02:30+00', 'linear');
+
+-- missing slices at the start of the window are filled based on the slice
+-- stored before the window
+SELECT value::float8 AS value
+	FROM PostRR_fetch('fetch_data', 'ts', 'value',
+		'2020-01-01 00:01:30+00', '2020-01-01 00:02:30+00', 'last');
+SELECT value::float8 AS value
+	FROM PostRR_fetch('fetch_data', 'ts', 'value',
+		'2020-01-01 00:01:30+00', '2020-01-01 00:02:30+00', 'linear');
@@ -0,0 +1,27 @@
+-- Holt-Winters forecasts
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+SELECT PostRR_create_forecast('fc', interval '500 milliseconds',
+	interval '2 seconds', 0.5, 0.5, 0.5);
+SELECT PostRR_create_forecast('fc_secs', 60, 10, 0.5, 0.5, 0.5);
+SELECT PostRR_create_forecast('fc_bad', interval '1 second',
+	interval '1.5 seconds', 0.5, 0.5, 0.5);
+SELECT rraname, tslen, season FROM postrr.rrforecasts ORDER BY rraname;
+
+-- sub-second slices
+DO $$
+BEGIN
+	PERFORM PostRR_update('fc', '2020-01-01 00:00:00.1+00', 10);
+	PERFORM PostRR_update('fc', '2020-01-01 00:00:00.6+00', 10);
+	PERFORM PostRR_update('fc', '2020-01-01 00:00:01.1+00', 10);
+	PERFORM PostRR_update('fc', '2020-01-01 00:00:01.2+00', 10);
+	PERFORM PostRR_update('fc', '2020-01-01 00:00:01.6+00', 10);
+END;
+$$;
+
+SELECT cur_slice = '2020-01-01 00:00:02+00' AS cur_slice_end, cur_num,
+		level, trend
+	FROM postrr.rrforecasts WHERE rraname = 'fc';
+SELECT * FROM PostRR_predict('fc', '2020-01-01 00:00:02.1+00');
@@ -0,0 +1,111 @@
+-- PostRR_import_rrd()
+--
+-- Each RRA is imported into its own archives, even if two RRAs share the
+-- consolidation function and step, and the values use the RRA's
+-- consolidation function.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+SELECT PostRR_import_rrd('imp', convert_to($$<?xml version="1.0" encoding="utf-8"?>
+<!DOCTYPE rrd SYSTEM "https://oss.oetiker.ch/rrdtool/rrdtool.dtd">
+<!-- Round Robin Database Dump -->
+<rrd>
+	<version>0003</version>
+	<step>60</step> <!-- Seconds -->
+	<lastupdate>1577837040</lastupdate> <!-- 2020-01-01 00:04:00 UTC -->
+	<ds>
+		<name> in </name>
+		<type> GAUGE </type>
+		<minimal_heartbeat>120</minimal_heartbeat>
+		<min>NaN</min>
+		<max>NaN</max>
+	</ds>
+	<ds>
+		<name> out </name>
+		<type> GAUGE </type>
+		<minimal_heartbeat>120</minimal_heartbeat>
+		<min>NaN</min>
+		<max>NaN</max>
+	</ds>
+	<!-- Round Robin Archives -->
+	<rra>
+		<cf>AVERAGE</cf>
+		<pdp_per_row>1</pdp_per_row> <!-- 60 seconds -->
+		<params><xff>5.0000000000e-01</xff></params>
+		<cdp_prep>
+			<ds><value>NaN</value><unknown_datapoints>0</unknown_datapoints></ds>
+			<ds><value>NaN</value><unknown_datapoints>0</unknown_datapoints></ds>
+		</cdp_prep>
+		<database>
+			<!-- 2020-01-01 00:01:00 UTC / 1577836860 --> <row><v>1.0000000000e+00</v><v>1.0000000000e+01</v></row>
+			<!-- 2020-01-01 00:02:00 UTC / 1577836920 --> <row><v>NaN</v><v>2.0000000000e+01</v></row>
+			<!-- 2020-01-01 00:03:00 UTC / 1577836980 --> <row><v>3.0000000000e+00</v><v>3.0000000000e+01</v></row>
+			<!-- 2020-01-01 00:04:00 UTC / 1577837040 --> <row><v>4.0000000000e+00</v><v>4.0000000000e+01</v></row>
+		</database>
+	</rra>
+	<rra>
+		<cf>AVERAGE</cf>
+		<pdp_per_row>1</pdp_per_row> <!-- 60 seconds -->
+		<params><xff>5.0000000000e-01</xff></params>
+		<cdp_prep>
+			<ds><value>NaN</value><unknown_datapoints>0</unknown_datapoints></ds>
+			<ds><value>NaN</value><unknown_datapoints>0</unknown_datapoints></ds>
+		</cdp_prep>
+		<database>
+			<!-- 2020-01-01 00:03:00 UTC / 1577836980 --> <row><v>3.0000000000e+00</v><v>3.0000000000e+01</v></row>
+			<!-- 2020-01-01 00:04:00 UTC / 1577837040 --> <row><v>4.0000000000e+00</v><v>4.0000000000e+01</v></row>
+		</database>
+	</rra>
+	<rra>
+		<cf>MAX</cf>
+		<pdp_per_row>2</pdp_per_row> <!-- 120 seconds -->
+		<params><xff>5.0000000000e-01</xff></params>
+		<cdp_prep>
+			<ds><value>NaN</value><unknown_datapoints>0</unknown_datapoints></ds>
+			<ds><value>NaN</value><unknown_datapoints>0</unknown_datapoints></ds>
+		</cdp_prep>
+		<database>
+			<!-- 2020-01-01 00:02:00 UTC / 1577836920 --> <row><v>2.0000000000e+00</v><v>2.0000000000e+01</v></row>
+			<!-- 2020-01-01 00:04:00 UTC / 1577837040 --> <row><v>4.0000000000e+00</v><v>4.0000000000e+01</v></row>
+		</database>
+	</rra>
+</rrd>
+$$, 'UTF8'));
+
+SELECT r.rraname, r.tbl, format_type(a.atttypid, a.atttypmod) AS vtype
+	FROM postrr.rrarchives r
+		JOIN pg_attribute a
+			ON a.attrelid = r.tbl::text::regclass AND a.attname = r.vcol
+	WHERE r.rraname LIKE 'imp\_%'
+	ORDER BY r.tbl;
+
+SELECT tableoid::regclass::text AS tbl,
+		extract(epoch FROM ts::timestamptz)::bigint - 1577836800 AS secs,
+		value
+	FROM (SELECT tableoid, * FROM imp_in_avg_60_0
+		UNION ALL SELECT tableoid, * FROM imp_in_avg_60_1
+		UNION ALL SELECT tableoid, * FROM imp_in_max_120_2
+		UNION ALL SELECT tableoid, * FROM imp_out_avg_60_0
+		UNION ALL SELECT tableoid, * FROM imp_out_avg_60_1
+		UNION ALL SELECT tableoid, * FROM imp_out_max_120_2) AS t
+	ORDER BY tbl, secs;
+
+-- more rows than are inserted in a single batch
+SELECT PostRR_import_rrd('impbig', convert_to('<rrd>
+	<step>60</step>
+	<lastupdate>' || 1577836800 + 2500 * 60 || '</lastupdate>
+	<ds><name>value</name><type>GAUGE</type></ds>
+	<rra>
+		<cf>AVERAGE</cf>
+		<pdp_per_row>1</pdp_per_row>
+		<database>
+' || (SELECT string_agg('<!-- / ' || 1577836800 + i * 60 || ' -->'
+			|| ' <row><v>' || i || '</v></row>', E'\n' ORDER BY i)
+		FROM generate_series(1, 2500) AS i) || '
+		</database>
+	</rra>
+</rrd>', 'UTF8'));
+
+SELECT count(*), min(value::float8), max(value::float8), sum(value::float8)
+	FROM impbig_value_avg_60_0;
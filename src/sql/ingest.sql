@@ -0,0 +1,59 @@
+-- PostRR_ingest()
+--
+-- Graphite and PUTVAL lines; malformed lines reject the whole batch.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('ing_load', 'ing_load', 60, 10);
+	PERFORM PostRR_create_archive('ing_rx', 'ing_rx', 60, 10);
+	PERFORM PostRR_create_archive('ing_tx', 'ing_tx', 60, 10);
+	PERFORM PostRR_create_archive('ing_disk', 'ing_disk', 60, 10);
+	PERFORM PostRR_create_archive('ing_now', 'ing_now', 60, 10);
+END;
+$$;
+
+INSERT INTO postrr.rrmetrics (path, rraname) VALUES
+	('servers.web1.load', 'ing_load'),
+	('web1/interface-eth0/if_octets/0', 'ing_rx'),
+	('web1/interface-eth0/if_octets/1', 'ing_tx'),
+	('web1/disk sda/disk_ops', 'ing_disk'),
+	('web1/now', 'ing_now');
+
+-- multi-value lists, quoted identifiers and undefined values ('U')
+SELECT PostRR_ingest(E'# Graphite\n'
+	'servers.web1.load 1.5 1577836830\n'
+	'servers.web1.load 2.5 1577836850\n'
+	'\n'
+	'# PUTVAL\n'
+	'PUTVAL web1/interface-eth0/if_octets interval=10 '
+		'1577836830:100:200 1577836840:U:400\n'
+	'PUTVAL "web1/disk sda/disk_ops" 1577836830:5 1577836835:U\n'
+	'PUTVAL web1/now N:7\n');
+
+SELECT tableoid::regclass::text AS tbl,
+		extract(epoch FROM ts::timestamptz)::bigint - 1577836800 AS secs,
+		value
+	FROM (SELECT tableoid, * FROM ing_load
+		UNION ALL SELECT tableoid, * FROM ing_rx
+		UNION ALL SELECT tableoid, * FROM ing_tx
+		UNION ALL SELECT tableoid, * FROM ing_disk) AS t
+	ORDER BY tbl, secs;
+
+-- 'N' refers to the current time
+SELECT value FROM ing_now;
+
+-- malformed lines
+SELECT PostRR_ingest(E'servers.web1.load 3 1577836890\n'
+	'servers.web1.load 3\n');
+SELECT count(*) FROM ing_load;
+SELECT PostRR_ingest('servers.web1.load 3 1577836890 1');
+SELECT PostRR_ingest('servers.web1.load abc 1577836890');
+SELECT PostRR_ingest('servers.web1.load 3 99999999999999');
+SELECT PostRR_ingest('PUTVAL web1/now');
+SELECT PostRR_ingest('PUTVAL "web1/now 1577836890:1');
+SELECT PostRR_ingest('PUTVAL web1/now 1577836890');
+SELECT PostRR_ingest('PUTVAL web1/now abc:1');
+SELECT PostRR_ingest('PUTVAL web1/now 1577836890:1:x');
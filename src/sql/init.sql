@@ -0,0 +1,7 @@
+-- PostRR regression tests
+--
+-- Load the extension used by all other tests.
+
+SET client_min_messages = warning;
+
+CREATE EXTENSION postrr;
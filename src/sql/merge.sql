@@ -0,0 +1,39 @@
+-- PostRR_merge_archive()
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('merge', 'merge_dst', 60, 10);
+	PERFORM PostRR_update('merge', '2020-01-01 00:00:30+00', 1);
+	PERFORM PostRR_update('merge', '2020-01-01 00:01:30+00', 1);
+	PERFORM PostRR_update('merge', '2020-01-01 00:12:30+00', 1);
+END;
+$$;
+
+-- the same slice, a newer slice, an older slice and an empty position
+CREATE TABLE merge_src (LIKE merge_dst);
+INSERT INTO merge_src VALUES
+	('2020-01-01 00:00:30+00', '2'),
+	('2020-01-01 00:11:30+00', '3'),
+	('2020-01-01 00:02:30+00', '4'),
+	('2020-01-01 00:03:30+00', '5');
+
+SELECT * FROM PostRR_merge_archive('merge_src', 'merge_dst');
+SELECT count(*) AS slices FROM merge_dst;
+
+-- tables holding several archives
+CREATE TABLE merge_multi (ts1 rrtimeslice(60, 10), v1 cdata,
+	ts2 rrtimeslice(60, 10), v2 cdata);
+INSERT INTO postrr.rrarchives (rraname, tbl, tscol, vcol)
+	VALUES ('merge1', 'merge_multi', 'ts1', 'v1'),
+		('merge2', 'merge_multi', 'ts2', 'v2');
+CREATE TABLE merge_multi_src (LIKE merge_multi);
+INSERT INTO merge_multi_src VALUES
+	('2020-01-01 00:00:30+00', '7', '2020-01-01 00:00:30+00', '8');
+
+SELECT * FROM PostRR_merge_archive('merge_multi_src', 'merge_multi');
+SELECT * FROM PostRR_merge_archive('merge_multi_src', 'merge_multi',
+	'ts1', 'v1');
+SELECT v1::float8 AS v1, v2::float8 AS v2 FROM merge_multi;
@@ -0,0 +1,43 @@
+-- partitioned archives (PostRR_create_archive(..., method, partitions))
+--
+-- Updates wrapping around the ring have to replace the old slice in the
+-- partition holding its position.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+DECLARE
+	i integer;
+BEGIN
+	PERFORM PostRR_create_archive('part_range', 'part_range', 60, 4, false,
+		'range', 2);
+	PERFORM PostRR_create_archive('part_hash', 'part_hash', 60, 4, false,
+		'hash', 2);
+
+	-- six slices, overwriting the first two positions
+	FOR i IN 1 .. 6 LOOP
+		PERFORM PostRR_update('part_range',
+			'2020-01-01 00:00:30+00'::timestamptz + (i - 1) * interval '1m', i);
+		PERFORM PostRR_update('part_hash',
+			'2020-01-01 00:00:30+00'::timestamptz + (i - 1) * interval '1m', i);
+	END LOOP;
+END;
+$$;
+
+-- range partitions hold consecutive positions
+SELECT tableoid::regclass::text AS part, RRTimeslice_seq(ts) AS seq,
+		extract(epoch FROM ts::timestamptz)::bigint - 1577836800 AS secs,
+		value::float8 AS value
+	FROM part_range
+	ORDER BY seq;
+
+-- each position is stored once, in the partition matching its hash
+SELECT RRTimeslice_seq(ts) AS seq,
+		extract(epoch FROM ts::timestamptz)::bigint - 1577836800 AS secs,
+		value::float8 AS value,
+		satisfies_hash_partition('part_hash'::regclass, 2,
+			CASE WHEN tableoid = 'part_hash_p0'::regclass THEN 0 ELSE 1 END,
+			RRTimeslice_seq(ts)) AS in_partition
+	FROM part_hash
+	ORDER BY seq;
@@ -0,0 +1,52 @@
+-- PostRR_resize_archive()
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('resize', 'resize_data', 60, 10);
+	PERFORM PostRR_update('resize', '2020-01-01 00:00:30+00', 1);
+	PERFORM PostRR_update('resize', '2020-01-01 00:01:30+00', 3);
+	PERFORM PostRR_update('resize', '2020-01-01 00:02:30+00', 5);
+END;
+$$;
+
+-- privileges, comments, user triggers and dependent views are carried over
+CREATE ROLE postrr_resize_reader NOLOGIN;
+GRANT SELECT ON resize_data TO postrr_resize_reader;
+COMMENT ON TABLE resize_data IS 'resized archive';
+
+CREATE FUNCTION resize_noop() RETURNS trigger
+	LANGUAGE plpgsql AS $$ BEGIN RETURN NEW; END; $$;
+CREATE TRIGGER resize_user BEFORE INSERT ON resize_data
+	FOR EACH ROW EXECUTE PROCEDURE resize_noop();
+ALTER TABLE resize_data DISABLE TRIGGER resize_user;
+
+CREATE VIEW resize_values AS
+	SELECT Tstamptz(ts) AS tstamp, value::float8 AS value FROM resize_data;
+CREATE VIEW resize_count AS
+	SELECT count(*) AS slices FROM resize_values;
+GRANT SELECT ON resize_count TO postrr_resize_reader;
+
+SELECT PostRR_resize_archive('resize', 'resize_data', 120, 5);
+
+SELECT value FROM resize_values ORDER BY tstamp;
+SELECT * FROM resize_count;
+
+SELECT has_table_privilege('postrr_resize_reader', 'resize_data', 'SELECT')
+		AS tbl_select,
+	has_table_privilege('postrr_resize_reader', 'resize_count', 'SELECT')
+		AS view_select,
+	obj_description('resize_data'::regclass, 'pg_class') AS descr;
+
+SELECT tgname, tgenabled FROM pg_catalog.pg_trigger
+	WHERE tgrelid = 'resize_data'::regclass ORDER BY tgname;
+
+-- materialized views cannot be re-created
+CREATE MATERIALIZED VIEW resize_mat AS SELECT * FROM resize_data;
+SELECT PostRR_resize_archive('resize', 'resize_data', 240, 5);
+DROP MATERIALIZED VIEW resize_mat;
+
+DROP TABLE resize_data CASCADE;
+DROP ROLE postrr_resize_reader;
@@ -0,0 +1,34 @@
+-- data source types (postrr.rrsources)
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('src_counter', 'src_counter', 60, 10);
+	INSERT INTO postrr.rrsources (rraname, dstype)
+		VALUES ('src_counter', 'COUNTER');
+	PERFORM PostRR_update('src_counter', '2020-01-01 00:00:30+00', 100);
+	PERFORM PostRR_update('src_counter', '2020-01-01 00:01:30+00', 160);
+END;
+$$;
+
+-- the rate (per second) is stored rather than the raw value
+SELECT value::float8 AS value
+	FROM PostRR_fetch('src_counter', 'ts', 'value',
+		'2020-01-01 00:01:30+00', '2020-01-01 00:01:30+00', 'none');
+
+-- raw values must not end up in vector or multi-series archives
+CREATE TABLE src_vector (ts rrtimeslice(60, 10), value cvector);
+INSERT INTO postrr.rrarchives (rraname, tbl, tscol, vcol)
+	VALUES ('src_vector', 'src_vector', 'ts', 'value');
+INSERT INTO postrr.rrsources (rraname, dstype)
+	VALUES ('src_vector', 'DERIVE');
+SELECT PostRR_update('src_vector', '2020-01-01 00:00:30+00',
+	ARRAY[1, 2]::float8[]);
+
+SELECT PostRR_create_archive('src_series', 'src_series', 60, 10, true);
+INSERT INTO postrr.rrsources (rraname, dstype)
+	VALUES ('src_series', 'ABSOLUTE');
+SELECT PostRR_update('src_series', 1, '2020-01-01 00:00:30+00', 5);
+SELECT count(*) AS slices FROM src_series;
@@ -0,0 +1,22 @@
+-- RRTimeslice spec cache
+--
+-- Specs are looked up using SPI once per backend only.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+CREATE TABLE specs_data (ts rrtimeslice(60, 10));
+INSERT INTO specs_data VALUES ('2020-01-01 00:00:30+00'),
+	('2020-01-01 00:01:30+00');
+
+DO $$
+BEGIN
+	PERFORM PostRR_stat_reset();
+END;
+$$;
+
+SELECT count(*) AS slices FROM specs_data WHERE ts::text IS NOT NULL;
+SELECT count(*) AS slices FROM specs_data WHERE ts::text IS NOT NULL;
+SELECT lookups > 0 AS lookups, cache_hits = lookups AS cached,
+		spi_lookups AS spi
+	FROM postrr.stat_specs;
@@ -0,0 +1,65 @@
+-- PostRR_topk()
+--
+-- Pruning must not change the result: cascaded summary archives lagging
+-- behind the window may not be used for bounds, and rranames with
+-- multi-series archives are skipped.
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+-- a past window spanning the boundary of two 10 minute slices
+CREATE TEMP TABLE topk_window AS
+	SELECT to_timestamp(floor(extract(epoch FROM now()) / 600) * 600 - 3600)
+		AS b;
+
+DO $$
+BEGIN
+	PERFORM PostRR_create_archive('topk_a', 'topk_a_fine', 60, 1440);
+	PERFORM PostRR_create_archive('topk_b', 'topk_b_fine', 60, 1440);
+	PERFORM PostRR_create_archive('topk_c', 'topk_c_fine', 60, 1440);
+	PERFORM PostRR_create_archive('topk_d', 'topk_d_fine', 60, 1440);
+	PERFORM PostRR_create_archive('topk_d', 'topk_d_multi', 120, 720, true);
+END;
+$$;
+
+-- MAX summaries: topk_b's has been cascaded up to the boundary only
+CREATE TABLE topk_b_max (ts rrtimeslice(600, 144) NOT NULL,
+	value cdata('MAX'));
+CREATE TABLE topk_c_max (ts rrtimeslice(600, 144) NOT NULL,
+	value cdata('MAX'));
+INSERT INTO postrr.rrarchives (rraname, tbl, tscol, vcol, cascade,
+		cascaded_until)
+	SELECT 'topk_b', 'topk_b_max', 'ts', 'value', true, b FROM topk_window;
+INSERT INTO postrr.rrarchives (rraname, tbl, tscol, vcol)
+	VALUES ('topk_c', 'topk_c_max', 'ts', 'value');
+
+-- topk_b peaks after the boundary, topk_d would win if it was not skipped
+DO $$
+DECLARE
+	b timestamptz;
+	n integer;
+BEGIN
+	SELECT w.b INTO b FROM topk_window AS w;
+	FOR n IN 0 .. 9 LOOP
+		PERFORM PostRR_update('topk_a', b + (n * 60 - 270) * interval '1s',
+			10);
+		PERFORM PostRR_update('topk_b', b + (n * 60 - 270) * interval '1s',
+			CASE WHEN n = 6 THEN 100 ELSE 1 END);
+		PERFORM PostRR_update('topk_c', b + (n * 60 - 270) * interval '1s',
+			5);
+		PERFORM PostRR_update('topk_d', b + (n * 60 - 270) * interval '1s',
+			1000);
+	END LOOP;
+END;
+$$;
+INSERT INTO topk_b_max SELECT b, '1' FROM topk_window;
+
+SELECT t.rraname
+	FROM topk_window AS w, PostRR_topk('topk%', w.b - interval '150s',
+		w.b + interval '150s', 1, false) AS t;
+SELECT t.rraname
+	FROM topk_window AS w, PostRR_topk('topk%', w.b - interval '150s',
+		w.b + interval '150s', 1, true) AS t;
+SELECT array_agg(t.rraname) AS rranames
+	FROM topk_window AS w, PostRR_topk('topk%', w.b - interval '150s',
+		w.b + interval '150s', 3, true) AS t;
@@ -0,0 +1,36 @@
+-- PostRR_trigger()
+
+\set VERBOSITY terse
+SET client_min_messages = warning;
+
+CREATE TABLE trg_raw (ts timestamptz, value float8);
+
+SELECT PostRR_create_archive('trg_gauge', 'trg_gauge', 60, 10);
+CREATE TRIGGER trg_gauge AFTER INSERT ON trg_raw
+	REFERENCING NEW TABLE AS new_rows
+	FOR EACH STATEMENT
+	EXECUTE PROCEDURE PostRR_trigger('trg_gauge', 'ts', 'value');
+
+SELECT PostRR_create_archive('trg_counter', 'trg_counter', 60, 10);
+INSERT INTO postrr.rrsources (rraname, dstype)
+	VALUES ('trg_counter', 'COUNTER');
+CREATE TRIGGER trg_counter AFTER INSERT ON trg_raw
+	REFERENCING NEW TABLE AS new_rows
+	FOR EACH STATEMENT
+	EXECUTE PROCEDURE PostRR_trigger('trg_counter', 'ts', 'value');
+
+INSERT INTO trg_raw VALUES
+	('2020-01-01 00:01:30+00', 160),
+	('2020-01-01 00:00:30+00', 100),
+	('2020-01-01 00:00:50+00', 120);
+
+-- consolidated per slice
+SELECT value::float8 AS value
+	FROM PostRR_fetch('trg_gauge', 'ts', 'value',
+		'2020-01-01 00:00:30+00', '2020-01-01 00:01:30+00', 'none');
+
+-- converted to rates in chronological order, as PostRR_update() does
+SELECT value::float8 AS value
+	FROM PostRR_fetch('trg_counter', 'ts', 'value',
+		'2020-01-01 00:01:30+00', '2020-01-01 00:01:30+00', 'none');
+SELECT last_value FROM postrr.rrsources WHERE rraname = 'trg_counter';